@@ -0,0 +1,67 @@
+/**
+ * @file   aio.hpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Mon Oct 19 19:12:37 2026
+ *
+ * @brief  Batched I/O of the child: file writes of the request are queued
+ *         and submitted at once together with the reply send. io_uring is
+ *         used if compiled with liburing and the kernel supports it, plain
+ *         write(2)/sendmsg(2) otherwise.
+ *
+ */
+
+#ifndef __AIO_HPP__
+#define __AIO_HPP__
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#define AIO_QUEUE 64 // ring size, queued files limit
+
+struct ioStats_t {
+    unsigned long syscalls; // I/O system calls made, including close(2)
+    unsigned long batches;  // io_uring submissions
+    unsigned long ops;      // file writes and sends
+    unsigned long bytes;    // bytes written and sent
+};
+
+class CIoBatch {
+    struct ioOp_t {
+        int fd;
+        int error;           // errno of the failed write
+        std::string path;
+        std::string data;
+        size_t done;         // bytes written already
+        bool submitted;      // passed to the ring
+    };
+    std::vector<ioOp_t> m_ops;
+    ioStats_t m_stats;
+    bool m_uring;            // io_uring is operational
+#ifdef HAVE_LIBURING
+    struct io_uring m_ring;
+    ssize_t submitUring(int sendfd, struct msghdr *msg);
+#endif
+    int complete();
+public:
+    CIoBatch();
+    ~CIoBatch();
+    bool init(bool useUring);
+    void shutdown();
+    int writeFile(const std::string& path, std::string& data);
+    int submit();
+    bool sendv(int fd, struct iovec *iov, int iovcnt);
+    inline bool is_uring() const { return m_uring; }
+    inline const ioStats_t& get_stats() const { return m_stats; }
+    inline void resetStats() { memset(&m_stats, 0, sizeof(m_stats)); }
+};
+
+extern CIoBatch ioBatch;
+
+#endif // #ifndef __AIO_HPP__
@@ -51,6 +51,10 @@ int Send(int fd, const void *ptr, size_t nbytes, int flags);
 int Setsockopt(int fd, int level, int optname, const void *optval, socklen_t optlen);
 int Socket(int family, int type, int protocol);
 
+/* descriptor passing over unix domain socket (SCM_RIGHTS) */
+int sendFd(int chan, int fd, char tag);
+int recvFd(int chan, char *tag);
+
 #endif // #ifndef __APPUTILS_HPP__
 
 
@@ -0,0 +1,66 @@
+/**
+ * @file   cachelistener.hpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Sat Oct 24 10:32:51 2026
+ *
+ * @brief  Master connection listening for the state cache invalidations.
+ *         NOTIFY payload is a comma separated list of the tags, the empty
+ *         payload invalidates the tag named as the channel:
+ *
+ *   [statecache]
+ *   listen = testdb                ; postgresql section to connect to
+ *   channels = prices, cache       ; LISTEN on them
+ *   listen_timeout = 3             ; s, connect timeout, master waits for it
+ *
+ *   NOTIFY prices;   SELECT pg_notify('cache', 'prices,currency');
+ *
+ * The tags lose their entries when the connection is restored, as the
+ * notifications sent meanwhile are lost.
+ *
+ */
+
+#ifndef __CACHELISTENER_HPP__
+#define __CACHELISTENER_HPP__
+
+#include <ctime>
+#include <string>
+#include <vector>
+#include <pqxx/pqxx>
+
+#define LISTEN_BACKOFF_MAX 60    // s, between the connection attempts
+#define LISTEN_CONNECT_TIMEOUT 3  // s, libpq connect_timeout
+
+class CCacheListener {
+    class CReceiver: public pqxx::notification_receiver {
+        CCacheListener *m_listener;
+    public:
+        CReceiver(CCacheListener *listener, pqxx::connection_base& conn, const std::string& channel):
+            pqxx::notification_receiver(conn, channel), m_listener(listener) {}
+        virtual void operator()(const std::string& payload, int pid);
+    };
+    std::string m_connectString;
+    std::vector<std::string> m_channels;
+    pqxx::connection *m_connection;     // master only, the children do not touch it
+    std::vector<CReceiver*> m_receivers;
+    time_t m_retryAt;
+    unsigned m_backoff;                 // s
+    unsigned long m_notifications;
+    unsigned long m_invalidations;
+    unsigned long m_reconnects;
+    void connect();
+    void drop();
+    void notified(const std::string& channel, const std::string& payload);
+public:
+    CCacheListener();
+    bool create();
+    void destroy();
+    void check();
+    void receive();
+    void wait(unsigned seconds);
+    void logStats();
+    int fd() const;
+};
+
+extern CCacheListener cacheListener;
+
+#endif // #ifndef __CACHELISTENER_HPP__
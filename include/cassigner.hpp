@@ -21,6 +21,8 @@
 class CAssigner {
     std::map<std::string, char *> m_symTable;
     memcached_st *m_mcached;
+    mutable std::map<std::string, int> m_flights;  // global misses this child is to fill
+    void landFlight(const std::string& var);
 public:
     char *getGlobal(const std::string& var) const;
     char *getLocal(const std::string& var) const;
@@ -28,6 +30,7 @@ public:
     explicit CAssigner(const std::string& libmemcachedconfig);
     virtual ~CAssigner();
     void resetTable();
+    void landFlights();
     const char *assignGlobal(const std::string& var, const char *val);
     const char *assignLocal(const std::string& var, const char *val);
     void assign(const assignmentList_t* assignment, const CState* state);
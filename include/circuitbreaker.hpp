@@ -0,0 +1,81 @@
+/**
+ * @file   circuitbreaker.hpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Mon Oct 26 10:42:15 2026
+ *
+ * @brief  Circuit breaker of the http upstreams (scheme://host:port) in
+ *         anonymous shared memory, so all the children see the same state.
+ *         The circuit opens after the consecutive failures or when the error
+ *         rate of the window is too high; the calls fail at once while it is
+ *         open. After opentime one child is let through as the probe: the
+ *         circuit closes if it succeeds and opens again otherwise; the probe
+ *         cancelled or not over in opentime is replaced. A transfer error or
+ *         HTTP status 5xx is a failure.
+ *
+ *   [circuitbreaker]
+ *   failures = 5          ; consecutive failures to open
+ *   errorrate = 50        ; failed calls of the window to open, %
+ *   minrequests = 20      ; calls of the window before the rate is checked
+ *   window = 10           ; seconds
+ *   opentime = 5000       ; ms before the probe
+ *
+ */
+
+#ifndef __CIRCUITBREAKER_HPP__
+#define __CIRCUITBREAKER_HPP__
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+
+#define CIRCUIT_SLOTS       256  // upstreams
+#define CIRCUIT_FAILURES    5
+#define CIRCUIT_ERRORRATE   50
+#define CIRCUIT_MINREQUESTS 20
+#define CIRCUIT_WINDOW      10
+#define CIRCUIT_OPENTIME    5000
+
+class CCircuitBreaker {
+    enum { CLOSED, OPEN, HALF_OPEN };
+    struct circuit_t {
+        uint64_t hash;            // 0 - free slot
+        char upstream[64];        // for the log, may be truncated
+        int state;
+        unsigned consecutive;     // failures in a row
+        long long windowStart;    // ms, monotonic
+        unsigned calls;           // in the window
+        unsigned failures;        // in the window
+        long long openedAt;       // ms, monotonic; the probe start in HALF_OPEN
+        pid_t probe;
+        unsigned long opened;     // statistics
+        unsigned long rejected;
+    };
+    struct table_t {
+        pthread_mutex_t mutex;
+        circuit_t circuits[CIRCUIT_SLOTS];
+    };
+    table_t *m_table;
+    unsigned m_failures;
+    unsigned m_errorRate;
+    unsigned m_minRequests;
+    unsigned m_window;            // ms
+    unsigned m_openTime;          // ms
+    void lock();
+    inline void unlock() { pthread_mutex_unlock(&m_table->mutex); }
+    circuit_t* find(const std::string& upstream, bool add);
+    void open(circuit_t *c, long long now);
+public:
+    CCircuitBreaker();
+    bool create();
+    void destroy();
+    bool allow(const std::string& url);
+    void record(const std::string& url, bool success);
+    void release(const std::string& url);
+    void logStats();
+    inline bool is_enabled() const { return m_table != nullptr; }
+};
+
+extern CCircuitBreaker circuitBreaker;
+
+#endif // #ifndef __CIRCUITBREAKER_HPP__
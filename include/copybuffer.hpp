@@ -0,0 +1,37 @@
+/**
+ * @file   copybuffer.hpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Fri Oct 23 15:42:19 2026
+ *
+ * @brief  Per child buffers of the rows written by the write states. The
+ *         rows go to the table with one COPY ... FROM STDIN and one commit
+ *         when the buffer is large or old enough, checked at the end of
+ *         every request, and at the child exit; the killed child leaves
+ *         them in the spool. Database section options:
+ *
+ *   copyrows = 1000       ; rows buffered before COPY
+ *   copyflush = 5         ; s, the oldest row waits no longer
+ *   copyspool = <dir>     ; the rows are also appended to a file there until
+ *                         ; they are copied; the files of the dead children
+ *                         ; are copied by the first child to flush. The rows
+ *                         ; failed with a data error go to <hash>.reject there
+ *
+ */
+
+#ifndef __COPYBUFFER_HPP__
+#define __COPYBUFFER_HPP__
+
+#include <string>
+#include <vector>
+
+#define COPY_ROWS      1000    // rows buffered before COPY
+#define COPY_FLUSH     5       // s
+#define COPY_KEEP      10      // failed COPY: rows kept up to COPY_KEEP * copyrows
+
+std::string copyEscape(const char *value);
+void copyAppend(const std::string& dbsection, const std::string& table,
+                const std::vector<std::string>& columns, const std::string& line);
+void flushCopyBuffers(bool force);
+void closeCopyBuffers();
+
+#endif // #ifndef __COPYBUFFER_HPP__
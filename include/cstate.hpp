@@ -10,6 +10,7 @@
  */
 
 #include <list>
+#include <map>
 #include <vector>
 #include <boost/property_tree/ptree.hpp>
 #include <fcgiapp.h>
@@ -21,6 +22,8 @@ typedef std::list<std::string> assignmentList_t; /// parsed assignment
 
 // forward declaration
 class CAssigner;
+class CQueryResult;
+struct httpCall_t;
 
 /**
  * \brief Base CState class
@@ -34,10 +37,11 @@ class CState {
     std::string m_stateName;   /// < @brief state name
     std::string m_logPrefix;   /// < @brief logging prefix
     bool m_pfxInterpretFlag;   /// < @brief logging prefix needs to be interpolated
+    unsigned m_cacheTTL;       /// < @brief results memoization time, 0 - not cached
 public:
     explicit CState(int num, const std::string& scriptName, const char* stateName):
         m_number(num), m_errorState(-1), m_nextState(-1), m_scriptName(scriptName),
-        m_stateName(stateName), m_logPrefix(""), m_pfxInterpretFlag(false) {};
+        m_stateName(stateName), m_logPrefix(""), m_pfxInterpretFlag(false), m_cacheTTL(0) {};
     virtual ~CState() {};
     virtual int execute(const FCGX_Request *request, CAssigner* assigner) = 0;
     virtual int parse(const std::string& line, const std::string& file, unsigned counter) = 0;
@@ -65,6 +69,8 @@ public:
         *flag = m_pfxInterpretFlag;
         return m_logPrefix;
     }
+    inline void set_cacheTTL(unsigned ttl) { m_cacheTTL = ttl; }
+    inline unsigned get_cacheTTL() const { return m_cacheTTL; }
 };
 
 /*
@@ -97,7 +103,10 @@ public:
   150 file
       file "/tmp/match.sl.output"
       done 200
-      error 250
+      error 250     ; the file can not be opened. The data is written at the
+                    ; end of the request, a write error is logged only, the
+                    ; reply is sent already. Written before that by the shell
+                    ; and mail states, those take their error state on it
       data "Matched alphabetic: @100.value\n"
       endstate 
 */
@@ -115,12 +124,30 @@ public:
 
 /*
   250 end
+      [status 404 | status "@100.code"]       ; default 200
+      [contenttype 'application/json']        ; default text/html
+      [addheader 'Cache-Control: no-cache']   ; may be repeated
+      [addheader "X-Request-Id: @0.id"]
+      [etag "@100.version @0.id"]             ; ETag is a hash of the string
+      [lastmodified "@100.mtime"]             ; unix time or HTTP date
       data "Can not write file"
       endstate
+
+  If-None-Match or If-Modified-Since request header matches etag or
+  lastmodified, 304 is sent and data lines are not evaluated.
 */
 class CEndState: public CState {
     std::vector<std::string> m_outList;
     std::vector<bool> m_interpretFlag;
+    std::string m_status;                  /// < @brief reply status, number or interpolated string
+    bool m_statusInterpret;
+    std::string m_contentType;             /// < @brief Content-type, default is text/html
+    bool m_ctypeInterpret;
+    std::vector<std::string> m_headers;    /// < @brief additional headers, "Name: value"
+    std::vector<bool> m_hdrInterpretFlag;
+    std::string m_etag;                    /// < @brief ETag source string
+    std::string m_lastModified;            /// < @brief Last-Modified source string
+    bool setReply(const FCGX_Request *request, CAssigner* assigner);
 public:
     explicit CEndState(const int stateno, const std::string& scriptName);
     virtual ~CEndState();
@@ -150,6 +177,26 @@ public:
     virtual bool verify();
 };
 
+/*
+  120 flush
+      data "<html><body>Please wait..."
+      data "@0.function is running"
+      done 130
+      # client has gone, optional, default is done state
+      [error 500]
+      endstate
+*/
+class CFlushState: public CState {
+    std::vector<std::string> m_outList;
+    std::vector<bool> m_interpretFlag;
+public:
+    explicit CFlushState(const int stateno, const std::string& scriptName);
+    virtual ~CFlushState();
+    virtual int execute(const FCGX_Request *request, CAssigner* assigner);
+    virtual int parse(const std::string&, const std::string&, unsigned);
+    virtual bool verify();
+};
+
 /*
   110 match
       match @100.value
@@ -174,9 +221,15 @@ public:
 /*
   433 query
       db "postgres"
-      query "select name, price from product where prod_id = 13"
-      name = $name
-      price = $price
+      query "select name, price from product where prod_id = '@prod_id'"
+      [cache 60]  ; memoize the result for the same statement, seconds
+      [tags prices,currency] ; cached result is dropped by NOTIFY of these tags
+      [bind]        ; variables are bound as parameters of the prepared
+                    ; statement, not put into the text; not for lists: in (@ids)
+      [retry]       ; no side effects: sent again if the connection breaks
+      [cursor 500]  ; do not read the rows now, fetch state iterates them
+      name = $name    ; column by name
+      price = $1      ; or by index, the first column is $0
       done 400
       error 500
       endstate
@@ -184,8 +237,17 @@ public:
 class CQueryState: public CState {
     std::string m_dbsection;
     std::string m_query;
+    std::string m_statement;            // m_query with $n placeholders
+    std::string m_stmtName;
+    std::vector<std::string> m_bindVars; // values of $1, $2, ...
+    bool m_prepared;                    // m_statement is valid
+    bool m_bind;                        // bind clause: prepare if possible
+    bool m_retry;                       // may be repeated on the new connection
+    unsigned m_cursorRows;              // rows per fetch, 0 - no cursor
+    unsigned m_cursor;                  // cursor opened by the last run
+    std::vector<std::string> m_cacheTags;
     std::vector<assignmentList_t*> m_assignments;
-    std::vector<char*> *m_qResult;
+    CQueryResult *m_qResult;            // first row, kept until the next run
     void clearQResult();
 public:
     explicit CQueryState(const int stateno, const std::string& scriptName);
@@ -194,6 +256,112 @@ public:
     virtual int parse(const std::string&, const std::string&, unsigned);
     virtual bool verify();
     virtual char* getPropositional(const std::string& name) const;// override;
+    CQueryResult* fetch();
+};
+
+CQueryState* findQueryState(const std::string& scriptName, int stateno);
+bool bindVariables(const std::string& query, int stateno, std::string& statement, std::vector<std::string>& vars);
+
+/*
+  150 fetch
+      from 100      ; query state with cursor clause
+      eof 300       ; no more rows
+      name = $name  ; the current row columns
+      done 200      ; row is fetched, 200 does something and goes back to 150
+      error 500
+      endstate
+
+  The cursor is read in its own transaction. Other statements on the same
+  database section may only select while it is open. Writes in the loop
+  need begin and commit transaction states around it, otherwise they fail.
+ */
+class CFetchState: public CState {
+    int m_from;
+    int m_eofState;
+    std::vector<assignmentList_t*> m_assignments;
+    CQueryResult *m_row;
+public:
+    explicit CFetchState(const int stateno, const std::string& scriptName);
+    virtual ~CFetchState();
+    virtual int execute(const FCGX_Request *request, CAssigner* assigner);
+    virtual int parse(const std::string&, const std::string&, unsigned);
+    virtual bool verify();
+    virtual char* getPropositional(const std::string& name) const;// override;
+};
+
+/*
+  140 batch
+      db 'testdb'
+      query "select name from users where id = '@0.uid'"
+      query "select count(*) from orders where uid = '@0.uid'"
+      [bind]            ; variables are parameters of prepared statements
+      [retry]           ; no side effects: sent again if the connection breaks
+      name = $q0.name   ; the first query, column by name
+      orders = $q1.0    ; the second query, column by number
+      done 150
+      error 500
+      endstate
+ */
+class CBatchState: public CState {
+    std::string m_dbsection;
+    std::vector<std::string> m_queries;
+    std::vector<std::string> m_statements;            // with $n placeholders, empty to interpolate
+    std::vector<std::vector<std::string> > m_bindVars;
+    bool m_bind;                                      // bind clause: prepare if possible
+    bool m_retry;                                     // may be repeated on the new connection
+    std::vector<assignmentList_t*> m_assignments;
+    std::vector<CQueryResult*> m_results;             // first rows, kept until the next run
+    void clearResults();
+public:
+    explicit CBatchState(const int stateno, const std::string& scriptName);
+    virtual ~CBatchState();
+    virtual int execute(const FCGX_Request *request, CAssigner* assigner);
+    virtual int parse(const std::string&, const std::string&, unsigned);
+    virtual bool verify();
+    virtual char* getPropositional(const std::string& name) const;// override;
+};
+
+/*
+  120 transaction
+      db 'testdb'
+      begin         ; or commit, rollback
+      done 130
+      error 500     ; the same as done if omitted
+      endstate
+ */
+class CTransactionState: public CState {
+    std::string m_dbsection;
+    std::string m_action;
+public:
+    explicit CTransactionState(const int stateno, const std::string& scriptName);
+    virtual ~CTransactionState();
+    virtual int execute(const FCGX_Request *request, CAssigner* assigner);
+    virtual int parse(const std::string&, const std::string&, unsigned);
+    virtual bool verify();
+};
+
+/*
+  160 write
+      db 'testdb'
+      table "audit(uid, action, ip)" # the columns may be omitted
+      value "@0.uid"                 # one for every column, in order
+      value "login"
+      value "@0.REMOTE_ADDR"
+      done 170
+      error 500     ; the same as done if omitted
+      endstate
+ */
+class CWriteState: public CState {
+    std::string m_dbsection;
+    std::string m_table;
+    std::vector<std::string> m_columns;
+    std::vector<std::string> m_values;
+public:
+    explicit CWriteState(const int stateno, const std::string& scriptName);
+    virtual ~CWriteState();
+    virtual int execute(const FCGX_Request *request, CAssigner* assigner);
+    virtual int parse(const std::string&, const std::string&, unsigned);
+    virtual bool verify();
 };
 
 /*
@@ -212,6 +380,21 @@ public:
       [addheader 'Accept: Yes']
       [addheader 'Reject: No']
       [file "path"]
+      [cache 300] ; memoize the reply for the same request, seconds
+      [timeout 2000]         // ms, the whole transfer, [common] http_timeout by default
+      [connecttimeout 500]   // ms, [common] http_connecttimeout by default
+      [hedge 95 "http://replica/..."] // the second call when the reply is later
+                             // than 95% of the previous ones, the first reply wins;
+                             // the same url if none; GET only
+      [stream file|client]   // the body goes to the file or to the client as it
+                             // comes, not kept in memory; no cache and hedge then.
+                             // client: Content-Type and Content-Disposition are the
+                             // upstream's, the reply header goes with the first bytes
+      [capture 65536]        // stream: bytes of the body kept in the output variable
+      [http2]                // HTTP/2 over TLS, the calls to the upstream share one
+                             // connection; [common] http2 by default
+      [compress yes|no]      // Accept-Encoding of gzip, br..., the reply is decoded;
+                             // [common] http_compress by default
       done 400
       error 500
       endstate   
@@ -231,15 +414,68 @@ class CHttpState: public CState {
     std::list<std::string> m_headers;
     std::string  m_dumpfile;
     bool m_dumpflag;
+    unsigned m_timeout;                // ms, the whole transfer
+    unsigned m_connectTimeout;         // ms
+    unsigned m_hedgePercentile;        // 0 - no hedged call
+    std::string m_hedgeUrl;            // empty - the same url
+    std::vector<long> m_latency;       // ms, the last calls of this child
+    size_t m_latencyNext;
+    int m_stream;                      // STREAM_*
+    size_t m_capture;                  // stream: bytes of the body kept
+    bool m_http2;
+    bool m_compress;
+    void addLatency(long ms);
+    long hedgeDelay();
+    int hedgedPerform(CAssigner* assigner, httpCall_t& call);
 public:
+    enum { CALL_READY, CALL_CACHED, CALL_FAILED };
+    enum { STREAM_NONE, STREAM_FILE, STREAM_CLIENT };
     explicit CHttpState(const int stateno,  const std::string& scriptName);
     virtual ~CHttpState();
     virtual int execute(const FCGX_Request *request, CAssigner* assigner);
     virtual int parse(const std::string&, const std::string&, unsigned);
     virtual bool verify();
+    bool verifyRequest() const;        // the request part, no state transitions
+    int startCall(CAssigner* assigner, httpCall_t& call, bool hedge = false);
+    bool finishCall(CAssigner* assigner, httpCall_t& call, int rc); // rc is CURLcode
+    int setOutput(CAssigner* assigner, std::string& output);
+    inline const std::string& get_outputvar() const { return m_outputvar; }
+    inline int get_stream() const { return m_stream; }
+    inline const std::string& get_dumpfile() const { return m_dumpfile; }
+    inline unsigned get_hedgePercentile() const { return m_hedgePercentile; }
 };
 
 
+/*
+  460 fanout
+      request 'price'                # the http clauses below are of this request
+      url "http://prices/get?id=@0.id"
+      outputvar @price
+      [failed 470]                   # this request failed and the wait is not satisfied
+      request 'stock'
+      url "https://stock/get"
+      parameters "id=@0.id"
+      method POST
+      outputvar @stock
+                                     # no hedge, no stream client; stream file paths differ
+      [wait all|any|2]               # all by default, 2 is a quorum
+      done 480
+      error 500
+      endstate
+*/
+class CFanoutState: public CState {
+    std::vector<std::string> m_names;
+    std::vector<CHttpState*> m_requests;
+    std::vector<int> m_failStates;     // 0 - the state error
+    unsigned m_wait;                   // successful requests needed, 0 - all
+public:
+    explicit CFanoutState(const int stateno,  const std::string& scriptName);
+    virtual ~CFanoutState();
+    virtual int execute(const FCGX_Request *request, CAssigner* assigner);
+    virtual int parse(const std::string&, const std::string&, unsigned);
+    virtual bool verify();
+};
+
 /*
   5322 mail
        [from "root@localhost"] ; MAIL FROM; optional, if absent the default from
@@ -307,6 +543,7 @@ public:
   810 structure
       match @0.data
       format {XML|JSON}
+      [cache 60]  ; memoize the values for the same text, seconds
       name = $state_code.a
       value = $state_code.b
       done 880
@@ -319,7 +556,11 @@ class CStructureState: public CState {
     sformat_t   m_sformat;                        /// < @brief format to parse (currently XML or JSON)
     boost::property_tree::ptree m_pt;            /// < @brief parsed property tree
     std::vector<assignmentList_t*> m_assignments; /// < @brief assignments list
+    std::vector<std::string> m_memoNames;         /// < @brief propositional names to memoize
+    std::map<std::string, std::string> m_memo;    /// < @brief memoized values
+    bool m_memoActive;                            /// < @brief values are taken from m_memo
     inline void set_sformat(sformat_t sf) { m_sformat = sf; }
+    void addMemoNames(const assignmentList_t *assignment);
 public:
     explicit CStructureState(const int stateno, const std::string& scriptName);
     virtual ~CStructureState();
@@ -0,0 +1,102 @@
+/**
+ * @file   curlpool.hpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Sat Oct 24 14:18:40 2026
+ *
+ * @brief  Per child pool of libcurl easy handles, idle handles are kept by
+ *         upstream (scheme://host:port) and reset before use. All the
+ *         handles of the child share the DNS cache, TLS sessions and the
+ *         connection cache, so the keep-alive connection and the TLS
+ *         session of the previous call to the same upstream are reused.
+ *         Certificate and key files are read once and passed as blobs when
+ *         libcurl supports it, and read again only when they are changed.
+ *
+ */
+
+#ifndef __CURLPOOL_HPP__
+#define __CURLPOOL_HPP__
+
+#include <unistd.h>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+#include <curl/curl.h>
+#include <fcgiapp.h>
+#include "singleflight.hpp"
+#include "httpcache.hpp"
+#include "circuitbreaker.hpp"
+
+#define CURLPOOL_IDLE 4        // idle handles kept per upstream
+
+class CCurlPool {
+    struct blob_t {
+        std::string data;
+        time_t mtime;
+        time_t checked;        // stat(2) once a second at most
+    };
+    CURLSH *m_share;
+    CURLM *m_multi;            // fanout and hedged calls, created on the first use
+    std::map<std::string, std::vector<CURL*> > m_idle;
+    std::map<std::string, blob_t> m_blobs;
+    unsigned long m_created;
+    unsigned long m_reused;
+    const blob_t* readBlob(const std::string& path);
+public:
+    CCurlPool();
+    void init();
+    void cleanup();
+    CURL* acquire(const std::string& url);
+    void release(const std::string& url, CURL *handle);
+    CURLM* multi();
+    CURLcode setFile(CURL *handle, CURLoption option, const std::string& path);
+};
+
+extern CCurlPool curlPool;
+
+/**
+ * \brief One transfer of the http or fanout state: the buffers libcurl
+ * points to live here until the transfer is over. The handle goes back to
+ * the pool with the call, it must be removed from a multi handle before.
+ * The streamed body goes to fd or client, the output keeps capture bytes
+ */
+struct httpCall_t {
+    std::string url;
+    std::string params;
+    std::string output;
+    std::string memoKey;
+    struct curl_slist *headers;
+    char errorBuffer[CURL_ERROR_SIZE];
+    CURL *handle;
+    long httpcode;
+    CScopedFlight flight;             // released with the call
+    int fd;                           // streamed to the spool file, renamed when complete
+    std::string spool;
+    FCGX_Stream *client;              // streamed to the client
+    std::string disposition;          // Content-Disposition header line for the client
+    size_t capture;
+    std::string cacheKey;             // http cache, empty - not cacheable
+    std::string replyHeaders;         // the cache related ones
+    httpCacheEntry_t cached;          // stale entry being revalidated
+    std::string cachedBody;
+    bool revalidate;
+    bool admitted;                    // by the circuit breaker, the outcome is not recorded yet
+    httpCall_t(): url(""), params(""), output(""), memoKey(""), headers(nullptr), handle(nullptr), httpcode(0),
+                  fd(-1), spool(""), client(nullptr), disposition(""), capture(0), cacheKey(""), replyHeaders(""),
+                  cachedBody(""), revalidate(false), admitted(false) {
+        errorBuffer[0] = '\0';
+    }
+    ~httpCall_t() {
+        if(admitted) circuitBreaker.release(url); // cancelled or not started
+        if(handle) curlPool.release(url, handle);
+        if(headers) curl_slist_free_all(headers);
+        if(fd >= 0) {                 // the transfer is not complete
+            close(fd);
+            unlink(spool.c_str());
+        }
+    }
+};
+
+std::string curlUpstream(const std::string& url);
+
+#endif // #ifndef __CURLPOOL_HPP__
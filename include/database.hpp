@@ -12,22 +12,134 @@
 
 #include <vector>
 #include <string>
+#include <set>
+#include <map>
 #include <pqxx/pqxx>
+#ifdef HAVE_SQLITE3
+#include <sqlite3.h>
+#endif
 
-typedef std::vector<char*> qresult_t;
+#define DB_BACKOFF_MIN  50       // ms, the first reconnect delay after a failure
+#define DB_BACKOFF_MAX  5000     // ms
+#define DB_CHECK_IDLE   30       // s, idle connection is checked on checkout
+#define DB_SECTIONS_MAX 32       // database sections with the shared counters
+
+typedef std::vector<const char*> qparams_t;   // bound values, nullptr is NULL
+
+// per section connection counters, in shared memory: children count, master logs
+struct dbStats_t {
+    char section[64];
+    unsigned long connects;
+    unsigned long reconnects;
+    unsigned long failures;      // connection attempts failed
+    unsigned long retries;       // statements repeated on the new connection
+    unsigned long checks;        // idle connection checks
+    unsigned long replicaReads;  // statements routed to the replicas
+    unsigned long ejections;     // replicas taken out of rotation
+};
+
+/**
+ * \brief One row of a query result. Values are views into the result the
+ * state keeps for the request, nothing is copied
+ */
+class CQueryResult {
+public:
+    CQueryResult() {};
+    virtual ~CQueryResult() {};
+    virtual size_t columns() const = 0;
+    virtual int column(const std::string& name) const = 0;  // -1 if there is no such column
+    virtual const char* name(size_t col) const = 0;
+    virtual const char* value(size_t col) const = 0;        // nullptr for NULL
+    virtual size_t length(size_t col) const = 0;
+    char* getPropositional(const std::string& name) const;  // $N or $name
+};
+
+class CPgResult: public CQueryResult {
+    pqxx::result m_result;                  // reference counted, copy is cheap
+    size_t m_row;
+public:
+    explicit CPgResult(const pqxx::result& r, size_t row = 0): CQueryResult(), m_result(r), m_row(row) {};
+    virtual size_t columns() const { return m_result.columns(); }
+    virtual int column(const std::string& name) const;
+    virtual const char* name(size_t col) const { return m_result.column_name(col); }
+    virtual const char* value(size_t col) const;
+    virtual size_t length(size_t col) const { return m_result[m_row][col].size(); }
+};
+
+/**
+ * \brief The first row unpacked from the state cache: column names, then
+ * the values. The packed memo is not NUL terminated, so they are copied
+ * into one buffer, each with the terminator
+ */
+class CMemoResult: public CQueryResult {
+    std::string m_data;
+    std::vector<size_t> m_offsets;      // names, then values; npos for NULL
+    std::vector<size_t> m_lengths;
+    size_t m_columns;
+public:
+    explicit CMemoResult(const std::string& memo);
+    inline bool is_valid() const { return m_columns > 0; }
+    virtual size_t columns() const { return m_columns; }
+    virtual int column(const std::string& name) const;
+    virtual const char* name(size_t col) const { return m_data.data() + m_offsets[col]; }
+    virtual const char* value(size_t col) const;
+    virtual size_t length(size_t col) const { return m_lengths[m_columns + col]; }
+};
 
 class CDatabase {
 public:
     CDatabase() {};
     virtual ~CDatabase() {};
     virtual int connect() = 0;
-    virtual qresult_t* query(const std::string& statement) = 0;
+    virtual void checkout() = 0;                            // connected and alive
+    // repeat -- no side effects: sent again on the new connection if it breaks
+    virtual CQueryResult* query(const std::string& statement, bool repeat) = 0;
+    virtual CQueryResult* execPrepared(const std::string& name, const std::string& statement,
+                                       const qparams_t& params, bool repeat) = 0;
+    // independent statements in one round trip
+    virtual std::vector<CQueryResult*> batch(const std::vector<std::string>& statements,
+                                             const std::vector<qparams_t>& params, bool repeat) = 0;
+    // server-side cursor: the rows are fetched by blocks, not materialized
+    virtual unsigned openCursor(const std::string& statement, const qparams_t& params, unsigned rows) = 0;
+    virtual CQueryResult* fetch(unsigned cursor) = 0;       // nullptr at the end of the rows
+    virtual void finish() = 0;                              // request is over: close the cursors
+    virtual void begin() = 0;                               // explicit transaction
+    virtual void commit() = 0;
+    virtual void rollback() = 0;
+    // COPY text format lines into the table, in its own transaction
+    virtual void copy(const std::string& table, const std::vector<std::string>& columns,
+                      const std::vector<std::string>& lines) = 0;
     virtual int disconnect() = 0;
 };
 
 class CPgDatabase: public CDatabase {
+    struct cursor_t {
+        pqxx::icursorstream *stream;
+        pqxx::result block;                 // the rows fetched
+        size_t row;                         // the next row in the block
+    };
     std::string m_connectString;
     pqxx::connection* m_connection;    
+    std::set<std::string> m_prepared;  // statements prepared on this connection
+    bool m_logColumns;
+    pqxx::work *m_tx;                  // open while there are cursors or explicit transaction
+    bool m_explicitTx;                 // m_tx is started by begin()
+    std::map<unsigned, cursor_t> m_cursors;
+    std::set<unsigned> m_lostCursors;  // open when the connection was dropped
+    unsigned m_cursorSerial;
+    dbStats_t *m_stats;
+    unsigned m_checkIdle;              // s, 0 - no checks
+    long long m_lastUse;               // ms, monotonic
+    long long m_retryAt;               // ms, no connection attempts until then
+    long long m_backoff;               // ms
+    bool m_connected;                  // connected once at least
+    unsigned m_statementTimeout;       // ms, set on connect; 0 - server default
+    CQueryResult* firstRow(const pqxx::result& r) const;
+    void checkCursorTx(const std::string& statement) const;
+    void closeCursor(unsigned cursor);
+    void dropCursors();
+    void drop();
+    bool retry(const pqxx::broken_connection& e, bool repeat);
 public:
     CPgDatabase(const std::string& dbname,
                 const std::string& user,
@@ -37,13 +149,152 @@ public:
     virtual ~CPgDatabase();
     virtual int connect();
     virtual int disconnect();
-    virtual qresult_t* query(const std::string& statement);
+    virtual void checkout();
+    virtual CQueryResult* query(const std::string& statement, bool repeat);
+    virtual CQueryResult* execPrepared(const std::string& name, const std::string& statement,
+                                       const qparams_t& params, bool repeat);
+    virtual std::vector<CQueryResult*> batch(const std::vector<std::string>& statements,
+                                             const std::vector<qparams_t>& params, bool repeat);
+    virtual unsigned openCursor(const std::string& statement, const qparams_t& params, unsigned rows);
+    virtual CQueryResult* fetch(unsigned cursor);
+    virtual void finish();
+    virtual void begin();
+    virtual void commit();
+    virtual void rollback();
+    virtual void copy(const std::string& table, const std::vector<std::string>& columns,
+                      const std::vector<std::string>& lines);
+    inline void set_logColumns(bool flag) { m_logColumns = flag; }
+    inline void set_checkIdle(unsigned seconds) { m_checkIdle = seconds; }
+    inline void set_statementTimeout(unsigned ms) { m_statementTimeout = ms; }
+    inline void set_stats(dbStats_t *stats) { m_stats = stats; }
+    inline bool is_inTransaction() const { return m_tx != nullptr; }
+};
+
+#define DB_EJECT_TIME 10         // s, failed replica is out of rotation
+
+/**
+ * \brief Primary with read replicas. Reads outside of a transaction go to
+ * the replicas by smooth weighted round-robin until the request writes,
+ * everything else goes to the primary. A replica failing to connect or to
+ * run a statement is ejected for a while and the statement goes to the
+ * primary, so does a read the replica refuses as a write (a function).
+ *
+ *   dbreplicas = host[:port] [weight], host[:port] [weight], ...
+ */
+class CPgCluster: public CDatabase {
+    struct replica_t {
+        CPgDatabase *db;
+        int weight;
+        int current;                   // smooth weighted round-robin
+        long long ejectedUntil;        // ms, monotonic
+        std::string name;
+    };
+    CPgDatabase *m_primary;
+    std::vector<replica_t> m_replicas;
+    std::map<unsigned, std::pair<CPgDatabase*, unsigned> > m_cursors;
+    unsigned m_cursorSerial;
+    unsigned m_ejectTime;              // s
+    dbStats_t *m_stats;
+    bool m_stickToPrimary;             // the request has written, reads go to the primary
+    replica_t* choose();
+    void eject(replica_t *r, const std::exception& e);
+    template<typename R, typename F> R route(bool read, F f);
+public:
+    explicit CPgCluster(CPgDatabase *primary);
+    virtual ~CPgCluster();
+    void addReplica(CPgDatabase *db, int weight, const std::string& name);
+    virtual int connect();
+    virtual int disconnect();
+    virtual void checkout();
+    virtual CQueryResult* query(const std::string& statement, bool repeat);
+    virtual CQueryResult* execPrepared(const std::string& name, const std::string& statement,
+                                       const qparams_t& params, bool repeat);
+    virtual std::vector<CQueryResult*> batch(const std::vector<std::string>& statements,
+                                             const std::vector<qparams_t>& params, bool repeat);
+    virtual unsigned openCursor(const std::string& statement, const qparams_t& params, unsigned rows);
+    virtual CQueryResult* fetch(unsigned cursor);
+    virtual void finish();
+    virtual void begin();
+    virtual void commit();
+    virtual void rollback();
+    virtual void copy(const std::string& table, const std::vector<std::string>& columns,
+                      const std::vector<std::string>& lines);
+    inline void set_ejectTime(unsigned seconds) { m_ejectTime = seconds; }
+    inline void set_stats(dbStats_t *stats) { m_stats = stats; }
+};
+
+bool is_readonly(const std::string& statement);
+
+#ifdef HAVE_SQLITE3
+
+#define SQLITE_MMAP_SIZE (64*1024*1024)
+
+/**
+ * \brief SQLite row: the values are valid until the next step of the
+ * statement, so the row is copied, names and values into one buffer
+ */
+class CSqliteResult: public CQueryResult {
+    std::string m_data;
+    std::vector<size_t> m_offsets;      // names, then values; npos for NULL
+    std::vector<size_t> m_lengths;
+    size_t m_columns;
+public:
+    explicit CSqliteResult(sqlite3_stmt *stmt);
+    virtual size_t columns() const { return m_columns; }
+    virtual int column(const std::string& name) const;
+    virtual const char* name(size_t col) const { return m_data.data() + m_offsets[col]; }
+    virtual const char* value(size_t col) const;
+    virtual size_t length(size_t col) const { return m_lengths[m_columns + col]; }
+};
+
+/**
+ * \brief Local read-only database file, opened by every child on the first
+ * use with memory mapped I/O. Statements are prepared once and kept
+ */
+class CSqliteDatabase: public CDatabase {
+    std::string m_path;
+    sqlite3 *m_db;
+    size_t m_mmapSize;
+    std::map<std::string, sqlite3_stmt*> m_prepared;
+    std::map<unsigned, sqlite3_stmt*> m_cursors;
+    unsigned m_cursorSerial;
+    bool m_inTx;
+    sqlite3_stmt* prepare(const std::string& statement);
+    void bind(sqlite3_stmt *stmt, const qparams_t& params);
+    CQueryResult* run(sqlite3_stmt *stmt);
+    void exec(const char *sql);
+    void fail(const char *what) const;
+public:
+    CSqliteDatabase(const std::string& path, size_t mmapSize);
+    virtual ~CSqliteDatabase();
+    virtual int connect();
+    virtual int disconnect();
+    virtual void checkout();
+    virtual CQueryResult* query(const std::string& statement, bool repeat);
+    virtual CQueryResult* execPrepared(const std::string& name, const std::string& statement,
+                                       const qparams_t& params, bool repeat);
+    virtual std::vector<CQueryResult*> batch(const std::vector<std::string>& statements,
+                                             const std::vector<qparams_t>& params, bool repeat);
+    virtual unsigned openCursor(const std::string& statement, const qparams_t& params, unsigned rows);
+    virtual CQueryResult* fetch(unsigned cursor);
+    virtual void finish();
+    virtual void begin();
+    virtual void commit();
+    virtual void rollback();
+    virtual void copy(const std::string& table, const std::vector<std::string>& columns,
+                      const std::vector<std::string>& lines);
 };
 
+#endif // #ifdef HAVE_SQLITE3
+
 void addDBSection(const std::string& section);
 CDatabase* getDatabase(const std::string& section);
+void dbStatsInit();
+void logDBStats();
 void connectDBs();
+void finishDBs();
 void disconnectDBs();
+std::string pgConnectString(const std::string& section);
 
 #endif // #ifndef __CDATABASE_HPP__
 
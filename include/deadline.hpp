@@ -0,0 +1,30 @@
+/**
+ * @file   deadline.hpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Sun Oct 25 15:20:34 2026
+ *
+ * @brief  Request deadline budget: started when the request comes, the http
+ *         states take no longer than what is left and the database states
+ *         are not started after it is over.
+ *
+ *   [common]
+ *   deadline = 10000      ; ms, 0 - no budget
+ *
+ */
+
+#ifndef __DEADLINE_HPP__
+#define __DEADLINE_HPP__
+
+#define DEADLINE_NONE (-1)
+
+void deadlineStart(unsigned ms);
+void deadlineStop();
+long long deadlineLeft();      // ms, DEADLINE_NONE if there is no budget
+long long monotonicMs();
+
+inline bool deadlineExpired() {
+    const long long left = deadlineLeft();
+    return left != DEADLINE_NONE && left <= 0;
+}
+
+#endif // #ifndef __DEADLINE_HPP__
@@ -10,7 +10,44 @@
 #ifndef __HTTP_HPP__
 #define __HTTP_HPP__
 
+#include <ctime>
+#include <list>
+#include <string>
+#include <fcgiapp.h>
+
+const char* HTTPreason(const int code);
 char* HTTPstatus(const char* prefix, const int code, char *buf, size_t buflen);
+char* HTTPdate(const time_t t, char *buf, size_t buflen);
+time_t HTTPparseDate(const char *date);
+bool HTTPetagMatch(const char *header, const std::string& etag);
+bool HTTPnotModified(FCGX_ParamArray envp, const std::string& etag, const time_t lastmod);
 std::string urlDecode(std::string &SRC);
 
+/**
+ * \brief CGI-style reply header writer.
+ * Collects the status, content type and additional headers of the current
+ * reply and writes them to the output stream exactly once. Both FastCGI and
+ * the native HTTP front end (see httpd.hpp) consume this header block.
+ */
+class CHttpReply {
+    int m_status;                      /// < @brief HTTP status code
+    std::string m_contentType;         /// < @brief Content-type header value
+    std::list<std::string> m_headers;  /// < @brief additional headers, "Name: value"
+    bool m_sent;                       /// < @brief header block is already written
+public:
+    CHttpReply();
+    void reset();
+    inline void set_status(const int code) { m_status = code; }
+    inline int get_status() const { return m_status; }
+    inline void set_contentType(const std::string& ctype) { m_contentType = ctype; }
+    inline const std::string& get_contentType() const { return m_contentType; }
+    inline void addHeader(const std::string& header) { m_headers.push_back(header); }
+    inline bool is_sent() const { return m_sent; }
+    inline void set_sent() { m_sent = true; }
+    int send(FCGX_Stream *out);
+    int sendStatus(FCGX_Stream *out, const int code);
+};
+
+extern CHttpReply httpReply; // reply of the request being processed by this child
+
 #endif // #ifndef __HTTP_HPP__
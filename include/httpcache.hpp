@@ -0,0 +1,55 @@
+/**
+ * @file   httpcache.hpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Mon Oct 26 17:55:02 2026
+ *
+ * @brief  Client side cache of the upstream GET replies (HTTP 200) in the
+ *         shared memory, the bodies too large for it are spilled to files.
+ *         Freshness is taken from Cache-Control max-age or Expires, no-store
+ *         replies are not stored. A stale entry with ETag or Last-Modified is
+ *         kept to be revalidated with If-None-Match / If-Modified-Since, the
+ *         body is taken from the cache on 304 Not Modified. The streamed
+ *         and hedged requests are not cached.
+ *
+ *   [httpcache]
+ *   size = 67108864       ; shared memory, bytes
+ *   maxentry = 262144     ; the largest body in the shared memory
+ *   spool = /var/cache/appserver ; larger bodies, not cached if not set
+ *   maxspill = 67108864   ; the largest body spilled
+ *   keep = 3600           ; stale entries kept for revalidation, seconds
+ *   maxttl = 86400        ; freshness limit, seconds
+ *
+ */
+
+#ifndef __HTTPCACHE_HPP__
+#define __HTTPCACHE_HPP__
+
+#include <ctime>
+#include <string>
+#include "shmcache.hpp"
+
+#define HTTPCACHE_SIZE     (64*1024*1024)
+#define HTTPCACHE_MAXENTRY (256*1024)
+#define HTTPCACHE_MAXSPILL (64*1024*1024)
+#define HTTPCACHE_KEEP     3600
+#define HTTPCACHE_MAXTTL   86400
+
+struct httpCacheEntry_t {
+    time_t expires;                 // fresh until, 0 - revalidate always
+    long lifetime;                  // s, of the last full reply, for 304 without freshness
+    std::string etag;
+    std::string lastModified;
+    httpCacheEntry_t(): expires(0), lifetime(0), etag(""), lastModified("") {}
+};
+
+extern CShmCache httpCache;
+
+void httpCacheInit();
+bool httpCacheGet(const std::string& key, httpCacheEntry_t& entry, std::string& body);
+void httpCachePut(const std::string& key, const httpCacheEntry_t& entry, const std::string& body,
+                  bool refresh = false);
+bool httpCacheControl(const std::string& headers, httpCacheEntry_t& entry);
+bool httpCacheHeader(const char *line, size_t len);
+void httpCachePrune();
+
+#endif // #ifndef __HTTPCACHE_HPP__
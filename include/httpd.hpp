@@ -0,0 +1,29 @@
+/**
+ * @file   httpd.hpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Mon Oct 19 11:20:41 2026
+ * 
+ * @brief  Native HTTP/1.1 front end. An alternative to FastCGI for the
+ *         service-to-service calls without the web server in front of us.
+ * 
+ */
+
+#ifndef __HTTPD_HPP__
+#define __HTTPD_HPP__
+
+#include <fcgiapp.h>
+
+#define HTTP_OUTBUF      16384   // reply buffer, larger replies are sent chunked
+#define HTTP_READBUF     16384   // socket read portion
+#define HTTP_MAXHEADER   16384   // request line and headers size limit
+#define HTTP_MAXBODY     1048576 // request body size limit
+#define HTTP_KEEPALIVE   5       // default idle keep-alive timeout, seconds
+#define HTTP_MAXREQUESTS 100     // default requests per connection limit
+
+// called for each request parsed, the request looks like a FastCGI one
+typedef void (*requestHandler_t)(FCGX_Request *request);
+
+int httpOpenSocket(const char *path, int backlog);
+int httpServeConnection(int fd, requestHandler_t handler, int keepalive, int maxrequests);
+
+#endif // #ifndef __HTTPD_HPP__
@@ -11,6 +11,7 @@
 
 #include <string>
 #include <map>
+#include <set>
 #include <cstring>
 #include <boost/property_tree/ptree.hpp>
 #include "myexceptions.hpp"
@@ -40,6 +41,8 @@ assignmentList_t* parseAssignment(const std::string& line,
                                   const std::string& file,
                                   unsigned counter);
 
+extern std::set<std::string> assignedGlobals; // the scripts set them, filled by parseAssignment
+
 #endif // #ifndef __PARSER_HPP__
 
 
@@ -21,6 +21,7 @@ struct pslot_t { // the element of control table stored in shared memory
     int         slotbusy;   // slot is occupied by child if field != 0
     slotstate_t childsts;   // slot status (empty, busy, idle, etc)
     pid_t       childpid;   // child process pid.
+    unsigned    scripthash; // hash of the last script name served, for affinity
 };
 
 #define CHILDREN_HARDLIMIT 1024
@@ -28,7 +29,14 @@ struct pslot_t { // the element of control table stored in shared memory
 #define CHILDREN_QUANTUM 16
 #define FORK_THRESHOLD   0.79
 #define SLEEPTIME 5
+#define STATS_INTERVAL 300 // master logs the caches statistics, seconds
 #define PARAMBUF_LENGTH 1024
+#define DISPATCH_QUEUE  CHILDREN_HARDLIMIT // connections accepted by master but not dispatched yet
+
+// dispatcher mode: front end tag passed along with the connection
+#define FRONTEND_FCGI 'f'
+#define FRONTEND_HTTP 'h'
+#define CHILD_READY   'r'
 
 int runPreforked();
 
@@ -0,0 +1,69 @@
+/**
+ * @file   respcache.hpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Tue Oct 20 14:05:26 2026
+ *
+ * @brief  Full response cache: the whole reply of a script (CGI header block
+ *         and body) is stored in the shared memory cache, the key is the
+ *         script name and the values of the selected parameters. GET and
+ *         HEAD only, a conditional request is answered by 304 when the
+ *         stored ETag or Last-Modified matches.
+ *
+ *   [respcache]
+ *   size = 67108864       ; shared memory, bytes
+ *   maxentry = 65536      ; the largest reply cached
+ *   <script> = <ttl> [param,param,...] [maxsize]
+ *
+ */
+
+#ifndef __RESPCACHE_HPP__
+#define __RESPCACHE_HPP__
+
+#include <string>
+#include <vector>
+#include <fcgiapp.h>
+#include "shmcache.hpp"
+
+#define RESPCACHE_SIZE     (64*1024*1024)
+#define RESPCACHE_MAXENTRY (64*1024)
+#define CAPTURE_BUF        8192
+
+class CAssigner;
+
+struct respCacheRule_t {
+    unsigned ttl;                       // seconds
+    std::vector<std::string> params;    // @0.* variables the reply depends on
+    size_t maxsize;                     // the largest reply of this script to cache
+};
+
+/**
+ * \brief Output stream tee: everything written goes to the real output
+ * stream and is collected up to the limit. Only the flushes made through
+ * flush() are passed on, so the streaming scripts still work.
+ */
+class CCaptureStream {
+    FCGX_Stream m_stream;
+    FCGX_Stream *m_out;                 /// < @brief real output stream
+    unsigned char m_buf[CAPTURE_BUF];
+    std::string m_data;                 /// < @brief collected output
+    size_t m_limit;
+    bool m_overflow;                    /// < @brief output exceeds the limit, m_data is incomplete
+    bool m_flush;                       /// < @brief the script flushes, not the full buffer
+    static void emptyBuffer(FCGX_Stream *stream, int doClose);
+public:
+    CCaptureStream(FCGX_Stream *out, size_t limit);
+    static int flush(FCGX_Stream *stream);
+    inline FCGX_Stream* stream() { return &m_stream; }
+    void finish();
+    inline bool is_complete() const { return !m_overflow; }
+    inline const std::string& get_data() const { return m_data; }
+};
+
+extern CShmCache respCache;
+
+void respCacheInit();
+const respCacheRule_t* respCacheRule(const std::string& script);
+std::string respCacheKey(const std::string& script, const respCacheRule_t *rule, CAssigner *assigner);
+std::string respCacheHeader(const std::string& reply, const char *name);
+
+#endif // #ifndef __RESPCACHE_HPP__
@@ -0,0 +1,75 @@
+/**
+ * @file   shmcache.hpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Tue Oct 20 12:31:08 2026
+ *
+ * @brief  Key-value cache in anonymous shared memory, visible to all the
+ *         preforked children. Created by master before fork. Set-associative
+ *         with fixed-size slots and LRU replacement within a set, protected by
+ *         process-shared robust mutex.
+ *
+ */
+
+#ifndef __SHMCACHE_HPP__
+#define __SHMCACHE_HPP__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <ctime>
+#include <string>
+
+#define SHMCACHE_WAYS 8   // slots per set
+
+struct shmCacheStats_t {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long stores;
+    unsigned long evictions;  // live entries replaced by LRU
+    unsigned long expired;
+    unsigned long toolarge;   // entries not stored: key + data exceed the slot
+};
+
+class CShmCache {
+    struct header_t {
+        pthread_mutex_t mutex;
+        shmCacheStats_t stats;
+        uint64_t tick;        // LRU clock
+        size_t   nsets;
+        size_t   ways;
+        size_t   slotsize;
+    };
+    struct slot_t {
+        uint64_t hash;        // 0 - empty slot
+        uint64_t lastuse;
+        time_t   expires;
+        uint32_t keylen;
+        uint32_t datalen;     // key and data follow
+    };
+    header_t *m_hdr;
+    char *m_slots;
+    size_t m_size;
+    std::string m_name;
+
+    void lock();
+    inline void unlock() { pthread_mutex_unlock(&m_hdr->mutex); }
+    inline slot_t* slot(size_t set, size_t way) const {
+        return (slot_t*)(m_slots + (set * m_hdr->ways + way) * m_hdr->slotsize);
+    }
+    slot_t* find(const std::string& key, uint64_t hash, time_t now);
+public:
+    CShmCache();
+    ~CShmCache();
+    bool create(const std::string& name, size_t size, size_t slotsize, size_t ways = SHMCACHE_WAYS);
+    void destroy();
+    bool get(const std::string& key, std::string& data);
+    bool put(const std::string& key, const std::string& data, unsigned ttl);
+    void remove(const std::string& key);
+    void getStats(shmCacheStats_t *stats);
+    void logStats();
+    inline bool is_enabled() const { return m_hdr != nullptr; }
+    inline size_t get_maxData() const { return m_hdr ? m_hdr->slotsize - sizeof(slot_t) : 0; }
+};
+
+uint64_t hash64(const char *data, size_t len);
+
+#endif // #ifndef __SHMCACHE_HPP__
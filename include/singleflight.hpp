@@ -0,0 +1,85 @@
+/**
+ * @file   singleflight.hpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Tue Oct 20 19:22:40 2026
+ *
+ * @brief  Cross-process request coalescing. The first child missing a cached
+ *         state result does the work, the others with the same key wait on a
+ *         process-shared condition variable (futex) and take the result from
+ *         the cache when the leader is done.
+ *
+ *   [common]
+ *   singleflight_wait = 5000      ; follower waits for the leader at most, ms
+ *   singleflight_globals = false  ; coalesce memcached global misses too
+ *
+ */
+
+#ifndef __SINGLEFLIGHT_HPP__
+#define __SINGLEFLIGHT_HPP__
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+
+#define SINGLEFLIGHT_SLOTS 256    // keys in flight at the same time
+#define SINGLEFLIGHT_WAIT  5000   // default follower wait, ms
+#define SINGLEFLIGHT_PROBE 100    // leader liveness check while waiting, ms
+
+#define SF_ALONE  (-1)            // no coordination: do the work
+#define SF_WAITED (-2)            // the leader is done: check the cache
+
+struct sfStats_t {
+    unsigned long leaders;
+    unsigned long followers;      // waited for a leader instead of doing the work
+    unsigned long timeouts;       // leader is too slow, did the work anyway
+    unsigned long takeovers;      // leader is dead
+    unsigned long overflows;      // no free slot
+};
+
+class CSingleFlight {
+    struct flight_t {
+        uint64_t hash;            // 0 - free slot
+        pid_t leader;
+    };
+    struct table_t {
+        pthread_mutex_t mutex;
+        pthread_cond_t done;      // broadcast on every flight end
+        sfStats_t stats;
+        flight_t flights[SINGLEFLIGHT_SLOTS];
+    };
+    table_t *m_table;
+    unsigned m_leading;           // flights of this process: it does not wait for others
+    unsigned m_wait;              // ms
+    bool m_globals;
+    void lock();
+public:
+    CSingleFlight();
+    bool create(unsigned waitms, bool globals);
+    void destroy();
+    int begin(const std::string& key);
+    void end(int slot);
+    void logStats();
+    inline bool is_enabled() const { return m_table != nullptr; }
+    inline bool get_globals() const { return m_table != nullptr && m_globals; }
+};
+
+extern CSingleFlight singleFlight;
+
+/**
+ * \brief RAII-style flight: the leader slot is released by destructor,
+ * on the state error path as well
+ */
+class CScopedFlight {
+    int m_slot;
+public:
+    CScopedFlight(): m_slot(SF_ALONE) {}
+    ~CScopedFlight() { if(m_slot >= 0) singleFlight.end(m_slot); }
+    // true if another child has done the work while we waited
+    inline bool join(const std::string& key) {
+        m_slot = singleFlight.begin(key);
+        return m_slot == SF_WAITED;
+    }
+};
+
+#endif // #ifndef __SINGLEFLIGHT_HPP__
@@ -0,0 +1,47 @@
+/**
+ * @file   statecache.hpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Tue Oct 20 16:48:19 2026
+ *
+ * @brief  State results memoization: query, http and structure states with
+ *         "cache <ttl>" clause store their outputs in the shared memory cache,
+ *         keyed by the interpolated inputs.
+ *
+ *   [statecache]
+ *   size = 33554432       ; shared memory, bytes
+ *   maxentry = 16384      ; key and result size limit
+ *
+ * Query states with "tags <tag,tag,...>" add the generations of the tags to
+ * the key: the tag invalidated by the database NOTIFY gets the next
+ * generation and the old entries are not found any more, they expire or are
+ * evicted. The tags are known from the scripts before fork, so the table is
+ * read only but for the generation counters.
+ *
+ */
+
+#ifndef __STATECACHE_HPP__
+#define __STATECACHE_HPP__
+
+#include <string>
+#include "shmcache.hpp"
+
+#define STATECACHE_SIZE     (32*1024*1024)
+#define STATECACHE_MAXENTRY (16*1024)
+#define STATECACHE_TAGS     1024  // tag slots, more tags than that are not invalidated
+
+extern CShmCache stateCache;
+
+void stateCacheRequired();
+void stateCacheInit();
+
+void stateCacheTag(const std::string& tag);
+uint64_t cacheTagGeneration(const std::string& tag);
+bool invalidateCacheTag(const std::string& tag);
+void invalidateCacheTags();
+
+// cached result is a sequence of nullable strings
+void memoPack(std::string& out, const char *value);
+void memoPack(std::string& out, const std::string& value);
+bool memoUnpack(const std::string& in, size_t& pos, const char **value, size_t *len);
+
+#endif // #ifndef __STATECACHE_HPP__
@@ -0,0 +1,277 @@
+/**
+ * @file   aio.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Mon Oct 19 19:12:37 2026
+ *
+ * @brief  CIoBatch class definition: batched file writes and reply send.
+ *
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cerrno>
+#include "apputils.hpp"
+#include "aio.hpp"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+CIoBatch ioBatch;
+
+CIoBatch::CIoBatch(): m_uring(false) {
+    resetStats();
+}
+
+CIoBatch::~CIoBatch() {
+    shutdown();
+}
+
+/**
+ * @fn bool CIoBatch::init(bool useUring)
+ * @brief sets up the ring, must be called in the child process
+ * @return true if io_uring is used
+ */
+bool CIoBatch::init(bool useUring) {
+#ifdef HAVE_LIBURING
+    if(useUring && !m_uring) {
+        int rv = io_uring_queue_init(AIO_QUEUE, &m_ring, 0);
+        if(rv == 0) m_uring = true;
+        // ENOSYS on the old kernels, EPERM if disabled by sysctl
+        else log_message("%s: io_uring is not available, using plain I/O: %s", __func__, strerror(-rv));
+    }
+#endif
+    return m_uring;
+}
+
+void CIoBatch::shutdown() {
+    submit();
+#ifdef HAVE_LIBURING
+    if(m_uring) io_uring_queue_exit(&m_ring);
+#endif
+    m_uring = false;
+}
+
+/**
+ * @fn int CIoBatch::writeFile(const std::string& path, std::string& data)
+ * @brief opens (truncates) the file and queues the data to write. Data is
+ *        swapped out, the caller's string is left empty
+ * @return 0 or errno if the file can not be opened
+ */
+int CIoBatch::writeFile(const std::string& path, std::string& data) {
+    // the same file twice within the batch: keep the write order
+    for(const auto &op : m_ops) {
+        if(op.path == path) {
+            submit();
+            break;
+        }
+    }
+    if(m_ops.size() >= AIO_QUEUE) submit();
+
+    int fd = open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666);
+    m_stats.syscalls++;
+    if(fd < 0) return errno;
+
+    m_ops.push_back(ioOp_t());
+    ioOp_t& op = m_ops.back();
+    op.fd = fd;
+    op.error = 0;
+    op.path = path;
+    op.data.swap(data);
+    op.done = 0;
+    op.submitted = false;
+    m_stats.ops++;
+    m_stats.bytes += op.data.size();
+    return 0;
+}
+
+/**
+ * @fn int CIoBatch::submit()
+ * @brief writes all queued data
+ * @return number of failed writes
+ */
+int CIoBatch::submit() {
+    if(m_ops.empty()) return 0;
+#ifdef HAVE_LIBURING
+    if(m_uring) submitUring(-1, nullptr);
+#endif
+    return complete();
+}
+
+// finishes what the ring did not: cancelled closes, plain I/O. The error of
+// close(2) is the deferred write error of the file system (NFS, quota)
+int CIoBatch::complete() {
+    int failed = 0;
+    for(auto &op : m_ops) {
+        while(!op.error && op.done < op.data.size()) {
+            ssize_t n = ::write(op.fd, op.data.data() + op.done, op.data.size() - op.done);
+            m_stats.syscalls++;
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) op.error = n < 0 ? errno : EIO;
+            else op.done += n;
+        }
+        if(op.fd >= 0) {
+            if(close(op.fd) && errno != EINTR && !op.error) op.error = errno;
+            m_stats.syscalls++;
+        }
+        if(op.error) {
+            log_warning("%s: %s: write error: %s", __func__, op.path.c_str(), strerror(op.error));
+            failed++;
+        }
+    }
+    m_ops.clear();
+    return failed;
+}
+
+/**
+ * @fn bool CIoBatch::sendv(int fd, struct iovec *iov, int iovcnt)
+ * @brief sends the data to the socket, queued file writes are submitted
+ *        within the same io_uring_enter(2). Partial sends are completed
+ *        with sendmsg(2). The iov array is modified.
+ * @return true on success
+ */
+bool CIoBatch::sendv(int fd, struct iovec *iov, int iovcnt) {
+    struct msghdr msg;
+    ssize_t n = 0;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+    m_stats.ops++;
+    for(int i = 0; i < iovcnt; i++) m_stats.bytes += iov[i].iov_len;
+
+#ifdef HAVE_LIBURING
+    if(m_uring) n = submitUring(fd, &msg);
+#endif
+    complete();
+
+    while(1) {
+        if(n < 0) {
+            if(n == -EINTR) n = 0;
+            else {
+                log_warning("%s: send failed: %s", __func__, strerror(-n));
+                return false;
+            }
+        }
+        // skip the bytes sent, partial write is possible
+        while(msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov->iov_len) {
+            n -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if(msg.msg_iovlen == 0) break;
+        msg.msg_iov->iov_base = (char*)msg.msg_iov->iov_base + n;
+        msg.msg_iov->iov_len -= n;
+
+        n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        m_stats.syscalls++;
+        if(n < 0) n = -errno;
+    }
+    return true;
+}
+
+#ifdef HAVE_LIBURING
+
+// user_data of the ring entries: operation index and kind
+enum { OP_WRITE = 0, OP_CLOSE = 1, OP_SEND = 2 };
+static inline void *opData(size_t idx, int kind) {
+    return (void*)(uintptr_t)((idx << 2) | kind);
+}
+
+/**
+ * @fn ssize_t CIoBatch::submitUring(int sendfd, struct msghdr *msg)
+ * @brief submits queued writes and the send if sendfd >= 0, waits for all
+ *        completions. With the send each write is linked with the file close,
+ *        without it complete() closes the files. The rest of a short write is
+ *        submitted again
+ * @return bytes sent or -errno
+ */
+ssize_t CIoBatch::submitUring(int sendfd, struct msghdr *msg) {
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    ssize_t sent = 0;
+    size_t next = 0;
+    bool sendQueued = sendfd < 0;
+
+    while(next < m_ops.size() || !sendQueued) {
+        unsigned queued = 0;
+        size_t again = m_ops.size();   // the first short write to submit again
+        for(; next < m_ops.size() && io_uring_sq_space_left(&m_ring) >= 2; next++) {
+            ioOp_t& op = m_ops[next];
+            if(op.submitted || op.error) continue;
+            sqe = io_uring_get_sqe(&m_ring);
+            io_uring_prep_write(sqe, op.fd, op.data.data() + op.done, op.data.size() - op.done, op.done);
+            io_uring_sqe_set_data(sqe, opData(next, OP_WRITE));
+            op.submitted = true;
+            queued++;
+            if(sendfd < 0) continue;
+            sqe->flags |= IOSQE_IO_LINK; // close only after the complete write
+            sqe = io_uring_get_sqe(&m_ring);
+            io_uring_prep_close(sqe, op.fd);
+            io_uring_sqe_set_data(sqe, opData(next, OP_CLOSE));
+            queued++;
+        }
+        if(!sendQueued && io_uring_sq_space_left(&m_ring) >= 1) {
+            sqe = io_uring_get_sqe(&m_ring);
+            io_uring_prep_sendmsg(sqe, sendfd, msg, MSG_NOSIGNAL|MSG_WAITALL);
+            io_uring_sqe_set_data(sqe, opData(0, OP_SEND));
+            sendQueued = true;
+            queued++;
+        }
+        if(queued == 0) break;
+
+        int rv;
+        do {
+            rv = io_uring_submit_and_wait(&m_ring, queued);
+            m_stats.syscalls++;
+        } while(rv == -EINTR);
+        m_stats.batches++;
+        if(rv < 0) {
+            // nothing is submitted, the ring is unusable: fall back to plain I/O
+            log_warning("%s: io_uring_submit failed, using plain I/O: %s", __func__, strerror(-rv));
+            io_uring_queue_exit(&m_ring);
+            m_uring = false;
+            for(auto &op : m_ops) op.submitted = false;
+            return 0;
+        }
+
+        for(unsigned i = 0; i < queued; i++) {
+            do {
+                rv = io_uring_wait_cqe(&m_ring, &cqe);
+            } while(rv == -EINTR);
+            if(rv < 0) break;
+            uintptr_t data = (uintptr_t)io_uring_cqe_get_data(cqe);
+            int res = cqe->res;
+            io_uring_cqe_seen(&m_ring, cqe);
+
+            ioOp_t& op = m_ops[data >> 2];
+            switch(data & 3) {
+            case OP_WRITE:
+                if(res < 0) op.error = -res;
+                else if(res == 0 && op.done < op.data.size()) op.error = EIO;
+                else if((op.done += res) < op.data.size()) {
+                    // the linked close is cancelled, both go again
+                    op.submitted = false;
+                    if((data >> 2) < again) again = data >> 2;
+                }
+                break;
+            case OP_CLOSE:
+                // cancelled after the failed or short write, closed by complete()
+                if(res == -ECANCELED) break;
+                op.fd = -1;
+                if(res < 0 && !op.error) op.error = -res;
+                break;
+            case OP_SEND:
+                sent = res;
+                break;
+            }
+        }
+        if(again < next) next = again;
+    }
+    return sent;
+}
+
+#endif // #ifdef HAVE_LIBURING
@@ -0,0 +1,128 @@
+/**
+ * @file   batchstate.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Thu Oct 22 10:18:06 2026
+ *
+ * @brief  CBatchState class implementation: independent queries are sent to
+ *         the database together and wait for one round trip
+ *
+ */
+
+#include "config.h"
+#include <cctype>
+#include <boost/lexical_cast.hpp>
+#include "apputils.hpp"
+#include "cstate.hpp"
+#include "parser.hpp"
+#include "cassigner.hpp"
+#include "database.hpp"
+
+namespace pt = boost::property_tree;
+extern pt::ptree *cpt;                       // property tree: global configuration
+extern const char *syntax_error;
+
+// *********************************************************************
+// *** CBatchState
+// *********************************************************************
+
+CBatchState::CBatchState(const int stateno, const std::string& scriptName):
+    CState(stateno, scriptName, "batch"), m_dbsection(""), m_bind(false), m_retry(false) { };
+
+CBatchState::~CBatchState() {
+    clearResults();
+    for(auto &it : m_assignments) delete it;
+};
+
+void CBatchState::clearResults() {
+    for(auto &it : m_results) delete it;
+    m_results.clear();
+}
+
+int CBatchState::parse(const std::string& line, const std::string& file, unsigned counter) {
+    regmatch_t regmatch[REGMATCH_COUNT];
+    regoff_t len;
+    if(is_matched("db", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_dbsection = line.substr(regmatch[1].rm_so, len);
+        if(cpt->find(m_dbsection) == cpt->not_found()) {
+            log_error("%s:%u: '%s' database section is not defined in configuration!",
+                      file.c_str(), counter, m_dbsection.c_str());
+        }
+        addDBSection(m_dbsection);
+    }
+    else if(is_matched("query", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_queries.push_back(line.substr(regmatch[1].rm_so, len));
+        m_statements.push_back("");
+        m_bindVars.push_back(std::vector<std::string>());
+    }
+    else if(is_matched("bind", line, regmatch, 0, file, counter)) {
+        m_bind = true;
+    }
+    else if(is_matched("retry", line, regmatch, 0, file, counter)) {
+        m_retry = true;
+    }
+    else m_assignments.push_back(parseAssignment(line, get_number(), file, counter));
+    return 0;
+}
+
+bool CBatchState::verify() {
+    for(size_t i = 0; m_bind && i < m_queries.size(); i++) {
+        if(!bindVariables(m_queries[i], get_number(), m_statements[i], m_bindVars[i])) {
+            // interpolated at run time
+            log_warning("%s:%d: query %u can not be prepared, variables are interpolated",
+                        get_scriptName().c_str(), get_number(), (unsigned)i);
+            m_statements[i] = "";
+            m_bindVars[i].clear();
+        }
+    }
+    return
+        get_errorState() > 0 && get_nextState() > 0 && get_errorState() != get_nextState() &&
+        m_dbsection.length() > 0 && m_queries.size() > 0;
+}
+
+// $qN.column or $qN.M, N is the query number from 0
+char* CBatchState::getPropositional(const std::string& name) const {
+    size_t dot = name.find('.');
+    if(name.length() < 5 || name[1] != 'q' || !isdigit(name[2]) || dot == std::string::npos) return nullptr;
+    size_t num;
+    try {
+        num = boost::lexical_cast<size_t>(name.substr(2, dot - 2));
+    }
+    catch(...) {
+        return nullptr;
+    }
+    if(num >= m_results.size() || !m_results[num]) return nullptr;
+    return m_results[num]->getPropositional("$" + name.substr(dot + 1));
+}
+
+int CBatchState::execute(const FCGX_Request *request, CAssigner* assigner) {
+    std::vector<std::string> statements(m_queries.size());
+    std::vector<std::vector<std::string> > values(m_queries.size());
+    std::vector<qparams_t> params(m_queries.size());
+
+    clearResults();
+    try {
+        for(size_t i = 0; i < m_queries.size(); i++) {
+            if(m_statements[i].empty()) {
+                assigner->evaluate(m_queries[i], statements[i], this);
+                continue;
+            }
+            statements[i] = m_statements[i];
+            // missing variable is an empty string, as interpolated
+            for(const auto &it : m_bindVars[i]) {
+                char *val = assigner->getValue(it);
+                values[i].push_back(val ? val : "");
+                free(val);
+            }
+            for(const auto &it : values[i]) params[i].push_back(it.c_str());
+        }
+        m_results = getDatabase(m_dbsection)->batch(statements, params, m_retry);
+        for(const auto &it : m_assignments) assigner->assign(it, this);
+    }
+    catch(const std::exception& e) {
+        log_warning("%s:%s:%d: %s", get_scriptName().c_str(), get_stateName().c_str(), get_number(), e.what());
+        return get_errorState();
+    }
+    return get_nextState();
+}
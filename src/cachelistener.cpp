@@ -0,0 +1,159 @@
+/**
+ * @file   cachelistener.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Sat Oct 24 10:32:51 2026
+ *
+ * @brief  CCacheListener class definition
+ *
+ */
+
+#include "config.h"
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include "apputils.hpp"
+#include "database.hpp"
+#include "statecache.hpp"
+#include "cachelistener.hpp"
+
+namespace pt = boost::property_tree;
+extern pt::ptree *cpt;                       // property tree: global configuration
+
+CCacheListener cacheListener;
+
+void CCacheListener::CReceiver::operator()(const std::string& payload, int pid) {
+    m_listener->notified(channel(), payload);
+}
+
+CCacheListener::CCacheListener(): m_connectString(""), m_connection(nullptr), m_retryAt(0), m_backoff(1),
+                                  m_notifications(0), m_invalidations(0), m_reconnects(0) {}
+
+/**
+ * @fn bool CCacheListener::create()
+ * @brief reads [statecache] listen and channels and connects, called by
+ *        master after stateCacheInit
+ * @return false if the listener is not configured or there are no tags
+ */
+bool CCacheListener::create() {
+    const std::string section = cpt->get<std::string>("statecache.listen", "");
+    std::string channels = boost::trim_copy(cpt->get<std::string>("statecache.channels", ""));
+    if(section.empty() || channels.empty() || !stateCache.is_enabled()) return false;
+    if(cpt->get<std::string>(section + ".dbtype", "") != "postgresql")
+        log_error("%s: [statecache] listen: %s is not a postgresql section", __func__, section.c_str());
+    // master must not hang on the host dropping packets
+    m_connectString = pgConnectString(section) + " connect_timeout=" +
+        std::to_string(cpt->get<unsigned>("statecache.listen_timeout", LISTEN_CONNECT_TIMEOUT));
+    boost::split(m_channels, channels, boost::is_any_of(", \t"), boost::token_compress_on);
+    connect();
+    return true;
+}
+
+// the next attempt is delayed on failure, the master loop goes on
+void CCacheListener::connect() {
+    try {
+        m_connection = new pqxx::connection(m_connectString);
+        for(const auto &it : m_channels) m_receivers.push_back(new CReceiver(this, *m_connection, it));
+        m_connection->get_notifs(); // LISTEN is sent
+    }
+    catch(const std::exception& e) {
+        log_warning("%s: %s", __func__, e.what());
+        drop();
+        m_retryAt = time(nullptr) + m_backoff;
+        m_backoff = std::min(m_backoff * 2, (unsigned)LISTEN_BACKOFF_MAX);
+        return;
+    }
+    if(m_retryAt) m_reconnects++;
+    m_retryAt = 0;
+    m_backoff = 1;
+    invalidateCacheTags();
+    log_message("%s: listening on %s", __func__, boost::join(m_channels, ", ").c_str());
+}
+
+void CCacheListener::drop() {
+    for(auto &it : m_receivers) delete it;
+    m_receivers.clear();
+    delete m_connection;
+    m_connection = nullptr;
+}
+
+void CCacheListener::destroy() {
+    drop();
+    m_connectString = "";
+}
+
+void CCacheListener::notified(const std::string& channel, const std::string& payload) {
+    std::vector<std::string> tags;
+    m_notifications++;
+    if(payload.empty()) tags.push_back(channel);
+    else boost::split(tags, payload, boost::is_any_of(", \t"), boost::token_compress_on);
+    for(const auto &it : tags) {
+        if(it.empty()) continue;
+        if(invalidateCacheTag(it)) {
+            m_invalidations++;
+            log_message("%s: %s: %s invalidated", __func__, channel.c_str(), it.c_str());
+        }
+        else log_debug("%s: %s: %s: no such tag", __func__, channel.c_str(), it.c_str());
+    }
+}
+
+// broken connection is restored by check()
+void CCacheListener::receive() {
+    if(!m_connection) return;
+    try {
+        m_connection->get_notifs();
+    }
+    catch(const std::exception& e) {
+        log_warning("%s: %s", __func__, e.what());
+        drop();
+        m_retryAt = time(nullptr);
+    }
+}
+
+// housekeeping: reconnects
+void CCacheListener::check() {
+    if(m_connectString.empty()) return;
+    if(m_connection && !m_connection->is_open()) {
+        drop();
+        m_retryAt = time(nullptr);
+    }
+    if(!m_connection && time(nullptr) >= m_retryAt) connect();
+}
+
+int CCacheListener::fd() const {
+    return m_connection ? m_connection->sock() : -1;
+}
+
+// sleep(3) replacement for the master loop: the notifications are handled
+// as they come, returns after the time is over or a signal
+void CCacheListener::wait(unsigned seconds) {
+    const time_t until = time(nullptr) + seconds;
+    if(fd() < 0) {
+        sleep(seconds);
+        return;
+    }
+    while(fd() >= 0) {
+        const time_t now = time(nullptr);
+        if(now >= until) return;
+        struct pollfd pfd;
+        pfd.fd = fd();
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int rv = poll(&pfd, 1, (until - now) * 1000);
+        if(rv < 0) {
+            if(errno != EINTR) log_warning("%s: poll failed: %s", __func__, strerror(errno));
+            return;
+        }
+        if(rv > 0) receive();
+    }
+}
+
+void CCacheListener::logStats() {
+    if(m_connectString.empty()) return;
+    log_message("cache listener: %s, notifications %lu, invalidations %lu, reconnects %lu",
+                m_connection ? "connected" : "disconnected", m_notifications, m_invalidations, m_reconnects);
+}
@@ -14,6 +14,7 @@
 #include "myexceptions.hpp"
 #include "cassigner.hpp"
 #include "parser.hpp"
+#include "singleflight.hpp"
 
 CAssigner::CAssigner(const std::string& libmemcachedconfig) {
     m_mcached = memcached(libmemcachedconfig.c_str(), libmemcachedconfig.length());
@@ -32,10 +33,20 @@ const char* CAssigner::assignGlobal(const std::string& var, const char *val) {
         if(rv != MEMCACHED_SUCCESS)
             throw memcache_error(memcached_strerror(m_mcached, rv), rv);
         free(const_cast<char*>(val));        
+        landFlight(var);
     }
     return 0;
 }
 
+// the global is set or the request is over: release the waiting children
+void CAssigner::landFlight(const std::string& var) {
+    const auto it = m_flights.find(var);
+    if(it != m_flights.end()) {
+        singleFlight.end(it->second);
+        m_flights.erase(it);
+    }
+}
+
 const char* CAssigner::assignLocal(const std::string& var, const char *val) {
     if(val) {
         const auto it = m_symTable.find(var);
@@ -50,6 +61,15 @@ char* CAssigner::getGlobal(const std::string& var) const {
     uint32_t flags;
     memcached_return_t rv;
     char* out = memcached_get(m_mcached, var.c_str(), var.length(), &outlen, &flags, &rv);
+    if(rv == MEMCACHED_NOTFOUND && singleFlight.get_globals() && m_flights.find(var) == m_flights.end() &&
+       assignedGlobals.count(var)) {
+        // the first child to miss fills the global, the others wait for it;
+        // no one waits for a global no script sets
+        int slot = singleFlight.begin("global" + std::string(1, '\0') + var);
+        if(slot >= 0) m_flights[var] = slot;
+        else if(slot == SF_WAITED)
+            out = memcached_get(m_mcached, var.c_str(), var.length(), &outlen, &flags, &rv);
+    }
     if(rv != MEMCACHED_SUCCESS) throw memcache_error(memcached_strerror(m_mcached, rv), rv);
     return out;
 }
@@ -68,9 +88,16 @@ char* CAssigner::getLocalPtr(const std::string& var) const {
     return  nullptr;
 }
 
+// the script is over, the globals it has not set are not waited for
+void CAssigner::landFlights() {
+    for(const auto &it : m_flights) singleFlight.end(it.second);
+    m_flights.clear();
+}
+
 void CAssigner::resetTable() {
     for(const auto &it : m_symTable) free(it.second);    
     m_symTable.clear();
+    landFlights();
 }
 
 void CAssigner::assign(const assignmentList_t* assignment, const CState* state) {
@@ -7,29 +7,140 @@
  */
 
 #include "config.h"
+#include <sys/mman.h>
+#include <cerrno>
+#include <cstring>
+#include <cctype>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/algorithm/string/split.hpp>
 #include "database.hpp"
 #include "myexceptions.hpp"
 #include "apputils.hpp"
+#include "deadline.hpp"
+#include "statecache.hpp"
 #include <boost/property_tree/ptree.hpp>
 
 namespace pt = boost::property_tree;
 extern pt::ptree *cpt;                       // property tree: global configuration
 
 static std::map<std::string, CDatabase*> dbMap;
+static dbStats_t *dbStats = nullptr;        // shared, in dbMap order
+
+// $N is the column number, $name is the column name; NULL is an empty string
+char* CQueryResult::getPropositional(const std::string& name) const {
+    if(name.length() < 2) return nullptr;
+    int col;
+    if(isdigit(name[1])) {
+        try {
+            col = boost::lexical_cast<int>(name.substr(1));
+        }
+        catch(...) {
+            return nullptr;
+        }
+    }
+    else col = column(name.substr(1));
+    if(col < 0 || (size_t)col >= columns()) return nullptr;
+    const char *val = value(col);
+    return val ? strndup(val, length(col)) : strdup("");
+}
+
+// *********************************************************************
+// *** CMemoResult
+// *********************************************************************
+
+CMemoResult::CMemoResult(const std::string& memo): CQueryResult(), m_data(""), m_columns(0) {
+    const char *value;
+    size_t len, pos = 0;
+    while(memoUnpack(memo, pos, &value, &len)) {
+        m_offsets.push_back(value ? m_data.size() : std::string::npos);
+        m_lengths.push_back(len);
+        if(value) m_data.append(value, len);
+        m_data.push_back('\0');
+    }
+    if(m_offsets.size() % 2 == 0) m_columns = m_offsets.size() / 2;
+    // a column name is never NULL
+    for(size_t col = 0; col < m_columns; col++) if(m_offsets[col] == std::string::npos) m_columns = 0;
+}
+
+int CMemoResult::column(const std::string& name) const {
+    for(size_t i = 0; i < m_columns; i++)
+        if(name.compare(0, std::string::npos, m_data.data() + m_offsets[i], m_lengths[i]) == 0) return i;
+    return -1;
+}
+
+const char* CMemoResult::value(size_t col) const {
+    const size_t offset = m_offsets[m_columns + col];
+    return offset == std::string::npos ? nullptr : m_data.data() + offset;
+}
 
 // filled before fork
 void addDBSection(const std::string& section) {
     dbMap[section] = nullptr;
 }
 
+// connected and checked, throws if the database is unavailable
 CDatabase* getDatabase(const std::string& section) {
      const auto it = dbMap.find(section);
-     if(it != dbMap.end()) return it->second;
+     // the states fail at once, the reply is late already
+     if(deadlineExpired()) throw std::runtime_error(section + ": request deadline is exceeded");
+     if(it != dbMap.end()) {
+         if(it->second) it->second->checkout();
+         return it->second;
+     }
      return 0;
 }
 
-// running after fork, in child process
+// called by master before fork, when the scripts are parsed
+void dbStatsInit() {
+    if(dbMap.empty()) return;
+    void *mem = mmap(nullptr, DB_SECTIONS_MAX * sizeof(dbStats_t), PROT_READ|PROT_WRITE,
+                     MAP_ANON|MAP_SHARED, -1, 0);
+    if(mem == MAP_FAILED) {
+        log_warning("%s: mmap failed: %s", __func__, strerror(errno));
+        return;
+    }
+    dbStats = (dbStats_t*)mem;
+    int i = 0;
+    for(const auto &it : dbMap) {
+        if(i == DB_SECTIONS_MAX) break;
+        strncpy(dbStats[i++].section, it.first.c_str(), sizeof(dbStats->section) - 1);
+    }
+}
+
+void logDBStats() {
+    for(int i = 0; dbStats && i < DB_SECTIONS_MAX && dbStats[i].section[0]; i++)
+        log_message("db %s: connects %lu, reconnects %lu, failures %lu, retries %lu, checks %lu, "
+                    "replica reads %lu, ejections %lu",
+                    dbStats[i].section, dbStats[i].connects, dbStats[i].reconnects,
+                    dbStats[i].failures, dbStats[i].retries, dbStats[i].checks,
+                    dbStats[i].replicaReads, dbStats[i].ejections);
+}
+
+// libpq connection string of the postgresql section, the same defaults as connectDBs
+std::string pgConnectString(const std::string& section) {
+    return "user=" + cpt->get<std::string>(section + ".dbuser", "smarty") +
+        " password=" + cpt->get<std::string>(section + ".dbpswd", "smarty") +
+        " dbname=" + cpt->get<std::string>(section + ".dbname", "smarty") +
+        " host=" + cpt->get<std::string>(section + ".dbhost", "localhost") +
+        " port=" + boost::lexical_cast<std::string>(cpt->get<int>(section + ".dbport", 5432));
+}
+
+static CPgDatabase* newPgDatabase(const std::string& section, const std::string& dbname,
+                                  const std::string& dbuser, const std::string& dbpswd,
+                                  const std::string& dbhost, int dbport, dbStats_t *stats)
+{
+    CPgDatabase *db = new CPgDatabase(dbname, dbuser, dbpswd, dbhost, dbport);
+    db->set_logColumns(cpt->get<bool>(section + ".logcolumns", false));
+    db->set_checkIdle(cpt->get<unsigned>(section + ".dbcheck", DB_CHECK_IDLE));
+    db->set_statementTimeout(cpt->get<unsigned>(section + ".dbtimeout", 0));
+    db->set_stats(stats);
+    return db;
+}
+
+// running after fork, in child process. Connections are opened on the first use
 void connectDBs() {
+    int i = 0;
     for(auto &it : dbMap) {
         const std::string dbkey = it.first + ".dbtype";
         const std::string dbtype = cpt->get<std::string>(dbkey);
@@ -47,17 +158,63 @@ void connectDBs() {
             std::string dbpswd = cpt->get<std::string>(dbpswd_key, "smarty");
             std::string dbhost = cpt->get<std::string>(dbhost_key, "localhost");
             int         dbport = cpt->get<int>(dbport_key, 5432);
-            it.second = new CPgDatabase(dbname, dbuser, dbpswd, dbhost, dbport);
-            it.second->connect();
-            log_message("%s: %s@%s:%d: connected",  __func__, dbname.c_str(), dbhost.c_str(), dbport);
+            dbStats_t *stats = dbStats && i < DB_SECTIONS_MAX ? &dbStats[i] : nullptr;
+            CPgDatabase *db = newPgDatabase(it.first, dbname, dbuser, dbpswd, dbhost, dbport, stats);
+
+            // dbreplicas = host[:port] [weight], ...
+            std::string replicas = boost::trim_copy(cpt->get<std::string>(it.first + ".dbreplicas", ""));
+            if(replicas.empty()) {
+                it.second = db;
+                i++;
+                continue;
+            }
+            CPgCluster *cluster = new CPgCluster(db);
+            cluster->set_ejectTime(cpt->get<unsigned>(it.first + ".dbeject", DB_EJECT_TIME));
+            cluster->set_stats(stats);
+            std::vector<std::string> list;
+            boost::split(list, replicas, boost::is_any_of(","), boost::token_compress_on);
+            for(auto &r : list) {
+                std::vector<std::string> fields;
+                boost::trim(r);
+                boost::split(fields, r, boost::is_any_of(" \t"), boost::token_compress_on);
+                std::string host = fields[0];
+                int port = dbport, weight = 1;
+                std::string::size_type colon = host.find(':');
+                try {
+                    if(colon != std::string::npos) {
+                        port = boost::lexical_cast<int>(host.substr(colon + 1));
+                        host.resize(colon);
+                    }
+                    if(fields.size() > 1) weight = boost::lexical_cast<int>(fields[1]);
+                }
+                catch(boost::bad_lexical_cast &) {
+                    log_error("%s: [%s] dbreplicas: %s: format error", __func__, it.first.c_str(), r.c_str());
+                }
+                cluster->addReplica(newPgDatabase(it.first, dbname, dbuser, dbpswd, host, port, stats), weight, r);
+            }
+            it.second = cluster;
         }
+#ifdef HAVE_SQLITE3
+        else if(dbtype == "sqlite") {
+            // the file is opened by every child, read-only
+            std::string dbfile = cpt->get<std::string>(it.first + ".dbfile", "");
+            if(dbfile.empty()) log_error("%s: [%s] dbfile is not defined", __func__, it.first.c_str());
+            it.second = new CSqliteDatabase(dbfile, cpt->get<size_t>(it.first + ".mmapsize", SQLITE_MMAP_SIZE));
+        }
+#endif
         else {
             log_warning("%s: (yet) unknown database type: %s", __func__, dbtype.c_str());
             throw unsupported_feature(dbtype + ": unknown database type");
         }
+        i++;
     }
 }
 
+// request is over
+void finishDBs() {
+    for(const auto &it : dbMap) if(it.second) it.second->finish();
+}
+
 void disconnectDBs() {
     for(const auto &it : dbMap) delete it.second;
 }
@@ -0,0 +1,203 @@
+/**
+ * @file   circuitbreaker.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Mon Oct 26 10:42:15 2026
+ *
+ * @brief  CCircuitBreaker class definition
+ *
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <boost/property_tree/ptree.hpp>
+#include "apputils.hpp"
+#include "shmcache.hpp"
+#include "curlpool.hpp"
+#include "deadline.hpp"
+#include "circuitbreaker.hpp"
+
+namespace pt = boost::property_tree;
+extern pt::ptree *cpt;                       // property tree: global configuration
+
+CCircuitBreaker circuitBreaker;
+
+CCircuitBreaker::CCircuitBreaker(): m_table(nullptr), m_failures(CIRCUIT_FAILURES),
+                                    m_errorRate(CIRCUIT_ERRORRATE), m_minRequests(CIRCUIT_MINREQUESTS),
+                                    m_window(CIRCUIT_WINDOW * 1000), m_openTime(CIRCUIT_OPENTIME) {}
+
+/**
+ * @fn bool CCircuitBreaker::create()
+ * @brief reads [circuitbreaker] section and maps the table, called by
+ *        master before fork. No section - no breaker
+ * @return false if the breaker is off
+ */
+bool CCircuitBreaker::create() {
+    pthread_mutexattr_t attr;
+
+    if(!cpt->get_child_optional("circuitbreaker")) return false;
+    m_failures = cpt->get<unsigned>("circuitbreaker.failures", CIRCUIT_FAILURES);
+    m_errorRate = cpt->get<unsigned>("circuitbreaker.errorrate", CIRCUIT_ERRORRATE);
+    m_minRequests = cpt->get<unsigned>("circuitbreaker.minrequests", CIRCUIT_MINREQUESTS);
+    m_window = cpt->get<unsigned>("circuitbreaker.window", CIRCUIT_WINDOW) * 1000;
+    m_openTime = cpt->get<unsigned>("circuitbreaker.opentime", CIRCUIT_OPENTIME);
+
+    void *mem = mmap(nullptr, sizeof(table_t), PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED, -1, 0);
+    if(mem == MAP_FAILED) {
+        log_warning("%s: mmap failed: %s", __func__, strerror(errno));
+        return false;
+    }
+    m_table = (table_t*)mem; // zeroed: all the slots are free
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&m_table->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return true;
+}
+
+void CCircuitBreaker::destroy() {
+    if(!m_table) return;
+    pthread_mutex_destroy(&m_table->mutex);
+    munmap(m_table, sizeof(table_t));
+    m_table = nullptr;
+}
+
+void CCircuitBreaker::lock() {
+    if(pthread_mutex_lock(&m_table->mutex) == EOWNERDEAD) pthread_mutex_consistent(&m_table->mutex);
+}
+
+// must be called locked; nullptr if the table is full
+CCircuitBreaker::circuit_t* CCircuitBreaker::find(const std::string& upstream, bool add) {
+    const uint64_t hash = hash64(upstream.data(), upstream.size());
+    for(size_t i = 0; i < CIRCUIT_SLOTS; i++) {
+        circuit_t *c = &m_table->circuits[(hash + i) % CIRCUIT_SLOTS];
+        if(c->hash == hash) return c;
+        if(c->hash == 0) {
+            if(!add) return nullptr;
+            c->hash = hash;
+            strncpy(c->upstream, upstream.c_str(), sizeof(c->upstream) - 1);
+            c->windowStart = monotonicMs();
+            return c;
+        }
+    }
+    return nullptr;
+}
+
+void CCircuitBreaker::open(circuit_t *c, long long now) {
+    if(c->state == CLOSED)
+        log_warning("%s: %s: circuit is open, %u failures in a row, %u of %u calls failed",
+                    __func__, c->upstream, c->consecutive, c->failures, c->calls);
+    c->state = OPEN;
+    c->openedAt = now;
+    c->probe = 0;
+    c->opened++;
+}
+
+/**
+ * @fn bool CCircuitBreaker::allow(const std::string& url)
+ * @brief checks the circuit of the url upstream before the call. When the
+ *        open time is over the caller becomes the probe, the others are
+ *        rejected for the open time; a probe not over by then is replaced
+ * @return false if the call must fail at once
+ */
+bool CCircuitBreaker::allow(const std::string& url) {
+    if(!m_table) return true;
+    const std::string upstream = curlUpstream(url);
+    bool allowed = true;
+
+    lock();
+    circuit_t *c = find(upstream, false);
+    if(c && c->state != CLOSED) {
+        const long long now = monotonicMs();
+        if(now - c->openedAt >= m_openTime) {
+            if(c->state == OPEN) log_message("%s: %s: circuit is half-open", __func__, c->upstream);
+            c->state = HALF_OPEN;
+            c->openedAt = now;
+            c->probe = getpid();
+        }
+        else {
+            c->rejected++;
+            allowed = false;
+        }
+    }
+    unlock();
+    return allowed;
+}
+
+/**
+ * @fn void CCircuitBreaker::release(const std::string& url)
+ * @brief the allowed call is cancelled or not started, nothing is recorded.
+ *        If it is the probe the next call becomes the probe at once
+ */
+void CCircuitBreaker::release(const std::string& url) {
+    if(!m_table) return;
+    const std::string upstream = curlUpstream(url);
+
+    lock();
+    circuit_t *c = find(upstream, false);
+    if(c && c->state == HALF_OPEN && c->probe == getpid()) {
+        c->state = OPEN;
+        c->openedAt = monotonicMs() - m_openTime;
+        c->probe = 0;
+    }
+    unlock();
+}
+
+/**
+ * @fn void CCircuitBreaker::record(const std::string& url, bool success)
+ * @brief counts the call of the url upstream over, opens or closes the circuit
+ */
+void CCircuitBreaker::record(const std::string& url, bool success) {
+    if(!m_table) return;
+    const std::string upstream = curlUpstream(url);
+    const long long now = monotonicMs();
+
+    lock();
+    circuit_t *c = find(upstream, !success);
+    if(c) {
+        if(now - c->windowStart >= m_window) {
+            c->windowStart = now;
+            c->calls = c->failures = 0;
+        }
+        c->calls++;
+        if(success) c->consecutive = 0;
+        else {
+            c->failures++;
+            c->consecutive++;
+        }
+
+        if(c->state == HALF_OPEN && c->probe == getpid()) {
+            if(success) {
+                log_message("%s: %s: circuit is closed", __func__, c->upstream);
+                c->state = CLOSED;
+                c->probe = 0;
+                c->windowStart = now;
+                c->calls = c->failures = 0;
+            }
+            else open(c, now);
+        }
+        else if(c->state == CLOSED && !success &&
+                (c->consecutive >= m_failures ||
+                 (c->calls >= m_minRequests && c->failures * 100 >= m_errorRate * c->calls)))
+            open(c, now);
+    }
+    unlock();
+}
+
+void CCircuitBreaker::logStats() {
+    if(!m_table) return;
+    lock();
+    for(size_t i = 0; i < CIRCUIT_SLOTS; i++) {
+        const circuit_t *c = &m_table->circuits[i];
+        if(c->hash == 0 || (c->opened == 0 && c->state == CLOSED)) continue;
+        log_message("circuit %s: %s, opened %lu times, %lu calls rejected", c->upstream,
+                    c->state == CLOSED ? "closed" : c->state == OPEN ? "open" : "half-open",
+                    c->opened, c->rejected);
+    }
+    unlock();
+}
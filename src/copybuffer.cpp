@@ -0,0 +1,363 @@
+/**
+ * @file   copybuffer.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Fri Oct 23 15:42:19 2026
+ *
+ * @brief  Buffered COPY of the write states rows
+ *
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <boost/algorithm/string.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include "apputils.hpp"
+#include "database.hpp"
+#include "shmcache.hpp"
+#include "deadline.hpp"
+#include "copybuffer.hpp"
+
+namespace pt = boost::property_tree;
+extern pt::ptree *cpt;                       // property tree: global configuration
+
+struct copyBuffer_t {
+    std::string section;
+    std::string table;
+    std::vector<std::string> columns;
+    std::vector<std::string> lines;
+    long long since;                  // ms, the oldest row
+    unsigned rows;                    // copyrows
+    long long flush;                  // ms, copyflush
+    int spoolfd;                      // -1 - no spool
+    std::string spool;
+};
+
+static std::map<std::string, copyBuffer_t> copyBuffers;
+
+// COPY text format: \N is NULL, the separators are escaped
+std::string copyEscape(const char *value) {
+    if(!value) return "\\N";
+    std::string out("");
+    for(const char *p = value; *p; p++) {
+        switch(*p) {
+        case '\\': out.append("\\\\"); break;
+        case '\t': out.append("\\t"); break;
+        case '\n': out.append("\\n"); break;
+        case '\r': out.append("\\r"); break;
+        default: out.push_back(*p);
+        }
+    }
+    return out;
+}
+
+// the first line of the spool file: section, table and columns
+static std::string spoolHeader(const copyBuffer_t& buf) {
+    return buf.section + "\t" + buf.table + "\t" + boost::join(buf.columns, ",") + "\n";
+}
+
+// the rows given up are left to the next child to check the spools; the name
+// is unique, the rows given up earlier may be there still
+static void orphanSpool(const std::string& spool) {
+    static unsigned orphans = 0;
+    const std::string orphan = spool + "." + std::to_string(time(nullptr)) + "-" + std::to_string(++orphans);
+    if(rename(spool.c_str(), orphan.c_str()) < 0)
+        log_warning("%s: %s: %s", __func__, orphan.c_str(), strerror(errno));
+}
+
+static void openSpool(copyBuffer_t& buf) {
+    const int flags = O_WRONLY|O_CREAT|O_EXCL|O_APPEND|O_CLOEXEC;
+    buf.spoolfd = open(buf.spool.c_str(), flags, 0640);
+    if(buf.spoolfd < 0 && errno == EEXIST) {
+        // the spool of a dead child with the same pid, its rows are not lost
+        orphanSpool(buf.spool);
+        buf.spoolfd = open(buf.spool.c_str(), flags, 0640);
+    }
+    if(buf.spoolfd < 0) {
+        log_warning("%s: %s: %s, rows are not spooled", __func__, buf.spool.c_str(), strerror(errno));
+        return;
+    }
+    const std::string header = spoolHeader(buf);
+    if(write(buf.spoolfd, header.data(), header.size()) < 0)
+        log_warning("%s: %s: %s", __func__, buf.spool.c_str(), strerror(errno));
+}
+
+/**
+ * @fn void copyAppend(const std::string& dbsection, const std::string& table, const std::vector<std::string>& columns, const std::string& line)
+ * @brief adds the row to the buffer of the table
+ * @param line -- COPY text format, values escaped with copyEscape
+ */
+void copyAppend(const std::string& dbsection, const std::string& table,
+                const std::vector<std::string>& columns, const std::string& line)
+{
+    std::string key(dbsection);
+    key.push_back('\0');
+    key.append(table);
+    for(const auto &it : columns) {
+        key.push_back('\0');
+        key.append(it);
+    }
+    auto it = copyBuffers.find(key);
+    if(it == copyBuffers.end()) {
+        copyBuffer_t buf;
+        buf.section = dbsection;
+        buf.table = table;
+        buf.columns = columns;
+        buf.since = 0;
+        buf.rows = cpt->get<unsigned>(dbsection + ".copyrows", COPY_ROWS);
+        buf.flush = cpt->get<long long>(dbsection + ".copyflush", COPY_FLUSH) * 1000;
+        buf.spoolfd = -1;
+        if(buf.rows == 0) buf.rows = 1;
+        const std::string dir = cpt->get<std::string>(dbsection + ".copyspool", "");
+        if(dir.length()) {
+            char name[64];
+            snprintf(name, sizeof(name), "/%016llx.%d.copy", (unsigned long long)hash64(key.data(), key.size()), getpid());
+            buf.spool = dir + name;
+            openSpool(buf);
+        }
+        it = copyBuffers.insert(std::make_pair(key, buf)).first;
+    }
+    copyBuffer_t& buf = it->second;
+    if(buf.lines.empty()) buf.since = monotonicMs();
+    buf.lines.push_back(line);
+    if(buf.spoolfd >= 0) {
+        const std::string rec = line + "\n";
+        if(write(buf.spoolfd, rec.data(), rec.size()) < 0)
+            log_warning("%s: %s: %s", __func__, buf.spool.c_str(), strerror(errno));
+    }
+}
+
+// <dir>/<hash>.reject for any spool file of the table, empty without spool
+static std::string rejectPath(const std::string& spool) {
+    if(spool.empty()) return "";
+    const size_t slash = spool.rfind('/');
+    return spool.substr(0, spool.find('.', slash == std::string::npos ? 0 : slash)) + ".reject";
+}
+
+// the row is appended to the reject file in the spool format, to be fixed
+// and replayed by hand; logged if there is no spool
+static void rejectRow(const std::string& reject, const std::string& header, const std::string& line) {
+    struct stat st;
+    if(reject.empty()) {
+        log_warning("%s: %s", __func__, line.c_str());
+        return;
+    }
+    const int fd = open(reject.c_str(), O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0640);
+    if(fd < 0) {
+        log_warning("%s: %s: %s, row is lost: %s", __func__, reject.c_str(), strerror(errno), line.c_str());
+        return;
+    }
+    const std::string rec = (fstat(fd, &st) == 0 && st.st_size == 0 ? header : "") + line + "\n";
+    if(write(fd, rec.data(), rec.size()) < 0)
+        log_warning("%s: %s: %s, row is lost: %s", __func__, reject.c_str(), strerror(errno), line.c_str());
+    close(fd);
+}
+
+// SQLSTATE classes 22 and 23: the rows are wrong, not the database
+static inline bool is_dataError(const pqxx::sql_error& e) {
+    return e.sqlstate().compare(0, 2, "22") == 0 || e.sqlstate().compare(0, 2, "23") == 0;
+}
+
+/*
+ * COPY of the rows. A data error of one row fails them all: then they are
+ * copied one by one, the bad ones go to the reject file. Throws if the
+ * database fails, the rows copied or rejected before are removed from lines
+ */
+static void copyRows(CDatabase *db, const std::string& table, const std::vector<std::string>& columns,
+                     std::vector<std::string>& lines, const std::string& header, const std::string& reject)
+{
+    try {
+        db->copy(table, columns, lines);
+        return;
+    }
+    catch(const pqxx::sql_error& e) {
+        if(!is_dataError(e)) throw;
+        log_warning("%s: %s: %s, copying row by row", __func__, table.c_str(), e.what());
+    }
+    std::vector<std::string> row(1);
+    size_t done = 0, rejected = 0;
+    try {
+        for(; done < lines.size(); done++) {
+            row[0] = lines[done];
+            try {
+                db->copy(table, columns, row);
+            }
+            catch(const pqxx::sql_error& e) {
+                if(!is_dataError(e)) throw;
+                rejectRow(reject, header, lines[done]);
+                rejected++;
+            }
+        }
+    }
+    catch(...) {
+        lines.erase(lines.begin(), lines.begin() + done);
+        throw;
+    }
+    log_warning("%s: %s: %zu rows are rejected%s%s", __func__, table.c_str(), rejected,
+                reject.length() ? " to " : "", reject.c_str());
+}
+
+// the spool keeps the rows not copied yet
+static void rewriteSpool(copyBuffer_t& buf) {
+    std::string data = spoolHeader(buf);
+    for(const auto &it : buf.lines) data.append(it + "\n");
+    if(ftruncate(buf.spoolfd, 0) < 0 || write(buf.spoolfd, data.data(), data.size()) < 0)
+        log_warning("%s: %s: %s", __func__, buf.spool.c_str(), strerror(errno));
+}
+
+static bool flushBuffer(copyBuffer_t& buf) {
+    const size_t rows = buf.lines.size();
+    try {
+        copyRows(getDatabase(buf.section), buf.table, buf.columns, buf.lines, spoolHeader(buf), rejectPath(buf.spool));
+    }
+    catch(const std::exception& e) {
+        log_warning("%s: [%s] %s: %zu rows are not copied: %s", __func__,
+                    buf.section.c_str(), buf.table.c_str(), buf.lines.size(), e.what());
+        if(buf.spoolfd >= 0 && buf.lines.size() < rows) rewriteSpool(buf);
+        if(buf.lines.size() >= (size_t)buf.rows * COPY_KEEP) {
+            log_warning("%s: [%s] %s: %zu rows are dropped%s", __func__, buf.section.c_str(), buf.table.c_str(),
+                        buf.lines.size(), buf.spoolfd >= 0 ? ", left in the spool" : "");
+            buf.lines.clear();
+            if(buf.spoolfd >= 0) {
+                close(buf.spoolfd);
+                orphanSpool(buf.spool);
+                openSpool(buf);
+            }
+        }
+        return false;
+    }
+    buf.lines.clear();
+    if(buf.spoolfd >= 0) rewriteSpool(buf);
+    return true;
+}
+
+// rows of a spool file left by the dead child, the file is claimed by rename
+static void copySpoolFile(const std::string& dir, const std::string& name) {
+    const std::string path = dir + "/" + name;
+    const std::string claimed = path + ".replay." + std::to_string(getpid());
+    if(rename(path.c_str(), claimed.c_str()) < 0) return; // another child has it
+    std::ifstream ifs(claimed.c_str());
+    std::string header, line;
+    std::vector<std::string> fields, columns, lines;
+    getline(ifs, header);
+    boost::split(fields, header, boost::is_any_of("\t"));
+    if(fields.size() != 3) {
+        log_warning("%s: %s: bad header", __func__, claimed.c_str());
+        return;
+    }
+    if(fields[2].length()) boost::split(columns, fields[2], boost::is_any_of(","));
+    while(getline(ifs, line)) lines.push_back(line);
+    if(lines.size()) {
+        const size_t rows = lines.size();
+        try {
+            CDatabase *db = getDatabase(fields[0]);
+            if(!db) throw std::runtime_error(fields[0] + ": database section is not used");
+            copyRows(db, fields[1], columns, lines, header + "\n", rejectPath(path));
+        }
+        catch(const std::exception& e) {
+            log_warning("%s: %s: %s", __func__, claimed.c_str(), e.what());
+            if(lines.size() < rows) {
+                // the rows copied one by one are not copied again
+                std::ofstream ofs(claimed.c_str(), std::ios::trunc);
+                ofs << header << "\n";
+                for(const auto &it : lines) ofs << it << "\n";
+            }
+            rename(claimed.c_str(), path.c_str());
+            return;
+        }
+        log_message("%s: %s: %zu rows of the dead child are copied", __func__, name.c_str(), lines.size());
+    }
+    unlink(claimed.c_str());
+}
+
+static inline bool is_dead(const std::string& pid) {
+    return atoi(pid.c_str()) != getpid() && kill(atoi(pid.c_str()), 0) < 0 && errno == ESRCH;
+}
+
+// this child is not replaying now: the file is of a dead child with our pid
+static inline bool is_deadReplay(const std::string& pid) {
+    return atoi(pid.c_str()) == getpid() || is_dead(pid);
+}
+
+/*
+ * the spool files of the children are not running: <hash>.<pid>.copy, or
+ * <hash>.<pid>.copy.<time>-<n> given up after the failures, or
+ * <...>.replay.<pid> of the child died copying it
+ */
+static void checkSpools() {
+    std::map<std::string, bool> dirs;
+    for(const auto &it : copyBuffers) if(it.second.spoolfd >= 0)
+        dirs[it.second.spool.substr(0, it.second.spool.rfind('/'))] = true;
+    for(const auto &d : dirs) {
+        DIR *dir = opendir(d.first.c_str());
+        if(!dir) continue;
+        struct dirent *de;
+        std::vector<std::string> names;
+        while((de = readdir(dir))) {
+            const std::string name = de->d_name;
+            std::vector<std::string> parts;
+            boost::split(parts, name, boost::is_any_of("."));
+            const size_t n = parts.size();
+            if(n < 3 || parts[2] != "copy") continue;
+            if((n == 3 && is_dead(parts[1])) || (n == 4 && parts[3] != "replay") ||
+               (n >= 5 && parts[n - 2] == "replay" && is_deadReplay(parts[n - 1]))) names.push_back(name);
+        }
+        closedir(dir);
+        for(const auto &it : names) copySpoolFile(d.first, it);
+    }
+}
+
+/**
+ * @fn void flushCopyBuffers(bool force)
+ * @brief copies the buffers that have enough rows or the old ones, called at
+ *        the end of every request and with force at the child exit. Not
+ *        called from the signal handler: see closeCopyBuffers()
+ */
+void flushCopyBuffers(bool force) {
+    const long long now = monotonicMs();
+    for(auto &it : copyBuffers) {
+        copyBuffer_t& buf = it.second;
+        if(buf.lines.empty()) continue;
+        if(force || buf.lines.size() >= buf.rows || now - buf.since >= buf.flush) {
+            if(flushBuffer(buf) && buf.spoolfd >= 0) checkSpools();
+        }
+    }
+    if(!force) return;
+    for(auto &it : copyBuffers) {
+        copyBuffer_t& buf = it.second;
+        if(buf.spoolfd < 0) continue;
+        close(buf.spoolfd);
+        buf.spoolfd = -1;
+        if(buf.lines.empty()) unlink(buf.spool.c_str()); // the rows left are copied by another child
+    }
+}
+
+/**
+ * @fn void closeCopyBuffers()
+ * @brief the child is killed: no COPY from the signal handler, the spool
+ *        files are left to the other children, the rows not spooled are lost
+ */
+void closeCopyBuffers() {
+    for(auto &it : copyBuffers) {
+        copyBuffer_t& buf = it.second;
+        if(buf.spoolfd >= 0) {
+            close(buf.spoolfd);
+            buf.spoolfd = -1;
+            if(buf.lines.empty()) unlink(buf.spool.c_str());
+        }
+        else if(buf.lines.size())
+            log_warning("%s: [%s] %s: %zu rows are lost", __func__, buf.section.c_str(),
+                        buf.table.c_str(), buf.lines.size());
+        buf.lines.clear();
+    }
+}
@@ -0,0 +1,175 @@
+/**
+ * @file   cpgcluster.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Thu Oct 22 17:26:45 2026
+ *
+ * @brief  CPgCluster class implementation: read replicas routing
+ *
+ */
+
+#include "config.h"
+#include "database.hpp"
+#include "apputils.hpp"
+#include "deadline.hpp"
+
+// a replica refuses to write: the transaction of the statement is read-only
+#define SQLSTATE_READ_ONLY "25006"
+
+CPgCluster::CPgCluster(CPgDatabase *primary):
+    CDatabase(), m_primary(primary), m_cursorSerial(0), m_ejectTime(DB_EJECT_TIME), m_stats(nullptr),
+    m_stickToPrimary(false) {}
+
+CPgCluster::~CPgCluster() {
+    delete m_primary;
+    for(auto &it : m_replicas) delete it.db;
+}
+
+void CPgCluster::addReplica(CPgDatabase *db, int weight, const std::string& name) {
+    replica_t r;
+    r.db = db;
+    r.weight = weight > 0 ? weight : 1;
+    r.current = 0;
+    r.ejectedUntil = 0;
+    r.name = name;
+    m_replicas.push_back(r);
+}
+
+/**
+ * @fn CPgCluster::replica_t* CPgCluster::choose()
+ * @brief smooth weighted round-robin over the replicas in rotation: every
+ *        pick adds the weights to the current values and takes the largest
+ * @return nullptr if all the replicas are ejected
+ */
+CPgCluster::replica_t* CPgCluster::choose() {
+    const long long now = monotonicMs();
+    replica_t *best = nullptr;
+    int total = 0;
+    for(auto &it : m_replicas) {
+        if(it.ejectedUntil > now) continue;
+        it.current += it.weight;
+        total += it.weight;
+        if(!best || it.current > best->current) best = &it;
+    }
+    if(best) best->current -= total;
+    return best;
+}
+
+void CPgCluster::eject(replica_t *r, const std::exception& e) {
+    log_warning("%s: replica %s: %s, out of rotation for %u s", __func__, r->name.c_str(), e.what(), m_ejectTime);
+    r->ejectedUntil = monotonicMs() + m_ejectTime * 1000LL;
+    r->current = 0;
+    if(m_stats) __sync_fetch_and_add(&m_stats->ejections, 1);
+}
+
+/*
+ * reads go to a replica unless the primary has a transaction open or the
+ * request has written to it: read-your-writes. A read the replica refuses
+ * as a write (a function called by select) is repeated on the primary
+ */
+template<typename R, typename F> R CPgCluster::route(bool read, F f) {
+    bool refused = false;
+    if(read && !m_stickToPrimary && !m_primary->is_inTransaction()) {
+        replica_t *r;
+        while((r = choose())) {
+            try {
+                r->db->checkout();
+                R result = f(r->db);
+                if(m_stats) __sync_fetch_and_add(&m_stats->replicaReads, 1);
+                return result;
+            }
+            catch(const pqxx::broken_connection& e) {
+                eject(r, e);
+            }
+            catch(const pqxx::sql_error& e) {
+                if(e.sqlstate() != SQLSTATE_READ_ONLY) throw;
+                log_message("%s: replica %s: %s, repeated on the primary", __func__, r->name.c_str(), e.what());
+                refused = true;
+                break;
+            }
+        }
+    }
+    // the rest of the request reads its writes
+    if(!read || refused) m_stickToPrimary = true;
+    m_primary->checkout();
+    return f(m_primary);
+}
+
+int CPgCluster::connect() {
+    return m_primary->connect();
+}
+
+int CPgCluster::disconnect() {
+    finish();
+    for(auto &it : m_replicas) it.db->disconnect();
+    return m_primary->disconnect();
+}
+
+// the target is checked out when the statement is routed
+void CPgCluster::checkout() {}
+
+CQueryResult* CPgCluster::query(const std::string& statement, bool repeat) {
+    return route<CQueryResult*>(is_readonly(statement),
+                                [&](CPgDatabase *db) { return db->query(statement, repeat); });
+}
+
+CQueryResult* CPgCluster::execPrepared(const std::string& name, const std::string& statement,
+                                       const qparams_t& params, bool repeat)
+{
+    return route<CQueryResult*>(is_readonly(statement),
+                                [&](CPgDatabase *db) { return db->execPrepared(name, statement, params, repeat); });
+}
+
+std::vector<CQueryResult*> CPgCluster::batch(const std::vector<std::string>& statements,
+                                             const std::vector<qparams_t>& params, bool repeat)
+{
+    bool read = true;
+    for(const auto &it : statements) read = read && is_readonly(it);
+    return route<std::vector<CQueryResult*> >(read,
+                                              [&](CPgDatabase *db) { return db->batch(statements, params, repeat); });
+}
+
+// the cursor stays on the database it is opened on
+unsigned CPgCluster::openCursor(const std::string& statement, const qparams_t& params, unsigned rows) {
+    CPgDatabase *target = nullptr;
+    unsigned cursor = route<unsigned>(is_readonly(statement), [&](CPgDatabase *db) {
+            target = db;
+            return db->openCursor(statement, params, rows);
+        });
+    m_cursors[++m_cursorSerial] = std::make_pair(target, cursor);
+    return m_cursorSerial;
+}
+
+CQueryResult* CPgCluster::fetch(unsigned cursor) {
+    const auto it = m_cursors.find(cursor);
+    if(it == m_cursors.end()) return nullptr;
+    CQueryResult *row = it->second.first->fetch(it->second.second);
+    if(!row) m_cursors.erase(it);
+    return row;
+}
+
+void CPgCluster::finish() {
+    m_cursors.clear();
+    m_stickToPrimary = false;
+    for(auto &it : m_replicas) it.db->finish();
+    m_primary->finish();
+}
+
+void CPgCluster::begin() {
+    m_primary->checkout();
+    m_primary->begin();
+}
+
+void CPgCluster::commit() {
+    m_primary->commit();
+}
+
+void CPgCluster::rollback() {
+    m_primary->rollback();
+}
+
+void CPgCluster::copy(const std::string& table, const std::vector<std::string>& columns,
+                      const std::vector<std::string>& lines)
+{
+    m_primary->checkout();
+    m_primary->copy(table, columns, lines);
+}
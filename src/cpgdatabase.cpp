@@ -10,15 +10,23 @@
 
 #include "config.h"
 #include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <stdexcept>
 #include <boost/lexical_cast.hpp>
 #include "database.hpp"
 #include "apputils.hpp"
+#include "deadline.hpp"
 
 CPgDatabase::CPgDatabase(const std::string& dbname,
                          const std::string& user,
                          const std::string& password,
                          const std::string& host,
-                         const int port) : CDatabase(), m_connection(nullptr)
+                         const int port) : CDatabase(), m_connection(nullptr), m_logColumns(false),
+                                          m_tx(nullptr), m_explicitTx(false), m_cursorSerial(0),
+                                          m_stats(nullptr), m_checkIdle(DB_CHECK_IDLE), m_lastUse(0),
+                                          m_retryAt(0), m_backoff(DB_BACKOFF_MIN), m_connected(false),
+                                          m_statementTimeout(0)
 {
     m_connectString = "user=";            m_connectString.append(user);
     m_connectString.append(" password="); m_connectString.append(password);
@@ -28,55 +36,499 @@ CPgDatabase::CPgDatabase(const std::string& dbname,
 }
 
 CPgDatabase::~CPgDatabase() {
-    m_connection->disconnect();
-    m_connection = nullptr;
+    drop();
+}
+
+static inline void count(unsigned long *counter) {
+    __sync_fetch_and_add(counter, 1);
 }
 
+/**
+ * @fn int CPgDatabase::connect()
+ * @brief connects unless the previous attempt failed recently: the delay
+ *        doubles with every failure up to DB_BACKOFF_MAX, so a database
+ *        which is down is not hammered by all the children
+ * @throw pqxx::broken_connection
+ */
 int CPgDatabase::connect() {
-    if(!m_connection) m_connection = new pqxx::connection(m_connectString.c_str());
+    const long long now = monotonicMs();
+    if(m_connection) return 0;
+    if(now < m_retryAt)
+        throw pqxx::broken_connection("database is unavailable, next attempt in " +
+                                      boost::lexical_cast<std::string>(m_retryAt - now) + " ms");
+    try {
+        m_connection = new pqxx::connection(m_connectString.c_str());
+        if(m_statementTimeout) {
+            // a hung statement does not hold the child longer
+            pqxx::nontransaction w(*m_connection);
+            w.exec("SET statement_timeout = " + boost::lexical_cast<std::string>(m_statementTimeout));
+        }
+    }
+    catch(const std::exception& e) {
+        delete m_connection;
+        m_connection = nullptr;
+        if(m_stats) count(&m_stats->failures);
+        m_retryAt = now + m_backoff;
+        m_backoff = std::min(m_backoff * 2, (long long)DB_BACKOFF_MAX);
+        log_warning("%s: %s", __func__, e.what());
+        throw;
+    }
+    if(m_stats) count(m_connected ? &m_stats->reconnects : &m_stats->connects);
+    log_message("%s: %s", __func__, m_connected ? "reconnected" : "connected");
+    m_connected = true;
+    m_backoff = DB_BACKOFF_MIN;
+    m_retryAt = 0;
+    m_lastUse = now;
     return 0;
 }
 
-int CPgDatabase::disconnect() {
-    m_connection->disconnect();
+// forgets the connection with its transaction, cursors and prepared statements
+void CPgDatabase::drop() {
+    for(const auto &it : m_cursors) m_lostCursors.insert(it.first);
+    dropCursors();
+    delete m_tx;        // aborts
+    m_tx = nullptr;
+    m_explicitTx = false;
+    delete m_connection;
     m_connection = nullptr;
+    m_prepared.clear();
+}
+
+int CPgDatabase::disconnect() {
+    finish();
+    drop();
     return 0;
 }
 
-qresult_t* CPgDatabase::query(const std::string& statement) {
-    pqxx::work w(*m_connection);
+/**
+ * @fn void CPgDatabase::checkout()
+ * @brief called by getDatabase(): connects on the first use, checks the
+ *        connection idle for more than m_checkIdle seconds with a trivial
+ *        statement and reconnects if it is broken
+ */
+void CPgDatabase::checkout() {
+    if(m_connection && !m_connection->is_open()) drop();
+    if(m_connection && m_checkIdle && !m_tx && monotonicMs() - m_lastUse > m_checkIdle * 1000LL) {
+        if(m_stats) count(&m_stats->checks);
+        try {
+            pqxx::nontransaction w(*m_connection);
+            w.exec("SELECT 1");
+        }
+        catch(const pqxx::broken_connection& e) {
+            log_warning("%s: %s", __func__, e.what());
+            drop();
+        }
+    }
+    connect();
+    m_lastUse = monotonicMs();
+}
+
+// SELECT can be sent to a replica
+bool is_readonly(const std::string& statement) {
+    size_t i = 0;
+    while(i < statement.length() && (isspace(statement[i]) || statement[i] == '(')) i++;
+    return strncasecmp(statement.c_str() + i, "select", 6) == 0 &&
+        !strcasestr(statement.c_str(), " for update") && !strcasestr(statement.c_str(), " for share");
+}
+
+/**
+ * @fn bool CPgDatabase::retry(const pqxx::broken_connection& e, bool repeat)
+ * @brief called when a statement fails with the broken connection. It is
+ *        not known if the server has run it, so it is repeated only if the
+ *        state says it has no side effects (retry clause)
+ * @return true if the statement can be repeated: it is allowed, there is
+ *         no transaction and the connection is restored
+ */
+bool CPgDatabase::retry(const pqxx::broken_connection& e, bool repeat) {
+    const bool inTx = m_tx != nullptr;
+    log_warning("%s: %s", __func__, e.what());
+    drop();
+    if(inTx || !repeat) return false;
+    if(m_stats) count(&m_stats->retries);
+    try {
+        connect();
+    }
+    catch(const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+// *********************************************************************
+// *** CPgResult
+// *********************************************************************
+
+int CPgResult::column(const std::string& name) const {
+    for(unsigned i = 0; i < m_result.columns(); i++)
+        if(name == m_result.column_name(i)) return i;
+    return -1;
+}
+
+// the empty value is NULL, as it always was for the query state
+const char* CPgResult::value(size_t col) const {
+    const pqxx::field field = m_result[m_row][col];
+    return field.is_null() || field.size() == 0 ? nullptr : field.c_str();
+}
+
+// *********************************************************************
+// *** CPgDatabase
+// *********************************************************************
+
+// keeps the result, nullptr if there are no rows
+CQueryResult* CPgDatabase::firstRow(const pqxx::result& r) const {
+    if(r.empty() || r.columns() == 0) {
+        log_warning("%s: no data returned", __func__);
+        return nullptr;
+    }
+    CQueryResult *result = new CPgResult(r);
+    if(m_logColumns) {
+        log_message("%s: rows: %u, cols: %zu", __func__, r.size(), result->columns());
+        for(size_t col = 0; col < result->columns(); col++)
+            log_message("%s: column: %zu %s, val: %s", __func__, col, result->name(col),
+                        result->value(col) ? result->value(col) : "NULL");
+    }
+    return result;
+}
+
+// the cursors' transaction takes no writes: a failed statement aborts the
+// cursors, and the writes made before it are rolled back with them
+void CPgDatabase::checkCursorTx(const std::string& statement) const {
+    if(m_tx && !m_explicitTx && !is_readonly(statement))
+        throw std::runtime_error("no writes while a cursor is open, unless in begin ... commit transaction");
+}
+
+CQueryResult* CPgDatabase::query(const std::string& statement, bool repeat) {
     log_message("%s: statement: %s", __func__, statement.c_str());
-    pqxx::result r = w.exec(statement);
-    w.commit();
-    if(r.size()) {
-        const pqxx::tuple row = r[0];
-        const int num_cols = row.size();
-        log_message("%s: rows: %d, cols: %d", __func__, r.size(), num_cols);
-        if(num_cols) {
-            qresult_t *result = new qresult_t(num_cols);
-            for(int colnum = 0; colnum < num_cols; ++colnum) {
-                const pqxx::field field = row[colnum];
-                if(field.size()) {
-                    char *val = strdup(field.c_str());
-                    log_message("%s: column: %d, val: %s", __func__, colnum, val);
-                    (*result)[colnum] = val;
-                }
-                else {
-                    (*result)[colnum] = nullptr;
-                    log_warning("%s: column %d is NULL", __func__, colnum);
-                }
+    checkCursorTx(statement);
+    while(1) {
+        try {
+            // pqxx allows one transaction per connection, an explicit one or the cursors' may be open
+            if(m_tx) return firstRow(m_tx->exec(statement));
+            // autocommit: no BEGIN and COMMIT round trips, a single statement is atomic anyway
+            pqxx::nontransaction w(*m_connection);
+            return firstRow(w.exec(statement));
+        }
+        catch(const pqxx::broken_connection& e) {
+            if(!retry(e, repeat)) throw;
+        }
+    }
+}
+
+static pqxx::result invoke(pqxx::transaction_base& w, const std::string& name, const qparams_t& params) {
+    pqxx::prepare::invocation inv = w.prepared(name);
+    for(const auto &it : params) {
+        if(it) inv(it);
+        else inv();
+    }
+    return inv.exec();
+}
+
+static inline bool is_identChar(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+// the end of the quoted literal or identifier, comment or dollar-quoted
+// body starting at pos, pos if there is none
+static size_t skipQuoted(const std::string& sql, size_t pos) {
+    const size_t len = sql.length();
+    const char c = sql[pos];
+    if(c == '\'' || c == '"') {
+        // E'...' has backslash escapes, the doubled quote is the quote itself
+        const bool escapes = c == '\'' && pos > 0 && toupper(sql[pos - 1]) == 'E' &&
+            (pos == 1 || !is_identChar(sql[pos - 2]));
+        size_t i = pos + 1;
+        while(i < len) {
+            if(escapes && sql[i] == '\\') i += 2;
+            else if(sql[i] != c) i++;
+            else if(i + 1 < len && sql[i + 1] == c) i += 2;
+            else return i + 1;
+        }
+        return len;
+    }
+    if(c == '-' && pos + 1 < len && sql[pos + 1] == '-') {
+        const size_t eol = sql.find('\n', pos);
+        return eol == std::string::npos ? len : eol;
+    }
+    if(c == '/' && pos + 1 < len && sql[pos + 1] == '*') {
+        const size_t end = sql.find("*/", pos + 2);
+        return end == std::string::npos ? len : end + 2;
+    }
+    if(c == '$' && (pos == 0 || !is_identChar(sql[pos - 1]))) {
+        // $tag$ ... $tag$, the tag does not start with a digit: $1 is a placeholder
+        size_t i = pos + 1;
+        if(i < len && isdigit(sql[i])) return pos;
+        while(i < len && is_identChar(sql[i])) i++;
+        if(i >= len || sql[i] != '$') return pos;
+        const std::string tag = sql.substr(pos, i - pos + 1);
+        const size_t end = sql.find(tag, i + 1);
+        return end == std::string::npos ? len : end + tag.length();
+    }
+    return pos;
+}
+
+// $n placeholders are replaced by the quoted and escaped values, the ones
+// in the literals, quoted identifiers and comments are not placeholders
+static std::string bindLiterals(pqxx::connection_base& conn, const std::string& statement, const qparams_t& params) {
+    std::string sql("");
+    for(size_t i = 0; i < statement.length(); i++) {
+        const size_t end = skipQuoted(statement, i);
+        if(end > i) {
+            sql.append(statement, i, end - i);
+            i = end - 1;
+        }
+        else if(statement[i] == '$' && i + 1 < statement.length() && isdigit(statement[i + 1])) {
+            size_t n = 0;
+            while(i + 1 < statement.length() && isdigit(statement[i + 1])) n = n * 10 + (statement[++i] - '0');
+            if(n == 0 || n > params.size()) throw std::runtime_error("no value for placeholder $" + boost::lexical_cast<std::string>(n));
+            if(params[n - 1]) sql.append("'" + conn.esc(params[n - 1]) + "'");
+            else sql.append("NULL");
+        }
+        else sql.push_back(statement[i]);
+    }
+    return sql;
+}
+
+/**
+ * @fn CQueryResult* CPgDatabase::execPrepared(const std::string& name, const std::string& statement, const qparams_t& params, bool repeat)
+ * @brief executes the statement with $n placeholders, the statement is
+ *        prepared (parsed and planned by the server) once per connection
+ * @param name -- statement name, the same for the same statement text
+ * @param params -- values of $1, $2, ...
+ * @param repeat -- sent again if the connection breaks, see retry()
+ */
+CQueryResult* CPgDatabase::execPrepared(const std::string& name, const std::string& statement,
+                                        const qparams_t& params, bool repeat)
+{
+    log_message("%s: statement: %s, %zu parameters", __func__, name.c_str(), params.size());
+    checkCursorTx(statement);
+    while(1) {
+        try {
+            if(m_prepared.find(name) == m_prepared.end()) {
+                log_message("%s: prepare %s: %s", __func__, name.c_str(), statement.c_str());
+                m_connection->prepare(name, statement);
+                m_prepared.insert(name);
             }
-            return result;
+            if(m_tx) return firstRow(invoke(*m_tx, name, params));
+            pqxx::nontransaction w(*m_connection);
+            return firstRow(invoke(w, name, params));
+        }
+        catch(const pqxx::broken_connection& e) {
+            if(!retry(e, repeat)) throw;
         }
     }
-    else {
-        log_warning("%s: no data returned", __func__);
+}
+
+/**
+ * @fn std::vector<CQueryResult*> CPgDatabase::batch(const std::vector<std::string>& statements, const std::vector<qparams_t>& params, bool repeat)
+ * @brief sends all the statements at once through pqxx::pipeline and
+ *        collects the results, one round trip instead of one per statement.
+ *        The pipeline takes no prepared statements, the values are quoted
+ * @return the first rows, nullptr for a statement returned no rows
+ */
+std::vector<CQueryResult*> CPgDatabase::batch(const std::vector<std::string>& statements,
+                                              const std::vector<qparams_t>& params, bool repeat)
+{
+    for(const auto &it : statements) checkCursorTx(it);
+    while(1) {
+        std::vector<CQueryResult*> results;
+        pqxx::nontransaction *own = m_tx ? nullptr : new pqxx::nontransaction(*m_connection);
+        pqxx::transaction_base &tx = m_tx ? static_cast<pqxx::transaction_base&>(*m_tx) :
+            static_cast<pqxx::transaction_base&>(*own);
+        try {
+            pqxx::pipeline pipe(tx);
+            std::vector<pqxx::pipeline::query_id> ids;
+            for(size_t i = 0; i < statements.size(); i++) {
+                // the interpolated statement has no placeholders, a '$1' in it is the value
+                const std::string sql = params[i].empty() ? statements[i] :
+                    bindLiterals(*m_connection, statements[i], params[i]);
+                log_message("%s: statement %zu: %s", __func__, i, sql.c_str());
+                ids.push_back(pipe.insert(sql));
+            }
+            pipe.complete();
+            for(const auto &it : ids) results.push_back(firstRow(pipe.retrieve(it)));
+        }
+        catch(const pqxx::broken_connection& e) {
+            for(auto &it : results) delete it;
+            delete own;
+            if(!retry(e, repeat)) throw;
+            continue;
+        }
+        catch(...) {
+            for(auto &it : results) delete it;
+            delete own;
+            throw;
+        }
+        delete own;
+        return results;
     }
-    
-    return 0;
 }
 
+// *** explicit transaction: the script groups the query states with begin
+// *** and commit (or rollback) transaction states
+
+void CPgDatabase::begin() {
+    if(m_explicitTx) throw std::runtime_error("begin: transaction is in progress already");
+    if(!m_tx) m_tx = new pqxx::work(*m_connection); // or the cursors' one
+    m_explicitTx = true;
+    log_message("%s: transaction started", __func__);
+}
+
+void CPgDatabase::commit() {
+    if(!m_explicitTx) throw std::runtime_error("commit: no transaction in progress");
+    dropCursors();
+    m_explicitTx = false;
+    pqxx::work *tx = m_tx;
+    m_tx = nullptr;
+    try {
+        tx->commit();
+    }
+    catch(...) {
+        delete tx;
+        throw;
+    }
+    delete tx;
+    log_message("%s: transaction committed", __func__);
+}
+
+void CPgDatabase::rollback() {
+    if(!m_explicitTx) throw std::runtime_error("rollback: no transaction in progress");
+    dropCursors();
+    m_explicitTx = false;
+    pqxx::work *tx = m_tx;
+    m_tx = nullptr;
+    try {
+        tx->abort();
+    }
+    catch(const std::exception& e) {
+        log_warning("%s: %s", __func__, e.what());
+    }
+    delete tx;
+    log_message("%s: transaction rolled back", __func__);
+}
+
+/**
+ * @fn void CPgDatabase::copy(const std::string& table, const std::vector<std::string>& columns, const std::vector<std::string>& lines)
+ * @brief COPY ... FROM STDIN of the buffered rows in one transaction, one
+ *        commit for all of them. Not repeated on the broken connection, the
+ *        caller keeps the rows
+ * @param columns -- empty for all the columns of the table
+ * @param lines -- COPY text format, no trailing newline
+ */
+void CPgDatabase::copy(const std::string& table, const std::vector<std::string>& columns,
+                       const std::vector<std::string>& lines)
+{
+    if(m_tx) throw std::runtime_error("copy: transaction is in progress");
+    try {
+        pqxx::work tx(*m_connection);
+        pqxx::tablewriter writer(tx, table, columns.begin(), columns.end());
+        for(const auto &it : lines) writer.write_raw_line(it);
+        writer.complete();
+        tx.commit();
+    }
+    catch(const pqxx::broken_connection& e) {
+        retry(e, false);
+        throw;
+    }
+    log_message("%s: %s: %zu rows", __func__, table.c_str(), lines.size());
+}
 
+/**
+ * @fn unsigned CPgDatabase::openCursor(const std::string& statement, const qparams_t& params, unsigned rows)
+ * @brief declares the cursor for the statement with $n placeholders, the
+ *        values are quoted and escaped (a cursor can not be declared for a
+ *        prepared statement). The transaction stays open until the last
+ *        cursor is read to the end or the request is over
+ * @param rows -- rows fetched from the server at once
+ * @return cursor number for fetch()
+ */
+unsigned CPgDatabase::openCursor(const std::string& statement, const qparams_t& params, unsigned rows) {
+    const std::string sql = params.empty() ? statement : bindLiterals(*m_connection, statement, params);
+    log_message("%s: statement: %s, %u rows per fetch", __func__, sql.c_str(), rows);
+    if(!m_tx) m_tx = new pqxx::work(*m_connection);
+    const unsigned cursor = ++m_cursorSerial;
+    pqxx::icursorstream *stream;
+    try {
+        stream = new pqxx::icursorstream(*m_tx, sql, "cur" + boost::lexical_cast<std::string>(cursor), rows);
+    }
+    catch(...) {
+        // the cursors' transaction is not left open without them
+        if(m_cursors.empty() && !m_explicitTx) {
+            delete m_tx; // aborts
+            m_tx = nullptr;
+        }
+        throw;
+    }
+    cursor_t &c = m_cursors[cursor];
+    c.stream = stream;
+    c.row = 0;
+    return cursor;
+}
 
+/**
+ * @fn CQueryResult* CPgDatabase::fetch(unsigned cursor)
+ * @brief the next row of the cursor
+ * @return nullptr when the rows are over or the cursor is closed
+ * @throw pqxx::broken_connection if the cursor is lost with the connection
+ */
+CQueryResult* CPgDatabase::fetch(unsigned cursor) {
+    if(m_lostCursors.erase(cursor))
+        throw pqxx::broken_connection("cursor " + boost::lexical_cast<std::string>(cursor) +
+                                      " is lost with the connection");
+    const auto it = m_cursors.find(cursor);
+    if(it == m_cursors.end()) return nullptr;
+    cursor_t &c = it->second;
+    if(c.row >= c.block.size()) {
+        c.block.clear();
+        c.row = 0;
+        if(!c.stream->get(c.block) || c.block.empty()) {
+            closeCursor(cursor);
+            return nullptr;
+        }
+    }
+    return new CPgResult(c.block, c.row++);
+}
 
+void CPgDatabase::closeCursor(unsigned cursor) {
+    const auto it = m_cursors.find(cursor);
+    if(it == m_cursors.end()) return;
+    delete it->second.stream;
+    m_cursors.erase(it);
+    if(m_cursors.empty() && m_tx && !m_explicitTx) {
+        m_tx->commit();
+        delete m_tx;
+        m_tx = nullptr;
+    }
+}
+
+// closes the cursors, the transaction stays
+void CPgDatabase::dropCursors() {
+    for(auto &it : m_cursors) {
+        try {
+            delete it.second.stream;
+        }
+        catch(const std::exception& e) {
+            log_warning("%s: %s", __func__, e.what());
+        }
+    }
+    m_cursors.clear();
+}
 
+// request is over: an unfinished explicit transaction is rolled back
+void CPgDatabase::finish() {
+    m_lostCursors.clear();
+    if(m_explicitTx) {
+        log_warning("%s: transaction is not finished by the script", __func__);
+        rollback();
+        return;
+    }
+    try {
+        while(!m_cursors.empty()) closeCursor(m_cursors.begin()->first);
+    }
+    catch(const std::exception& e) {
+        log_warning("%s: %s", __func__, e.what());
+        dropCursors();
+    }
+    // the cursors' transaction is over with the last of them, if not - aborted
+    delete m_tx;
+    m_tx = nullptr;
+}
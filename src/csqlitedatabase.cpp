@@ -0,0 +1,261 @@
+/**
+ * @file   csqlitedatabase.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Fri Oct 23 11:05:12 2026
+ *
+ * @brief  CSqliteDatabase class definition: local read-mostly lookup data
+ *
+ */
+
+#include "config.h"
+#ifdef HAVE_SQLITE3
+#include <cstring>
+#include <stdexcept>
+#include <boost/lexical_cast.hpp>
+#include "database.hpp"
+#include "apputils.hpp"
+
+// *********************************************************************
+// *** CSqliteResult
+// *********************************************************************
+
+CSqliteResult::CSqliteResult(sqlite3_stmt *stmt): CQueryResult(), m_data(""), m_columns(0) {
+    m_columns = sqlite3_column_count(stmt);
+    for(size_t col = 0; col < m_columns; col++) {
+        const char *name = sqlite3_column_name(stmt, col);
+        m_offsets.push_back(m_data.size());
+        m_lengths.push_back(strlen(name));
+        m_data.append(name);
+        m_data.push_back('\0');
+    }
+    for(size_t col = 0; col < m_columns; col++) {
+        const unsigned char *value = sqlite3_column_text(stmt, col);
+        size_t len = sqlite3_column_bytes(stmt, col);
+        if(!value) {
+            m_offsets.push_back(std::string::npos);
+            m_lengths.push_back(0);
+            continue;
+        }
+        m_offsets.push_back(m_data.size());
+        m_lengths.push_back(len);
+        m_data.append((const char*)value, len);
+        m_data.push_back('\0');
+    }
+}
+
+int CSqliteResult::column(const std::string& name) const {
+    for(size_t i = 0; i < m_columns; i++) if(name == m_data.data() + m_offsets[i]) return i;
+    return -1;
+}
+
+// the empty value is NULL, the same as for Postgres
+const char* CSqliteResult::value(size_t col) const {
+    size_t offset = m_offsets[m_columns + col];
+    if(offset == std::string::npos || m_lengths[m_columns + col] == 0) return nullptr;
+    return m_data.data() + offset;
+}
+
+// *********************************************************************
+// *** CSqliteDatabase
+// *********************************************************************
+
+CSqliteDatabase::CSqliteDatabase(const std::string& path, size_t mmapSize):
+    CDatabase(), m_path(path), m_db(nullptr), m_mmapSize(mmapSize), m_cursorSerial(0), m_inTx(false) {}
+
+CSqliteDatabase::~CSqliteDatabase() {
+    disconnect();
+}
+
+void CSqliteDatabase::fail(const char *what) const {
+    throw std::runtime_error(std::string(what) + ": " + (m_db ? sqlite3_errmsg(m_db) : "not open"));
+}
+
+void CSqliteDatabase::exec(const char *sql) {
+    if(sqlite3_exec(m_db, sql, nullptr, nullptr, nullptr) != SQLITE_OK) fail(sql);
+}
+
+int CSqliteDatabase::connect() {
+    if(m_db) return 0;
+    int rc = sqlite3_open_v2(m_path.c_str(), &m_db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr);
+    if(rc != SQLITE_OK) {
+        std::string err = m_db ? sqlite3_errmsg(m_db) : sqlite3_errstr(rc);
+        sqlite3_close(m_db);
+        m_db = nullptr;
+        throw std::runtime_error(m_path + ": " + err);
+    }
+    exec(("PRAGMA mmap_size = " + boost::lexical_cast<std::string>(m_mmapSize)).c_str());
+    exec("PRAGMA query_only = 1");
+    log_message("%s: %s: opened", __func__, m_path.c_str());
+    return 0;
+}
+
+int CSqliteDatabase::disconnect() {
+    finish();
+    for(auto &it : m_prepared) sqlite3_finalize(it.second);
+    m_prepared.clear();
+    if(m_db) sqlite3_close(m_db);
+    m_db = nullptr;
+    return 0;
+}
+
+void CSqliteDatabase::checkout() {
+    connect();
+}
+
+// $n placeholders are SQLite named parameters, the casts are Postgres only
+static std::string sqliteStatement(const std::string& statement) {
+    std::string sql(statement);
+    std::string::size_type pos = 0;
+    while((pos = sql.find("::text", pos)) != std::string::npos) {
+        std::string::size_type d = pos;
+        while(d > 0 && isdigit(sql[d - 1])) d--;
+        if(d > 0 && d < pos && sql[d - 1] == '$') sql.erase(pos, 6);
+        else pos += 6;
+    }
+    return sql;
+}
+
+sqlite3_stmt* CSqliteDatabase::prepare(const std::string& statement) {
+    sqlite3_stmt *stmt = nullptr;
+    const std::string sql = sqliteStatement(statement);
+    if(sqlite3_prepare_v2(m_db, sql.c_str(), sql.size(), &stmt, nullptr) != SQLITE_OK) fail(sql.c_str());
+    return stmt;
+}
+
+void CSqliteDatabase::bind(sqlite3_stmt *stmt, const qparams_t& params) {
+    for(size_t i = 0; i < params.size(); i++) {
+        const std::string name = "$" + boost::lexical_cast<std::string>(i + 1);
+        int idx = sqlite3_bind_parameter_index(stmt, name.c_str());
+        if(idx == 0) continue;
+        int rc = params[i] ? sqlite3_bind_text(stmt, idx, params[i], -1, SQLITE_TRANSIENT) : sqlite3_bind_null(stmt, idx);
+        if(rc != SQLITE_OK) fail("bind");
+    }
+}
+
+// the first row, nullptr if there are no rows
+CQueryResult* CSqliteDatabase::run(sqlite3_stmt *stmt) {
+    int rc = sqlite3_step(stmt);
+    if(rc == SQLITE_ROW) return new CSqliteResult(stmt);
+    if(rc != SQLITE_DONE) fail("step");
+    log_warning("%s: no data returned", __func__);
+    return nullptr;
+}
+
+CQueryResult* CSqliteDatabase::query(const std::string& statement, bool repeat) {
+    log_message("%s: statement: %s", __func__, statement.c_str());
+    sqlite3_stmt *stmt = prepare(statement);
+    try {
+        CQueryResult *result = run(stmt);
+        sqlite3_finalize(stmt);
+        return result;
+    }
+    catch(...) {
+        sqlite3_finalize(stmt);
+        throw;
+    }
+}
+
+CQueryResult* CSqliteDatabase::execPrepared(const std::string& name, const std::string& statement,
+                                            const qparams_t& params, bool repeat)
+{
+    sqlite3_stmt *stmt;
+    const auto it = m_prepared.find(name);
+    if(it == m_prepared.end()) {
+        log_message("%s: prepare %s: %s", __func__, name.c_str(), statement.c_str());
+        stmt = m_prepared[name] = prepare(statement);
+    }
+    else stmt = it->second;
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    bind(stmt, params);
+    CQueryResult *result = run(stmt);
+    sqlite3_reset(stmt);
+    return result;
+}
+
+// no network, no round trips to save: one by one
+std::vector<CQueryResult*> CSqliteDatabase::batch(const std::vector<std::string>& statements,
+                                                  const std::vector<qparams_t>& params, bool repeat)
+{
+    std::vector<CQueryResult*> results;
+    try {
+        for(size_t i = 0; i < statements.size(); i++) {
+            sqlite3_stmt *stmt = prepare(statements[i]);
+            try {
+                bind(stmt, params[i]);
+                results.push_back(run(stmt));
+            }
+            catch(...) {
+                sqlite3_finalize(stmt);
+                throw;
+            }
+            sqlite3_finalize(stmt);
+        }
+    }
+    catch(...) {
+        for(auto &it : results) delete it;
+        throw;
+    }
+    return results;
+}
+
+// SQLite steps through the rows itself, nothing is materialized
+unsigned CSqliteDatabase::openCursor(const std::string& statement, const qparams_t& params, unsigned rows) {
+    sqlite3_stmt *stmt = prepare(statement);
+    try {
+        bind(stmt, params);
+    }
+    catch(...) {
+        sqlite3_finalize(stmt);
+        throw;
+    }
+    m_cursors[++m_cursorSerial] = stmt;
+    return m_cursorSerial;
+}
+
+CQueryResult* CSqliteDatabase::fetch(unsigned cursor) {
+    const auto it = m_cursors.find(cursor);
+    if(it == m_cursors.end()) return nullptr;
+    int rc = sqlite3_step(it->second);
+    if(rc == SQLITE_ROW) return new CSqliteResult(it->second);
+    sqlite3_finalize(it->second);
+    m_cursors.erase(it);
+    if(rc != SQLITE_DONE) fail("fetch");
+    return nullptr;
+}
+
+void CSqliteDatabase::finish() {
+    for(auto &it : m_cursors) sqlite3_finalize(it.second);
+    m_cursors.clear();
+    if(m_inTx) {
+        log_warning("%s: transaction is not finished by the script", __func__);
+        rollback();
+    }
+}
+
+// read-only: a transaction gives the consistent snapshot for several reads
+void CSqliteDatabase::begin() {
+    if(m_inTx) throw std::runtime_error("begin: transaction is in progress already");
+    exec("BEGIN");
+    m_inTx = true;
+}
+
+void CSqliteDatabase::commit() {
+    if(!m_inTx) throw std::runtime_error("commit: no transaction in progress");
+    m_inTx = false;
+    exec("COMMIT");
+}
+
+void CSqliteDatabase::rollback() {
+    if(!m_inTx) throw std::runtime_error("rollback: no transaction in progress");
+    m_inTx = false;
+    exec("ROLLBACK");
+}
+
+void CSqliteDatabase::copy(const std::string& table, const std::vector<std::string>& columns,
+                           const std::vector<std::string>& lines)
+{
+    throw std::runtime_error(m_path + ": read-only database");
+}
+
+#endif // #ifdef HAVE_SQLITE3
@@ -0,0 +1,144 @@
+/**
+ * @file   curlpool.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Sat Oct 24 14:18:40 2026
+ *
+ * @brief  CCurlPool class definition
+ *
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <sstream>
+#include "apputils.hpp"
+#include "curlpool.hpp"
+
+CCurlPool curlPool;
+
+// scheme://host:port, the handles of the same upstream are interchangeable
+std::string curlUpstream(const std::string& url) {
+    std::string::size_type pos = url.find("://");
+    pos = pos == std::string::npos ? 0 : pos + 3;
+    return url.substr(0, url.find_first_of("/?#", pos));
+}
+
+CCurlPool::CCurlPool(): m_share(nullptr), m_multi(nullptr), m_created(0), m_reused(0) {}
+
+// called by the child after curl_global_init
+void CCurlPool::init() {
+    m_share = curl_share_init();
+    if(!m_share) {
+        log_warning("%s: curl_share_init failed, nothing is shared", __func__);
+        return;
+    }
+    // the child is single threaded, no lock functions
+    curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+    curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+// child exit: the connections are closed properly
+void CCurlPool::cleanup() {
+    for(auto &it : m_idle)
+        for(auto &h : it.second) curl_easy_cleanup(h);
+    m_idle.clear();
+    if(m_multi) curl_multi_cleanup(m_multi);
+    m_multi = nullptr;
+    if(m_share) curl_share_cleanup(m_share);
+    m_share = nullptr;
+    log_debug("%s: %lu handles created, %lu reused", __func__, m_created, m_reused);
+}
+
+/**
+ * @fn CURL* CCurlPool::acquire(const std::string& url)
+ * @brief idle handle of the upstream or the new one, with no options but
+ *        the share. The connections, DNS and TLS sessions survive the reset
+ * @return nullptr if the handle can not be created
+ */
+CURL* CCurlPool::acquire(const std::string& url) {
+    CURL *handle;
+    auto it = m_idle.find(curlUpstream(url));
+    if(it != m_idle.end() && it->second.size()) {
+        handle = it->second.back();
+        it->second.pop_back();
+        curl_easy_reset(handle);
+        m_reused++;
+    }
+    else {
+        handle = curl_easy_init();
+        if(!handle) return nullptr;
+        m_created++;
+    }
+    if(m_share) curl_easy_setopt(handle, CURLOPT_SHARE, m_share);
+    curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+    return handle;
+}
+
+// the handle is kept for the next call to the upstream
+void CCurlPool::release(const std::string& url, CURL *handle) {
+    std::vector<CURL*>& idle = m_idle[curlUpstream(url)];
+    if(idle.size() >= CURLPOOL_IDLE) curl_easy_cleanup(handle);
+    else idle.push_back(handle);
+}
+
+// file contents, nullptr if it can not be read
+const CCurlPool::blob_t* CCurlPool::readBlob(const std::string& path) {
+    struct stat st;
+    const time_t now = time(nullptr);
+    auto it = m_blobs.find(path);
+    if(it != m_blobs.end() && it->second.checked == now) return &it->second;
+    if(stat(path.c_str(), &st) < 0) return nullptr;
+    if(it != m_blobs.end() && it->second.mtime == st.st_mtime) {
+        it->second.checked = now;
+        return &it->second;
+    }
+    std::ifstream ifs(path.c_str(), std::ios::binary);
+    if(!ifs.is_open()) return nullptr;
+    std::ostringstream oss;
+    oss << ifs.rdbuf();
+    blob_t& blob = m_blobs[path];
+    blob.data = oss.str();
+    blob.mtime = st.st_mtime;
+    blob.checked = now;
+    log_debug("%s: %s: %zu bytes", __func__, path.c_str(), blob.data.size());
+    return &blob;
+}
+
+/**
+ * @fn CURLcode CCurlPool::setFile(CURL *handle, CURLoption option, const std::string& path)
+ * @brief sets CURLOPT_SSLCERT, CURLOPT_SSLKEY or CURLOPT_CAINFO: from memory
+ *        if libcurl and its TLS backend support the blob, by path otherwise
+ */
+CURLcode CCurlPool::setFile(CURL *handle, CURLoption option, const std::string& path) {
+#if LIBCURL_VERSION_NUM >= 0x074700
+    CURLoption blobopt = CURLOPT_LASTENTRY;
+    if(option == CURLOPT_SSLCERT) blobopt = CURLOPT_SSLCERT_BLOB;
+    else if(option == CURLOPT_SSLKEY) blobopt = CURLOPT_SSLKEY_BLOB;
+#if LIBCURL_VERSION_NUM >= 0x074d00
+    else if(option == CURLOPT_CAINFO) blobopt = CURLOPT_CAINFO_BLOB;
+#endif
+    const blob_t *data = blobopt != CURLOPT_LASTENTRY ? readBlob(path) : nullptr;
+    if(data) {
+        struct curl_blob blob;
+        blob.data = (void*)data->data.data();
+        blob.len = data->data.size();
+        blob.flags = CURL_BLOB_COPY;
+        if(curl_easy_setopt(handle, blobopt, &blob) == CURLE_OK) return CURLE_OK;
+    }
+#endif
+    return curl_easy_setopt(handle, option, path.c_str());
+}
+
+// the handles are added and removed by the caller, none is left between states
+CURLM* CCurlPool::multi() {
+    if(m_multi) return m_multi;
+    if(!(m_multi = curl_multi_init())) log_warning("%s: libCURL: error creating multi handle", __func__);
+    // HTTP/2 transfers to the same upstream share the connection
+    else curl_multi_setopt(m_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    return m_multi;
+}
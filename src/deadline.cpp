@@ -0,0 +1,35 @@
+/**
+ * @file   deadline.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Sun Oct 25 15:20:34 2026
+ *
+ * @brief  Request deadline budget
+ *
+ */
+
+#include "config.h"
+#include <ctime>
+#include "deadline.hpp"
+
+static long long deadline = 0;               // ms, monotonic; 0 - no budget
+
+long long monotonicMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+void deadlineStart(unsigned ms) {
+    deadline = ms ? monotonicMs() + ms : 0;
+}
+
+// the request is over: the cleanup is not limited
+void deadlineStop() {
+    deadline = 0;
+}
+
+long long deadlineLeft() {
+    if(!deadline) return DEADLINE_NONE;
+    const long long left = deadline - monotonicMs();
+    return left > 0 ? left : 0;
+}
@@ -9,6 +9,7 @@
 
 #include "config.h"
 #include <iostream>
+#include <cstring>
 #include "apputils.hpp"
 #include "cstate.hpp"
 #include "parser.hpp"
@@ -22,7 +23,8 @@ extern const char *syntax_error;
 // *********************************************************************
 
 CEndState::CEndState(const int stateno, const std::string& scriptName):
-    CState(stateno, scriptName, "end") { };
+    CState(stateno, scriptName, "end"), m_status(""), m_statusInterpret(false),
+    m_contentType(""), m_ctypeInterpret(false), m_etag(""), m_lastModified("") { };
 
 CEndState::~CEndState() {};
 
@@ -39,7 +41,44 @@ int CEndState::parse(const std::string& line, const std::string& file, unsigned
         m_outList.push_back(line.substr(regmatch[1].rm_so, len));
         m_interpretFlag.push_back(true);
     }
-
+    else if(is_matched("status", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_status = line.substr(regmatch[1].rm_so, len);
+        m_statusInterpret = false;
+    }
+    else if(is_matched("status_double", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_status = line.substr(regmatch[1].rm_so, len);
+        m_statusInterpret = true;
+    }
+    else if(is_matched("ctype_single", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_contentType = line.substr(regmatch[1].rm_so, len);
+        m_ctypeInterpret = false;
+    }
+    else if(is_matched("ctype_double", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_contentType = line.substr(regmatch[1].rm_so, len);
+        m_ctypeInterpret = true;
+    }
+    else if(is_matched("addheader", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_headers.push_back(line.substr(regmatch[1].rm_so, len));
+        m_hdrInterpretFlag.push_back(false);
+    }
+    else if(is_matched("addheader_double", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_headers.push_back(line.substr(regmatch[1].rm_so, len));
+        m_hdrInterpretFlag.push_back(true);
+    }
+    else if(is_matched("etag", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_etag = line.substr(regmatch[1].rm_so, len);
+    }
+    else if(is_matched("lastmodified", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_lastModified = line.substr(regmatch[1].rm_so, len);
+    }
     else throw parser_error(file, syntax_error, counter);
     return 0;
 }
@@ -50,9 +89,79 @@ bool CEndState::verify() {
         m_outList.size() == m_interpretFlag.size();
 }
 
+// an interpolated value must not start another header line
+static inline bool is_headerValue(const std::string& value) {
+    return value.find_first_of("\r\n") == std::string::npos;
+}
+
+/**
+ * @fn bool CEndState::setReply(const FCGX_Request *request, CAssigner* assigner)
+ * @brief sets status, content type and headers of the reply, checks the
+ *        conditional request headers against etag and lastmodified
+ * @return true if the client has the current version, 304 is to be sent
+ */
+bool CEndState::setReply(const FCGX_Request *request, CAssigner* assigner) {
+    std::string value("");
+    std::string etag("");
+    time_t lastmod = 0;
+    char buf[64];
+
+    if(m_status.length()) {
+        if(m_statusInterpret) assigner->evaluate(m_status, value, this);
+        else value = m_status;
+        int code = atoi(value.c_str());
+        if(code >= 100 && code < 600) httpReply.set_status(code);
+        else log_warning("%s:%s:%d: invalid status \"%s\"", get_scriptName().c_str(),
+                         get_stateName().c_str(), get_number(), value.c_str());
+    }
+    if(m_contentType.length()) {
+        if(m_ctypeInterpret) {
+            assigner->evaluate(m_contentType, value, this);
+            if(is_headerValue(value)) httpReply.set_contentType(value);
+            else log_warning("%s:%s:%d: line break in content type, ignored", get_scriptName().c_str(),
+                             get_stateName().c_str(), get_number());
+        }
+        else httpReply.set_contentType(m_contentType);
+    }
+    for(size_t i = 0; i < m_headers.size(); ++i) {
+        if(m_hdrInterpretFlag[i]) {
+            assigner->evaluate(m_headers[i], value, this);
+            if(is_headerValue(value)) httpReply.addHeader(value);
+            else log_warning("%s:%s:%d: line break in header, ignored", get_scriptName().c_str(),
+                             get_stateName().c_str(), get_number());
+        }
+        else httpReply.addHeader(m_headers[i]);
+    }
+    if(m_etag.length()) {
+        // FNV-1a 64 of the declared variables values
+        unsigned long long h = 14695981039346656037ULL;
+        assigner->evaluate(m_etag, value, this);
+        for(size_t i = 0; i < value.length(); ++i) {
+            h ^= (unsigned char)value[i];
+            h *= 1099511628211ULL;
+        }
+        snprintf(buf, sizeof(buf), "\"%016llx\"", h);
+        etag = buf;
+        httpReply.addHeader(std::string("ETag: ") + etag);
+    }
+    if(m_lastModified.length()) {
+        assigner->evaluate(m_lastModified, value, this);
+        lastmod = HTTPparseDate(value.c_str());
+        if(lastmod > 0) httpReply.addHeader(std::string("Last-Modified: ") + HTTPdate(lastmod, buf, sizeof(buf)));
+    }
+
+    return httpReply.get_status() == 200 && HTTPnotModified(request->envp, etag, lastmod);
+}
+
 int CEndState::execute(const FCGX_Request *request, CAssigner* assigner) {
     size_t len = m_outList.size();
 
+    // after a flush state the reply header is gone already
+    if(!httpReply.is_sent() && setReply(request, assigner)) {
+        httpReply.sendStatus(request->out, 304);
+        return ENDSTATE;
+    }
+    httpReply.send(request->out);
     if(len > 0) {
         std::string outstr("");
         for(size_t i = 0; i < len; ++i) {
@@ -0,0 +1,165 @@
+/**
+ * @file   fanoutstate.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Sun Oct 25 11:07:23 2026
+ *
+ * @brief  CFanoutState class implementation: independent HTTP requests run
+ *         together through the curl multi interface, the state takes as
+ *         long as the slowest one it waits for
+ *
+ */
+
+#include "config.h"
+#include <set>
+#include <boost/lexical_cast.hpp>
+#include <curl/curl.h>
+#include "apputils.hpp"
+#include "cstate.hpp"
+#include "parser.hpp"
+#include "cassigner.hpp"
+#include "curlpool.hpp"
+
+namespace pt = boost::property_tree;
+extern pt::ptree *cpt;                       // property tree: global configuration
+extern const char *syntax_error;
+
+#define FANOUT_POLL 1000                     // ms, curl_multi_wait
+
+// *********************************************************************
+// *** CFanoutState
+// *********************************************************************
+
+CFanoutState::CFanoutState(const int stateno, const std::string& scriptName):
+    CState(stateno, scriptName, "fanout"), m_wait(0) { };
+
+CFanoutState::~CFanoutState() {
+    for(auto &it : m_requests) delete it;
+};
+
+int CFanoutState::parse(const std::string& line, const std::string& file, unsigned counter) {
+    regmatch_t regmatch[REGMATCH_COUNT];
+    regoff_t len;
+    if(is_matched("request", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_names.push_back(line.substr(regmatch[1].rm_so, len));
+        m_requests.push_back(new CHttpState(get_number(), get_scriptName()));
+        m_failStates.push_back(0);
+    }
+    else if(is_matched("wait", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        const std::string wait = line.substr(regmatch[1].rm_so, len);
+        if(wait == "all") m_wait = 0;
+        else if(wait == "any") m_wait = 1;
+        else m_wait = boost::lexical_cast<unsigned>(wait);
+    }
+    else if(m_requests.empty()) throw parser_error(file, syntax_error, counter);
+    else if(is_matched("failed", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_failStates.back() = boost::lexical_cast<int>(line.substr(regmatch[1].rm_so, len));
+    }
+    else m_requests.back()->parse(line, file, counter);
+    return 0;
+}
+
+bool CFanoutState::verify() {
+    std::set<std::string> streamFiles;
+    for(size_t i = 0; i < m_requests.size(); i++) {
+        // the bodies streamed to the client would be mixed, the requests
+        // already run concurrently and are not hedged
+        if(!m_requests[i]->verifyRequest() || m_requests[i]->get_stream() == CHttpState::STREAM_CLIENT ||
+           m_requests[i]->get_hedgePercentile()) {
+            log_warning("%s:%d: request '%s' is not complete", get_scriptName().c_str(), get_number(),
+                        m_names[i].c_str());
+            return false;
+        }
+        // the spool <file>.<pid> would be shared
+        if(m_requests[i]->get_stream() == CHttpState::STREAM_FILE &&
+           !streamFiles.insert(m_requests[i]->get_dumpfile()).second) {
+            log_warning("%s:%d: request '%s' streams to the file of another request", get_scriptName().c_str(),
+                        get_number(), m_names[i].c_str());
+            return false;
+        }
+    }
+    return
+        m_requests.size() > 0 && m_wait <= m_requests.size() &&
+        get_errorState() > 0 && get_nextState() > 0 && get_errorState() != get_nextState();
+}
+
+/**
+ * @fn int CFanoutState::execute(const FCGX_Request *request, CAssigner* assigner)
+ * @brief starts all the requests and waits until enough of them succeed or
+ *        it is not possible any more; the rest are cancelled. The request
+ *        succeeds if the transfer is complete and HTTP status is below 400
+ * @return done state, the failed state of the first failed request having
+ *         one or error state
+ */
+int CFanoutState::execute(const FCGX_Request *request, CAssigner* assigner) {
+    enum { PENDING, SUCCEEDED, FAILED };
+    const size_t n = m_requests.size();
+    const size_t need = m_wait ? m_wait : n;
+    std::vector<httpCall_t*> calls(n, nullptr);
+    std::vector<int> status(n, PENDING);
+    std::map<CURL*, size_t> running;
+    size_t succeeded = 0, failed = 0;
+    CURLM *multiHandle = curlPool.multi();
+
+    if(!multiHandle) return get_errorState();
+
+    for(size_t i = 0; i < n; i++) {
+        calls[i] = new httpCall_t;
+        switch(m_requests[i]->startCall(assigner, *calls[i])) {
+        case CHttpState::CALL_CACHED:
+            m_requests[i]->setOutput(assigner, calls[i]->output);
+            status[i] = SUCCEEDED;
+            break;
+        case CHttpState::CALL_FAILED:
+            status[i] = FAILED;
+            break;
+        default:
+            if(curl_multi_add_handle(multiHandle, calls[i]->handle) == CURLM_OK) running[calls[i]->handle] = i;
+            else status[i] = FAILED;
+        }
+        if(status[i] == SUCCEEDED) succeeded++;
+        else if(status[i] == FAILED) failed++;
+    }
+
+    while(running.size() && succeeded < need && failed <= n - need) {
+        int active = 0, msgs = 0;
+        CURLMsg *msg;
+        curl_multi_perform(multiHandle, &active);
+        while((msg = curl_multi_info_read(multiHandle, &msgs))) {
+            if(msg->msg != CURLMSG_DONE) continue;
+            const auto it = running.find(msg->easy_handle);
+            if(it == running.end()) continue;
+            const size_t i = it->second;
+            const CURLcode rc = msg->data.result;
+            running.erase(it);
+            curl_multi_remove_handle(multiHandle, calls[i]->handle);
+            if(m_requests[i]->finishCall(assigner, *calls[i], rc) && calls[i]->httpcode < 400) {
+                status[i] = SUCCEEDED;
+                succeeded++;
+            }
+            else {
+                if(rc == CURLE_OK)
+                    log_warning("%s:%s:%d: %s: HTTP status %ld", get_scriptName().c_str(), get_stateName().c_str(),
+                                get_number(), m_names[i].c_str(), calls[i]->httpcode);
+                status[i] = FAILED;
+                failed++;
+            }
+        }
+        if(running.size() && succeeded < need && failed <= n - need)
+            curl_multi_wait(multiHandle, nullptr, 0, FANOUT_POLL, nullptr);
+    }
+
+    // not needed any more: cancelled, the handles go back to the pool
+    for(const auto &it : running) curl_multi_remove_handle(multiHandle, it.first);
+    for(auto &it : calls) delete it;
+
+    log_debug("%s:%s:%d: %zu requests, %zu succeeded, %zu failed, %zu cancelled",
+              get_scriptName().c_str(), get_stateName().c_str(), get_number(),
+              n, succeeded, failed, running.size());
+    if(succeeded >= need) return get_nextState();
+    for(size_t i = 0; i < n; i++)
+        if(status[i] == FAILED && m_failStates[i] > 0) return m_failStates[i];
+    return get_errorState();
+}
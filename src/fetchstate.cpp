@@ -0,0 +1,77 @@
+/**
+ * @file   fetchstate.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Wed Oct 21 11:37:20 2026
+ *
+ * @brief  CFetchState class implementation: reads the next row of the query
+ *         state cursor, the script loops through the rows with goto
+ *
+ */
+
+#include "config.h"
+#include <boost/lexical_cast.hpp>
+#include "apputils.hpp"
+#include "cstate.hpp"
+#include "parser.hpp"
+#include "cassigner.hpp"
+#include "database.hpp"
+
+extern const char *syntax_error;
+
+// *********************************************************************
+// *** CFetchState
+// *********************************************************************
+
+CFetchState::CFetchState(const int stateno, const std::string& scriptName):
+    CState(stateno, scriptName, "fetch"), m_from(0), m_eofState(0), m_row(nullptr) { };
+
+CFetchState::~CFetchState() {
+    delete m_row;
+    for(auto &it : m_assignments) delete it;
+};
+
+int CFetchState::parse(const std::string& line, const std::string& file, unsigned counter) {
+    regmatch_t regmatch[REGMATCH_COUNT];
+    regoff_t len;
+    if(is_matched("from", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_from = boost::lexical_cast<int>(line.substr(regmatch[1].rm_so, len));
+    }
+    else if(is_matched("eof", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_eofState = boost::lexical_cast<int>(line.substr(regmatch[1].rm_so, len));
+    }
+    else m_assignments.push_back(parseAssignment(line, get_number(), file, counter));
+    return 0;
+}
+
+bool CFetchState::verify() {
+    return
+        m_from > 0 && m_eofState > 0 && get_errorState() > 0 && get_nextState() > 0 &&
+        get_errorState() != get_nextState();
+}
+
+char* CFetchState::getPropositional(const std::string& name) const {
+    return m_row ? m_row->getPropositional(name) : nullptr;
+}
+
+int CFetchState::execute(const FCGX_Request *request, CAssigner* assigner) {
+    CQueryState *qs = findQueryState(get_scriptName(), m_from);
+    delete m_row;
+    m_row = nullptr;
+    if(!qs) {
+        log_warning("%s:%s:%d: state %d is not a query with cursor", get_scriptName().c_str(),
+                    get_stateName().c_str(), get_number(), m_from);
+        return get_errorState();
+    }
+    try {
+        m_row = qs->fetch();
+        if(!m_row) return m_eofState;
+        for(const auto &it : m_assignments) assigner->assign(it, this);
+    }
+    catch(const std::exception& e) {
+        log_warning("%s:%s:%d: %s", get_scriptName().c_str(), get_stateName().c_str(), get_number(), e.what());
+        return get_errorState();
+    }
+    return get_nextState();
+}
@@ -8,12 +8,11 @@
  */
 
 #include "config.h"
-#include <iostream>
-#include <fstream>
 #include "cstate.hpp"
 #include "parser.hpp"
 #include "cassigner.hpp"
 #include "apputils.hpp"
+#include "aio.hpp"
 
 extern const char *syntax_error;
 
@@ -56,20 +55,18 @@ bool CFileState::verify() {
 
 int CFileState::execute(const FCGX_Request *request, CAssigner* assigner) {
     std::string outstr("");
-    std::ofstream thefile(m_fileName.c_str());
-    if(thefile.is_open()) {
-        for(size_t  i = 0; i < m_outList.size(); ++i) {
-            if(m_interpretFlag[i]) {
-                assigner->evaluate(m_outList[i], outstr, this);
-                thefile << outstr << std::endl;
-            }
-            else thefile << m_outList[i] << std::endl;
+    std::string content("");
+    for(size_t  i = 0; i < m_outList.size(); ++i) {
+        if(m_interpretFlag[i]) {
+            assigner->evaluate(m_outList[i], outstr, this);
+            content.append(outstr);
         }
-        thefile.close();
-    }
-    else {
-        return get_errorState();
+        else content.append(m_outList[i]);
+        content.push_back('\n');
     }
+    // the file is written at the end of request within the I/O batch: the
+    // error state is taken if it can not be opened, write errors are logged
+    if(ioBatch.writeFile(m_fileName, content)) return get_errorState();
 
     return get_nextState();
 }
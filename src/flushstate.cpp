@@ -0,0 +1,71 @@
+/**
+ * @file   flushstate.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Tue Oct 20 10:14:52 2026
+ *
+ * @brief  CFlushState class implementation: sends the partial output to the
+ *         client while the script goes on
+ *
+ */
+
+#include "config.h"
+#include "apputils.hpp"
+#include "cstate.hpp"
+#include "parser.hpp"
+#include "cassigner.hpp"
+#include "http.hpp"
+#include "respcache.hpp"
+
+extern const char *syntax_error;
+
+// *********************************************************************
+// *** CFlushState
+// *********************************************************************
+
+CFlushState::CFlushState(const int stateno, const std::string& scriptName):
+    CState(stateno, scriptName, "flush") { };
+
+CFlushState::~CFlushState() {};
+
+int CFlushState::parse(const std::string& line, const std::string& file, unsigned counter) {
+    regmatch_t regmatch[REGMATCH_COUNT];
+    regoff_t len;
+    if(is_matched("data_single", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_outList.push_back(line.substr(regmatch[1].rm_so, len));
+        m_interpretFlag.push_back(false);
+    }
+    else if(is_matched("data_double", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_outList.push_back(line.substr(regmatch[1].rm_so, len));
+        m_interpretFlag.push_back(true);
+    }
+    else throw parser_error(file, syntax_error, counter);
+    return 0;
+}
+
+bool CFlushState::verify() {
+    if(get_errorState() <= 0) set_errorState(get_nextState());
+    return get_nextState() > 0 && m_outList.size() == m_interpretFlag.size();
+}
+
+int CFlushState::execute(const FCGX_Request *request, CAssigner* assigner) {
+    size_t len = m_outList.size();
+
+    // nginx buffers FastCGI replies unless told not to
+    if(!httpReply.is_sent()) httpReply.addHeader("X-Accel-Buffering: no");
+    httpReply.send(request->out);
+    if(len > 0) {
+        std::string outstr("");
+        for(size_t i = 0; i < len; ++i) {
+            if(m_interpretFlag[i]) {
+                assigner->evaluate(m_outList[i], outstr, this);
+                FCGX_FPrintF(request->out, "%s\r\n", outstr.c_str());
+            }
+            else FCGX_FPrintF(request->out, "%s\r\n", m_outList[i].c_str());
+        }
+    }
+    // FastCGI: FCGI_STDOUT record is sent, native HTTP: a chunk is sent
+    if(CCaptureStream::flush(request->out) < 0) return get_errorState();
+    return get_nextState();
+}
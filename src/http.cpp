@@ -7,6 +7,9 @@
 
 #include "config.h"
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
 #include <string>
 #include "http.hpp"
 
@@ -61,16 +64,126 @@ static struct {
     {505, "HTTP Version not supported"}
 };
 
-char* HTTPstatus(const char* prefix, const int code, char *buf, size_t buflen) {
-    size_t i;
-    for(i = 0; i < sizeof(HTTPreply)/sizeof(HTTPreply[0]); i++) {
-        if(code == HTTPreply[i].code) break;
+const char* HTTPreason(const int code) {
+    for(size_t i = 0; i < sizeof(HTTPreply)/sizeof(HTTPreply[0]); i++) {
+        if(code == HTTPreply[i].code) return HTTPreply[i].message;
     }
-    if(i == sizeof(HTTPreply)/sizeof(HTTPreply[0])) i = 33; // 500 Internal Server Error
-    snprintf(buf, buflen, "%s: %d %s\n", prefix, code, HTTPreply[i].message);
+    return HTTPreply[1].message; // 500 Internal Server Error
+}
+
+/**
+ * @fn char* HTTPstatus(const char* prefix, const int code, char *buf, size_t buflen)
+ * @brief formats the status line of a reply
+ * @param prefix -- "Status:" for CGI-style header or protocol name ("HTTP/1.1") for
+ *        the status line of native HTTP reply
+ * @param code -- HTTP status code
+ * @return buf
+ */
+char* HTTPstatus(const char* prefix, const int code, char *buf, size_t buflen) {
+    snprintf(buf, buflen, "%s %d %s\r\n", prefix, code, HTTPreason(code));
+    return buf;
+}
+
+// RFC 7231 IMF-fixdate, i.e. "Sun, 06 Nov 1994 08:49:37 GMT"
+char* HTTPdate(const time_t t, char *buf, size_t buflen) {
+    static const char *wday[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static const char *month[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                  "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    snprintf(buf, buflen, "%s, %02d %s %04d %02d:%02d:%02d GMT", wday[tm.tm_wday], tm.tm_mday,
+             month[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
     return buf;
 }
 
+// IMF-fixdate or unix time, 0 if can not be parsed
+time_t HTTPparseDate(const char *date) {
+    struct tm tm;
+    char *end;
+    time_t t = strtol(date, &end, 10);
+    if(end != date && *end == '\0') return t;
+    memset(&tm, 0, sizeof(tm));
+    if(!strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm)) return 0;
+    return timegm(&tm);
+}
+
+/**
+ * @fn bool HTTPetagMatch(const char *header, const std::string& etag)
+ * @brief If-None-Match check, weak comparison (RFC 7232, 3.2)
+ * @param header -- If-None-Match value: "*" or comma separated entity tags
+ * @param etag -- current entity tag, quoted
+ */
+bool HTTPetagMatch(const char *header, const std::string& etag) {
+    const char *p = header;
+    while(*p) {
+        while(*p == ' ' || *p == ',' || *p == '\t') p++;
+        if(*p == '*') return true;
+        if(strncmp(p, "W/", 2) == 0) p += 2;
+        const char *e = p;
+        while(*e && *e != ',' && *e != ' ' && *e != '\t') e++;
+        if(e > p && etag.compare(0, std::string::npos, p, e - p) == 0) return true;
+        p = e;
+    }
+    return false;
+}
+
+/**
+ * @fn bool HTTPnotModified(FCGX_ParamArray envp, const std::string& etag, const time_t lastmod)
+ * @brief conditional GET, RFC 7232: If-None-Match takes precedence over
+ *        If-Modified-Since
+ * @param etag -- current entity tag, quoted, empty if none
+ * @param lastmod -- current modification time, 0 if none
+ * @return true if the client has the current version, 304 is to be sent
+ */
+bool HTTPnotModified(FCGX_ParamArray envp, const std::string& etag, const time_t lastmod) {
+    if(etag.empty() && lastmod == 0) return false;
+    const char *method = FCGX_GetParam("REQUEST_METHOD", envp);
+    if(!method || (strcasecmp(method, "GET") && strcasecmp(method, "HEAD"))) return false;
+    const char *inm = FCGX_GetParam("HTTP_IF_NONE_MATCH", envp);
+    if(inm) return etag.length() && HTTPetagMatch(inm, etag);
+    const char *ims = FCGX_GetParam("HTTP_IF_MODIFIED_SINCE", envp);
+    if(ims && lastmod > 0) {
+        time_t since = HTTPparseDate(ims);
+        return since > 0 && lastmod <= since;
+    }
+    return false;
+}
+
+// *********************************************************************
+// *** CHttpReply
+// *********************************************************************
+
+CHttpReply httpReply;
+
+CHttpReply::CHttpReply() {
+    reset();
+}
+
+void CHttpReply::reset() {
+    m_status = 200;
+    m_contentType = "text/html";
+    m_headers.clear();
+    m_sent = false;
+}
+
+int CHttpReply::send(FCGX_Stream *out) {
+    char buf[128];
+    if(m_sent) return 0;
+    m_sent = true;
+    if(m_status != 200) FCGX_PutS(HTTPstatus("Status:", m_status, buf, sizeof(buf)), out);
+    // no body, no content type
+    if(m_status != 204 && m_status != 304) FCGX_FPrintF(out, "Content-type: %s\r\n", m_contentType.c_str());
+    for(const auto &it : m_headers) FCGX_FPrintF(out, "%s\r\n", it.c_str());
+    return FCGX_PutS("\r\n", out);
+}
+
+// short error reply, just status and empty body. Too late if the output
+// is streamed already (see CFlushState): the status is sent
+int CHttpReply::sendStatus(FCGX_Stream *out, const int code) {
+    set_status(code);
+    return send(out);
+}
+
 std::string urlDecode(std::string &SRC) {
     std::string ret("");
     char ch;
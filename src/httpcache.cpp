@@ -0,0 +1,257 @@
+/**
+ * @file   httpcache.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Mon Oct 26 17:55:02 2026
+ *
+ * @brief  Upstream HTTP cache implementation
+ *
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <stdint.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <curl/curl.h>
+#include <boost/property_tree/ptree.hpp>
+#include "apputils.hpp"
+#include "httpcache.hpp"
+
+namespace pt = boost::property_tree;
+extern pt::ptree *cpt;                       // property tree: global configuration
+
+CShmCache httpCache;
+
+static std::string spoolDir("");             // spilled bodies, empty - none
+static size_t maxSpill = HTTPCACHE_MAXSPILL;
+static unsigned keepStale = HTTPCACHE_KEEP;
+static unsigned maxTTL = HTTPCACHE_MAXTTL;
+
+// shared memory value: this header, ETag, Last-Modified and the body if not spilled
+struct httpCacheHead_t {
+    int64_t  expires;
+    int64_t  lifetime;                       // s, freshness of the last full reply
+    uint32_t etaglen;
+    uint32_t lmlen;
+    uint64_t bodylen;
+    uint32_t spilled;
+};
+
+// called by master before fork
+void httpCacheInit() {
+    if(!cpt->get_child_optional("httpcache")) return;
+    spoolDir = cpt->get<std::string>("httpcache.spool", "");
+    maxSpill = cpt->get<size_t>("httpcache.maxspill", HTTPCACHE_MAXSPILL);
+    keepStale = cpt->get<unsigned>("httpcache.keep", HTTPCACHE_KEEP);
+    maxTTL = cpt->get<unsigned>("httpcache.maxttl", HTTPCACHE_MAXTTL);
+    httpCache.create("httpcache", cpt->get<size_t>("httpcache.size", HTTPCACHE_SIZE),
+                     cpt->get<size_t>("httpcache.maxentry", HTTPCACHE_MAXENTRY) + sizeof(httpCacheHead_t) + 512);
+}
+
+static std::string spillPath(const std::string& key) {
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.http", (unsigned long long)hash64(key.data(), key.size()));
+    return spoolDir + name;
+}
+
+static bool readSpill(const std::string& path, size_t len, std::string& body) {
+    struct stat st;
+    int fd = open(path.c_str(), O_RDONLY|O_CLOEXEC);
+    if(fd < 0) return false;
+    if(fstat(fd, &st) || (size_t)st.st_size != len) {
+        close(fd);
+        return false;
+    }
+    body.resize(len);
+    size_t done = 0;
+    while(done < len) {
+        const ssize_t rv = read(fd, &body[done], len - done);
+        if(rv < 0 && errno == EINTR) continue;
+        if(rv <= 0) break;
+        done += rv;
+    }
+    close(fd);
+    return done == len;
+}
+
+// the file is replaced at once, a reader never sees it half written
+static bool writeSpill(const std::string& path, const std::string& body) {
+    const std::string tmp = path + "." + std::to_string(getpid());
+    int fd = open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if(fd < 0) return false;
+    size_t done = 0;
+    while(done < body.size()) {
+        const ssize_t rv = write(fd, body.data() + done, body.size() - done);
+        if(rv < 0 && errno == EINTR) continue;
+        if(rv <= 0) break;
+        done += rv;
+    }
+    if(close(fd) || done != body.size() || rename(tmp.c_str(), path.c_str())) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @fn bool httpCacheGet(const std::string& key, httpCacheEntry_t& entry, std::string& body)
+ * @brief looks up the reply, fresh or stale; the caller checks entry.expires
+ * @return false if there is no reply or its spilled body is lost
+ */
+bool httpCacheGet(const std::string& key, httpCacheEntry_t& entry, std::string& body) {
+    std::string data;
+    httpCacheHead_t head;
+    if(!httpCache.is_enabled() || !httpCache.get(key, data) || data.size() < sizeof(head)) return false;
+    memcpy(&head, data.data(), sizeof(head));
+    size_t pos = sizeof(head);
+    entry.expires = head.expires;
+    entry.lifetime = head.lifetime;
+    entry.etag.assign(data, pos, head.etaglen);
+    pos += head.etaglen;
+    entry.lastModified.assign(data, pos, head.lmlen);
+    pos += head.lmlen;
+    if(!head.spilled) {
+        body.assign(data, pos, head.bodylen);
+        return true;
+    }
+    if(readSpill(spillPath(key), head.bodylen, body)) return true;
+    httpCache.remove(key);
+    return false;
+}
+
+/**
+ * @fn void httpCachePut(const std::string& key, const httpCacheEntry_t& entry, const std::string& body, bool refresh)
+ * @brief stores the reply for its freshness time, plus the keep time if it
+ *        can be revalidated. The body larger than the shared memory slot is
+ *        spilled to the spool directory
+ * @param refresh -- the body is revalidated, a spilled one is not written again
+ */
+void httpCachePut(const std::string& key, const httpCacheEntry_t& entry, const std::string& body, bool refresh) {
+    if(!httpCache.is_enabled()) return;
+    const time_t now = time(nullptr);
+    const bool validators = entry.etag.size() || entry.lastModified.size();
+    const unsigned ttl = (entry.expires > now ? entry.expires - now : 0) + (validators ? keepStale : 0);
+    if(ttl == 0) return;
+
+    httpCacheHead_t head;
+    memset(&head, 0, sizeof(head));
+    head.expires = entry.expires;
+    head.lifetime = entry.lifetime;
+    head.etaglen = entry.etag.size();
+    head.lmlen = entry.lastModified.size();
+    head.bodylen = body.size();
+    head.spilled = sizeof(head) + head.etaglen + head.lmlen + body.size() + key.size() > httpCache.get_maxData();
+
+    if(head.spilled) {
+        if(spoolDir.empty() || body.size() > maxSpill) {
+            httpCache.remove(key);
+            return;
+        }
+        const std::string path = spillPath(key);
+        if(!(refresh && utime(path.c_str(), nullptr) == 0) && !writeSpill(path, body)) {
+            log_warning("%s: %s: %s", __func__, path.c_str(), strerror(errno));
+            httpCache.remove(key);
+            return;
+        }
+    }
+
+    std::string data((const char*)&head, sizeof(head));
+    data.append(entry.etag);
+    data.append(entry.lastModified);
+    if(!head.spilled) data.append(body);
+    httpCache.put(key, data, ttl);
+}
+
+// the reply header lines the cache needs, collected by the header callback
+bool httpCacheHeader(const char *line, size_t len) {
+    static const char *names[] = { "cache-control:", "expires:", "date:", "age:", "etag:", "last-modified:", nullptr };
+    for(int i = 0; names[i]; i++) {
+        const size_t n = strlen(names[i]);
+        if(len > n && strncasecmp(line, names[i], n) == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * @fn bool httpCacheControl(const std::string& headers, httpCacheEntry_t& entry)
+ * @brief sets the freshness and the validators of the entry from the reply
+ *        headers. The entry of a 304 reply keeps its validators and its
+ *        lifetime if the reply has none
+ * @return false if the reply must not be stored
+ */
+bool httpCacheControl(const std::string& headers, httpCacheEntry_t& entry) {
+    const time_t now = time(nullptr);
+    long maxAge = -1, age = 0;
+    time_t expires = -1, date = -1;
+    bool noStore = false, noCache = false;
+    std::string::size_type pos = 0;
+
+    while(pos < headers.size()) {
+        std::string::size_type eol = headers.find('\n', pos);
+        if(eol == std::string::npos) eol = headers.size();
+        const std::string::size_type colon = headers.find(':', pos);
+        if(colon < eol) {
+            std::string name = headers.substr(pos, colon - pos);
+            std::string value = headers.substr(colon + 1, eol - colon - 1);
+            value.erase(0, value.find_first_not_of(" \t"));
+            value.erase(value.find_last_not_of(" \t\r") + 1);
+            if(strcasecmp(name.c_str(), "cache-control") == 0) {
+                std::string::size_type p = 0;
+                while(p < value.size()) {
+                    std::string::size_type comma = value.find(',', p);
+                    if(comma == std::string::npos) comma = value.size();
+                    std::string token = value.substr(p, comma - p);
+                    token.erase(0, token.find_first_not_of(" \t"));
+                    token.erase(token.find_last_not_of(" \t") + 1);
+                    if(strcasecmp(token.c_str(), "no-store") == 0) noStore = true;
+                    else if(strcasecmp(token.c_str(), "no-cache") == 0) noCache = true;
+                    else if(strncasecmp(token.c_str(), "max-age=", 8) == 0) maxAge = atol(token.c_str() + 8);
+                    p = comma + 1;
+                }
+            }
+            else if(strcasecmp(name.c_str(), "expires") == 0) {
+                expires = curl_getdate(value.c_str(), nullptr);
+                if(expires < 0) expires = 0;          // invalid date means expired
+            }
+            else if(strcasecmp(name.c_str(), "date") == 0) date = curl_getdate(value.c_str(), nullptr);
+            else if(strcasecmp(name.c_str(), "age") == 0) age = atol(value.c_str());
+            else if(strcasecmp(name.c_str(), "etag") == 0) entry.etag = value;
+            else if(strcasecmp(name.c_str(), "last-modified") == 0) entry.lastModified = value;
+        }
+        pos = eol + 1;
+    }
+    if(noStore) return false;
+
+    long lifetime;
+    if(noCache) lifetime = 0;
+    else if(maxAge >= 0) lifetime = maxAge - age;
+    else if(expires >= 0) lifetime = expires - (date > 0 ? date : now) - age;
+    else lifetime = entry.lifetime;
+    if(lifetime > (long)maxTTL) lifetime = maxTTL;
+    entry.lifetime = lifetime > 0 ? lifetime : 0;
+    entry.expires = lifetime > 0 ? now + lifetime : 0;
+    return entry.expires > now || entry.etag.size() || entry.lastModified.size();
+}
+
+// master: the spilled bodies of the entries gone from the shared memory
+void httpCachePrune() {
+    if(spoolDir.empty() || !httpCache.is_enabled()) return;
+    DIR *dir = opendir(spoolDir.c_str());
+    if(!dir) return;
+    const time_t old = time(nullptr) - maxTTL - keepStale;
+    struct dirent *de;
+    struct stat st;
+    while((de = readdir(dir))) {
+        if(!strstr(de->d_name, ".http")) continue;
+        const std::string path = spoolDir + "/" + de->d_name;
+        if(stat(path.c_str(), &st) == 0 && st.st_mtime < old) unlink(path.c_str());
+    }
+    closedir(dir);
+}
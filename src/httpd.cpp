@@ -0,0 +1,460 @@
+/**
+ * @file   httpd.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Mon Oct 19 11:20:41 2026
+ *
+ * @brief  Native HTTP/1.1 front end: keep-alive, pipelining and chunked replies.
+ *         Every HTTP request is translated to the FCGX_Request with memory
+ *         streams, so the script dispatch and the states are exactly the same
+ *         as for the FastCGI requests.
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include "apputils.hpp"
+#include "http.hpp"
+#include "httpd.hpp"
+#include "aio.hpp"
+
+static const char CRLF[] = "\r\n";
+static const char LASTCHUNK[] = "0\r\n\r\n";
+
+// *********************************************************************
+// *** CHttpConnection: single client connection
+// *********************************************************************
+
+class CHttpConnection {
+    int m_fd;
+    std::string m_rbuf;               /// < @brief received but not processed yet (pipelined) data
+    std::string m_body;               /// < @brief request body
+    std::string m_protocol;           /// < @brief request protocol, HTTP/1.0 or HTTP/1.1
+    std::vector<std::string> m_env;   /// < @brief CGI environment
+    std::vector<char*> m_envp;        /// < @brief CGI environment for FCGX_GetParam
+    FCGX_Stream m_in;                 /// < @brief request body reader
+    FCGX_Stream m_out;                /// < @brief reply writer
+    FCGX_Stream m_err;                /// < @brief error stream, everything is discarded
+    unsigned char m_obuf[HTTP_OUTBUF];
+    unsigned char m_ebuf[256];
+    bool m_keepAlive;                 /// < @brief keep connection after the reply
+    bool m_headOnly;                  /// < @brief HEAD request, no body in reply
+    bool m_headersSent;               /// < @brief status line and headers are sent
+    bool m_chunked;                   /// < @brief reply uses chunked transfer encoding
+    bool m_broken;                    /// < @brief write error, drop connection
+
+    static void fillBuffer(FCGX_Stream *stream);
+    static void emptyBuffer(FCGX_Stream *stream, int doClose);
+    static void discardBuffer(FCGX_Stream *stream, int doClose);
+
+    bool receive(int timeout);
+    bool sendAll(struct iovec *iov, int iovcnt);
+    void setEnv(const char *name, const std::string& value);
+    std::string replyHeader(const char *data, size_t len, bool final, size_t *hlen);
+public:
+    explicit CHttpConnection(int fd);
+    int readRequest(int timeout);
+    void initRequest(FCGX_Request *request, bool last);
+    void flush(bool final);
+    void sendError(int code);
+    inline bool keepAlive() const { return m_keepAlive && !m_broken; }
+};
+
+CHttpConnection::CHttpConnection(int fd):
+    m_fd(fd), m_keepAlive(true), m_headOnly(false), m_headersSent(false),
+    m_chunked(false), m_broken(false) {}
+
+// the whole request body is already in memory
+void CHttpConnection::fillBuffer(FCGX_Stream *stream) {
+    stream->isClosed = 1;
+}
+
+void CHttpConnection::emptyBuffer(FCGX_Stream *stream, int doClose) {
+    static_cast<CHttpConnection*>(stream->data)->flush(false);
+}
+
+void CHttpConnection::discardBuffer(FCGX_Stream *stream, int doClose) {
+    stream->wrNext = static_cast<CHttpConnection*>(stream->data)->m_ebuf;
+}
+
+bool CHttpConnection::receive(int timeout) {
+    char buf[HTTP_READBUF];
+    struct pollfd pfd;
+    pfd.fd = m_fd;
+    pfd.events = POLLIN;
+    while(1) {
+        int rv = poll(&pfd, 1, timeout * 1000);
+        if(rv < 0 && errno == EINTR) continue;
+        if(rv <= 0) return false; // error or idle timeout
+        ssize_t n = recv(m_fd, buf, sizeof(buf), 0);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;  // error or peer closed connection
+        m_rbuf.append(buf, n);
+        return true;
+    }
+}
+
+// the queued file writes of the request go out within the same batch
+bool CHttpConnection::sendAll(struct iovec *iov, int iovcnt) {
+    return ioBatch.sendv(m_fd, iov, iovcnt);
+}
+
+void CHttpConnection::setEnv(const char *name, const std::string& value) {
+    std::string var(name);
+    var.push_back('=');
+    var.append(value);
+    m_env.push_back(var);
+}
+
+/**
+ * @fn int CHttpConnection::readRequest(int timeout)
+ * @brief reads the next request from the connection or from the pipelined data
+ * @param timeout -- idle timeout, seconds
+ * @return 0 if request is read, 1 if connection is closed or timed out,
+ *         HTTP error status code otherwise
+ */
+int CHttpConnection::readRequest(int timeout) {
+    std::string::size_type hend;
+    std::vector<std::string> lines;
+    std::vector<std::string> rline;
+    size_t clen = 0;
+    bool expect = false;
+
+    m_env.clear();
+    m_body.clear();
+    m_headersSent = m_chunked = m_headOnly = false;
+
+    while(1) {
+        // RFC 7230, 3.5: ignore empty lines before the request line
+        hend = m_rbuf.find_first_not_of(CRLF);
+        if(hend != std::string::npos && hend > 0) m_rbuf.erase(0, hend);
+        hend = m_rbuf.find("\r\n\r\n");
+        if(hend != std::string::npos) break;
+        if(m_rbuf.size() > HTTP_MAXHEADER) return 400;
+        if(!receive(timeout)) return 1;
+    }
+
+    std::string header = m_rbuf.substr(0, hend);
+    boost::split(lines, header, boost::is_any_of(CRLF), boost::token_compress_on);
+    boost::split(rline, lines[0], boost::is_any_of(" "), boost::token_compress_on);
+    if(rline.size() != 3) return 400;
+    m_protocol = rline[2];
+    if(m_protocol == "HTTP/1.0") m_keepAlive = false;
+    else if(m_protocol == "HTTP/1.1") m_keepAlive = true;
+    else return 505;
+    m_headOnly = rline[0] == "HEAD";
+
+    std::string::size_type qs = rline[1].find('?');
+    setEnv("REQUEST_METHOD", rline[0]);
+    setEnv("REQUEST_URI", rline[1]);
+    setEnv("SCRIPT_NAME", rline[1].substr(0, qs));
+    setEnv("QUERY_STRING", qs != std::string::npos ? rline[1].substr(qs + 1) : "");
+    setEnv("SERVER_PROTOCOL", m_protocol);
+    setEnv("SERVER_SOFTWARE", "appserver");
+    setEnv("GATEWAY_INTERFACE", "CGI/1.1");
+
+    for(size_t i = 1; i < lines.size(); ++i) {
+        std::string::size_type colon = lines[i].find(':');
+        if(colon == std::string::npos || colon == 0) return 400;
+        std::string name = lines[i].substr(0, colon);
+        std::string value = boost::trim_copy(lines[i].substr(colon + 1));
+        if(boost::iequals(name, "Content-Length")) {
+            try {
+                clen = boost::lexical_cast<size_t>(value);
+            }
+            catch(boost::bad_lexical_cast&) {
+                return 400;
+            }
+            setEnv("CONTENT_LENGTH", value);
+            continue;
+        }
+        if(boost::iequals(name, "Content-Type")) {
+            setEnv("CONTENT_TYPE", value);
+            continue;
+        }
+        if(boost::iequals(name, "Transfer-Encoding")) return 501; // chunked requests are not supported
+        if(boost::iequals(name, "Connection")) {
+            if(boost::iequals(value, "close")) m_keepAlive = false;
+            else if(boost::iequals(value, "keep-alive")) m_keepAlive = true;
+        }
+        if(boost::iequals(name, "Expect") && boost::iequals(value, "100-continue")) expect = true;
+        // all the rest are HTTP_* variables
+        std::string var("HTTP_");
+        var.append(boost::to_upper_copy(name));
+        std::replace(var.begin(), var.end(), '-', '_');
+        setEnv(var.c_str(), value);
+    }
+
+    if(clen > HTTP_MAXBODY) return 413;
+    hend += 4;
+    if(expect && m_rbuf.size() < hend + clen) {
+        static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        struct iovec iov = { (void*)cont, sizeof(cont) - 1 };
+        if(!sendAll(&iov, 1)) return 1;
+    }
+    while(m_rbuf.size() < hend + clen) {
+        if(!receive(timeout)) return 1;
+    }
+    m_body.assign(m_rbuf, hend, clen);
+    m_rbuf.erase(0, hend + clen);
+
+    struct sockaddr_storage sa;
+    socklen_t salen = sizeof(sa);
+    char host[NI_MAXHOST], port[NI_MAXSERV];
+    if(getpeername(m_fd, (struct sockaddr*)&sa, &salen) == 0 &&
+       getnameinfo((struct sockaddr*)&sa, salen, host, sizeof(host), port, sizeof(port),
+                   NI_NUMERICHOST|NI_NUMERICSERV) == 0)
+    {
+        setEnv("REMOTE_ADDR", host);
+        setEnv("REMOTE_PORT", port);
+    }
+    return 0;
+}
+
+void CHttpConnection::initRequest(FCGX_Request *request, bool last) {
+    if(last) m_keepAlive = false;
+
+    m_envp.clear();
+    for(auto &it : m_env) m_envp.push_back(const_cast<char*>(it.c_str()));
+    m_envp.push_back(nullptr);
+
+    memset(&m_in, 0, sizeof(m_in));
+    m_in.rdNext = m_in.stop = m_in.stopUnget = (unsigned char*)m_body.data();
+    m_in.stop += m_body.size();
+    m_in.isReader = 1;
+    m_in.isClosed = m_body.empty();
+    m_in.fillBuffProc = fillBuffer;
+    m_in.data = this;
+
+    memset(&m_out, 0, sizeof(m_out));
+    m_out.wrNext = m_obuf;
+    m_out.stop = m_obuf + sizeof(m_obuf);
+    m_out.emptyBuffProc = emptyBuffer;
+    m_out.data = this;
+
+    memset(&m_err, 0, sizeof(m_err));
+    m_err.wrNext = m_ebuf;
+    m_err.stop = m_ebuf + sizeof(m_ebuf);
+    m_err.emptyBuffProc = discardBuffer;
+    m_err.data = this;
+
+    memset(request, 0, sizeof(*request));
+    request->in = &m_in;
+    request->out = &m_out;
+    request->err = &m_err;
+    request->envp = &m_envp[0];
+    request->ipcFd = -1;
+    request->listen_sock = -1;
+}
+
+/**
+ * @fn std::string CHttpConnection::replyHeader(const char *data, size_t len, bool final, size_t *hlen)
+ * @brief translates the CGI header block written by CHttpReply to the HTTP reply header
+ * @param data, len -- reply data written so far
+ * @param final -- the whole reply is in data, so we know Content-Length
+ * @param hlen -- (out) CGI header block length
+ * @return status line and headers
+ */
+std::string CHttpConnection::replyHeader(const char *data, size_t len, bool final, size_t *hlen) {
+    int status = 200;
+    char buf[128];
+    std::string headers;
+    const char *end = data + len;
+    const char *sep = std::search(data, end, "\r\n\r\n", "\r\n\r\n" + 4);
+
+    *hlen = 0;
+    if(sep != end) {
+        std::vector<std::string> lines;
+        std::string block(data, sep - data);
+        boost::split(lines, block, boost::is_any_of(CRLF), boost::token_compress_on);
+        for(const auto &it : lines) {
+            std::string::size_type colon = it.find(':');
+            if(colon == std::string::npos) continue;
+            std::string name = it.substr(0, colon);
+            if(boost::iequals(name, "Status")) status = atoi(it.c_str() + colon + 1);
+            else if(!boost::iequals(name, "Content-Length") &&
+                    !boost::iequals(name, "Connection") &&
+                    !boost::iequals(name, "Transfer-Encoding"))
+            {
+                headers.append(it);
+                headers.append(CRLF);
+            }
+        }
+        *hlen = sep - data + 4;
+    }
+    else headers = "Content-type: text/html\r\n"; // no CGI header, everything is a body
+
+    std::string head(HTTPstatus("HTTP/1.1", status, buf, sizeof(buf)));
+    head.append("Date: ");
+    head.append(HTTPdate(time(nullptr), buf, sizeof(buf)));
+    head.append(CRLF);
+    head.append(headers);
+    if(status == 204 || status == 304 || status < 200) {
+        m_headOnly = true; // no message body allowed
+    }
+    else if(final) {
+        head.append("Content-Length: ");
+        head.append(boost::lexical_cast<std::string>(len - *hlen));
+        head.append(CRLF);
+    }
+    else if(m_protocol == "HTTP/1.1") {
+        head.append("Transfer-Encoding: chunked\r\n");
+        m_chunked = true;
+    }
+    else m_keepAlive = false; // HTTP/1.0 reply of unknown length ends with the connection
+    head.append(m_keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+    return head;
+}
+
+/**
+ * @fn void CHttpConnection::flush(bool final)
+ * @brief sends the reply buffer to the client. The reply header is sent along
+ *        with the first portion of data. If the reply does not fit the buffer
+ *        or the script flushes the output, the chunked transfer is used.
+ * @param final -- the reply is complete
+ */
+void CHttpConnection::flush(bool final) {
+    const char *data = (const char*)m_obuf;
+    size_t len = m_out.wrNext - m_obuf;
+    std::string head;
+    char chunk[32];
+    struct iovec iov[5];
+    int n = 0;
+
+    if(!m_headersSent) {
+        size_t hlen;
+        head = replyHeader(data, len, final, &hlen);
+        data += hlen;
+        len -= hlen;
+        m_headersSent = true;
+        iov[n].iov_base = (void*)head.data();
+        iov[n++].iov_len = head.size();
+    }
+    if(!m_headOnly && len > 0) {
+        if(m_chunked) {
+            iov[n].iov_base = chunk;
+            iov[n++].iov_len = snprintf(chunk, sizeof(chunk), "%zx\r\n", len);
+        }
+        iov[n].iov_base = (void*)data;
+        iov[n++].iov_len = len;
+        if(m_chunked) {
+            iov[n].iov_base = (void*)CRLF;
+            iov[n++].iov_len = sizeof(CRLF) - 1;
+        }
+    }
+    if(final && m_chunked && !m_headOnly) {
+        iov[n].iov_base = (void*)LASTCHUNK;
+        iov[n++].iov_len = sizeof(LASTCHUNK) - 1;
+    }
+    if(n > 0 && !m_broken && !sendAll(iov, n)) {
+        m_broken = true;
+        m_out.isClosed = 1; // FCGX_PutStr fails from now on
+    }
+    m_out.wrNext = m_obuf;
+}
+
+void CHttpConnection::sendError(int code) {
+    char buf[128];
+    std::string reply(HTTPstatus("HTTP/1.1", code, buf, sizeof(buf)));
+    reply.append("Content-Length: 0\r\nConnection: close\r\n\r\n");
+    struct iovec iov = { (void*)reply.data(), reply.size() };
+    m_keepAlive = false;
+    if(!m_broken) sendAll(&iov, 1);
+}
+
+// *********************************************************************
+// *** front end interface
+// *********************************************************************
+
+/**
+ * @fn int httpOpenSocket(const char *path, int backlog)
+ * @brief opens listening socket, semantics is the same as for FCGX_OpenSocket
+ * @param path -- "[host]:port" for TCP socket or unix domain socket path
+ * @param backlog -- listen(2) backlog
+ * @return socket or -1 on error
+ */
+int httpOpenSocket(const char *path, int backlog) {
+    int fd, one = 1;
+    const char *colon = strrchr(path, ':');
+
+    if(colon) {
+        struct addrinfo hints, *res;
+        std::string host(path, colon - path);
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        int rv = getaddrinfo(host.empty() ? nullptr : host.c_str(), colon + 1, &hints, &res);
+        if(rv) {
+            log_warning("%s: %s: %s", __func__, path, gai_strerror(rv));
+            errno = EINVAL;
+            return -1;
+        }
+        fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+        if(fd >= 0) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if(bind(fd, res->ai_addr, res->ai_addrlen) < 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(res);
+    }
+    else {
+        struct sockaddr_un sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        strncpy(sa.sun_path, path, sizeof(sa.sun_path) - 1);
+        unlink(path);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd >= 0 && bind(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if(fd >= 0 && listen(fd, backlog) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/**
+ * @fn int httpServeConnection(int fd, requestHandler_t handler, int keepalive, int maxrequests)
+ * @brief serves all the requests of the accepted connection and closes it
+ * @param fd -- accepted connection
+ * @param handler -- request handler, the same as for FastCGI requests
+ * @param keepalive -- idle timeout, seconds
+ * @param maxrequests -- requests per connection limit
+ * @return number of requests served
+ */
+int httpServeConnection(int fd, requestHandler_t handler, int keepalive, int maxrequests) {
+    int rv, served = 0, one = 1;
+    CHttpConnection *conn = new CHttpConnection(fd);
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // fails for unix socket, ok
+    while((rv = conn->readRequest(keepalive)) == 0) {
+        FCGX_Request request;
+        conn->initRequest(&request, ++served >= maxrequests);
+        handler(&request);
+        conn->flush(true);
+        ioBatch.submit(); // nothing is left normally, but the connection may be broken
+        if(!conn->keepAlive()) break;
+    }
+    if(rv > 1) conn->sendError(rv);
+    delete conn;
+    close(fd);
+    return served;
+}
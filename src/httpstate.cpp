@@ -10,17 +10,37 @@
 #include "config.h"
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
 #include <boost/lexical_cast.hpp>
 #include <curl/curl.h>
 #include "cstate.hpp"
 #include "parser.hpp"
 #include "cassigner.hpp"
 #include "apputils.hpp"
+#include "aio.hpp"
+#include "statecache.hpp"
+#include "singleflight.hpp"
+#include "curlpool.hpp"
+#include "deadline.hpp"
+#include "circuitbreaker.hpp"
+#include "http.hpp"
+#include "httpcache.hpp"
 
 namespace pt = boost::property_tree;
 extern pt::ptree *cpt;                       // property tree: global configuration
 extern const char *syntax_error;
 
+#define HTTP_TIMEOUT        30000            // ms, [common] http_timeout
+#define HTTP_CONNECTTIMEOUT 5000             // ms, [common] http_connecttimeout
+#define HEDGE_WINDOW        128              // latencies kept per state
+#define HEDGE_SAMPLES       20               // no hedged calls until then
+#define HEDGE_POLL          1000             // ms, curl_multi_wait
+#define HTTP_CAPTURE        (64*1024)        // stream: body kept by default
+#define HTTP_ERRORPAGE      4096             // stream: error body kept at least
+
 // *********************************************************************
 // *** libCURL staff
 // *********************************************************************
@@ -31,6 +51,52 @@ static int curlWriter(char *data, size_t size, size_t nmemb, std::string *result
     return (int)(size * nmemb);
 }
 
+// streaming: the body goes to the file or the client as it comes, the
+// output keeps the first bytes. An error page is captured only
+static size_t streamWriter(char *data, size_t size, size_t nmemb, httpCall_t *call) {
+    const size_t len = size * nmemb;
+    if(!call->httpcode) curl_easy_getinfo(call->handle, CURLINFO_RESPONSE_CODE, &call->httpcode);
+    const bool failed = call->httpcode >= 400;
+    const size_t capture = failed ? std::max(call->capture, (size_t)HTTP_ERRORPAGE) : call->capture;
+    if(call->output.size() < capture) call->output.append(data, std::min(len, capture - call->output.size()));
+    if(failed) return len;
+
+    for(size_t done = 0; call->fd >= 0 && done < len; ) {
+        const ssize_t rv = write(call->fd, data + done, len - done);
+        if(rv < 0 && errno == EINTR) continue;
+        if(rv <= 0) return 0;         // the transfer is aborted
+        done += rv;
+    }
+    if(call->client) {
+        if(!httpReply.is_sent()) {
+            // the script can not set them before the stream starts: the upstream's
+            char *ctype = nullptr;
+            if(curl_easy_getinfo(call->handle, CURLINFO_CONTENT_TYPE, &ctype) == CURLE_OK && ctype &&
+               !strpbrk(ctype, "\r\n")) httpReply.set_contentType(ctype);
+            if(call->disposition.size()) httpReply.addHeader(call->disposition);
+            httpReply.send(call->client);
+        }
+        if(FCGX_PutStr(data, len, call->client) < 0) return 0;
+    }
+    return len;
+}
+
+// the reply headers the http cache needs, and Content-Disposition of the
+// stream to the client; the status line starts them over
+static size_t headerWriter(char *data, size_t size, size_t nmemb, httpCall_t *call) {
+    const size_t len = size * nmemb;
+    if(len > 5 && strncmp(data, "HTTP/", 5) == 0) {
+        call->replyHeaders.clear();
+        call->disposition.clear();
+    }
+    else if(call->cacheKey.size() && httpCacheHeader(data, len)) call->replyHeaders.append(data, len);
+    else if(call->client && len > 20 && strncasecmp(data, "content-disposition:", 20) == 0) {
+        call->disposition.assign(data, len);
+        call->disposition.erase(call->disposition.find_last_not_of("\r\n") + 1);
+    }
+    return len;
+}
+
 // *********************************************************************
 // *** CHttpGetState
 // *********************************************************************
@@ -39,7 +105,13 @@ CHttpState::CHttpState(const int stateno, const std::string& scriptName):
     CState(stateno, scriptName, "http"), m_url(""), 
     m_ucertenc("PEM"), m_pkeyenc("PEM"), m_pkeypswd(""),
     m_method(HTTPGET),
-    m_outputvar(""), m_params(""), m_dumpfile(""), m_dumpflag(false) {};
+    m_outputvar(""), m_params(""), m_dumpfile(""), m_dumpflag(false),
+    m_timeout(cpt->get<unsigned>("common.http_timeout", HTTP_TIMEOUT)),
+    m_connectTimeout(cpt->get<unsigned>("common.http_connecttimeout", HTTP_CONNECTTIMEOUT)),
+    m_hedgePercentile(0), m_hedgeUrl(""), m_latencyNext(0),
+    m_stream(STREAM_NONE), m_capture(HTTP_CAPTURE),
+    m_http2(cpt->get<bool>("common.http2", false)),
+    m_compress(cpt->get<bool>("common.http_compress", true)) {};
 
 CHttpState::~CHttpState() {};
 
@@ -60,6 +132,14 @@ CHttpState::~CHttpState() {};
       [addheader 'Accept: Yes']
       [addheader 'Reject: No']
       [file "path"]
+      [cache 300]
+      [timeout 2000]
+      [connecttimeout 500]
+      [hedge 95 "http://replica/..."]
+      [stream file|client]
+      [capture 65536]
+      [http2]
+      [compress yes|no]
       done 400
       error 500
       endstate
@@ -127,11 +207,47 @@ int CHttpState::parse(const std::string& line, const std::string& file, unsigned
         m_dumpfile = line.substr(regmatch[1].rm_so, len);
         m_dumpflag = true;
     }
+    else if(is_matched("cache", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        set_cacheTTL(boost::lexical_cast<unsigned>(line.substr(regmatch[1].rm_so, len)));
+        stateCacheRequired();
+    }
+    else if(is_matched("timeout", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_timeout = boost::lexical_cast<unsigned>(line.substr(regmatch[1].rm_so, len));
+    }
+    else if(is_matched("connecttimeout", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_connectTimeout = boost::lexical_cast<unsigned>(line.substr(regmatch[1].rm_so, len));
+    }
+    else if(is_matched("hedge", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_hedgePercentile = boost::lexical_cast<unsigned>(line.substr(regmatch[1].rm_so, len));
+        if(regmatch[3].rm_so >= 0) {
+            len = regmatch[3].rm_eo - regmatch[3].rm_so;
+            m_hedgeUrl = line.substr(regmatch[3].rm_so, len);
+        }
+    }
+    else if(is_matched("stream", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_stream = line.substr(regmatch[1].rm_so, len) == "file" ? STREAM_FILE : STREAM_CLIENT;
+    }
+    else if(is_matched("capture", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_capture = boost::lexical_cast<size_t>(line.substr(regmatch[1].rm_so, len));
+    }
+    else if(is_matched("http2", line, regmatch, 0, file, counter)) {
+        m_http2 = true;
+    }
+    else if(is_matched("compress", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_compress = line.substr(regmatch[1].rm_so, len) == "yes";
+    }
     else throw parser_error(file, syntax_error, counter);
     return 0;
 }
 
-bool CHttpState::verify() {
+bool CHttpState::verifyRequest() const {
     return
         m_url.length() > 7 &&
         (strncasecmp(m_url.c_str(), "http://", 7) == 0 ||
@@ -139,32 +255,146 @@ bool CHttpState::verify() {
         (m_ucertenc == "PEM" || m_ucertenc == "DER") &&
         (m_pkeyenc == "PEM" ||  m_pkeyenc == "DER") &&
         m_outputvar.length() > 0 &&
+        m_hedgePercentile < 100 &&
+        // a POST may change something, it is not sent twice
+        (m_hedgePercentile == 0 || m_method == HTTPGET) &&
+        (m_hedgeUrl.empty() ||
+         strncasecmp(m_hedgeUrl.c_str(), "http://", 7) == 0 ||
+         strncasecmp(m_hedgeUrl.c_str(), "https://", 8) == 0) &&
+        // a partial body is neither memoized nor raced
+        (m_stream == STREAM_NONE || (get_cacheTTL() == 0 && m_hedgePercentile == 0)) &&
+        (m_stream != STREAM_FILE || m_dumpflag);
+}
+
+bool CHttpState::verify() {
+    if(m_http2 && !(curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_HTTP2))
+        log_warning("%s:%d: libCURL is built without HTTP/2, HTTP/1.1 is used",
+                    get_scriptName().c_str(), get_number());
+    return
+        verifyRequest() &&
         get_errorState() > 0 &&
         get_nextState() > 0 &&
         get_errorState() != get_nextState();
 }
 
-int CHttpState::execute(const FCGX_Request *request, CAssigner* assigner) {
+// stores the reply to the output variable and dumps it to the file, the
+// reply is taken by the batch
+int CHttpState::setOutput(CAssigner* assigner, std::string& output) {
+    assigner->assignLocal(m_outputvar, strdup(output.c_str()));
+
+    if(m_dumpflag && m_stream != STREAM_FILE) {
+        if(ioBatch.writeFile(m_dumpfile, output))
+            log_warning("%s:%s:%d: %s: dump error",
+                        get_scriptName().c_str(), get_stateName().c_str(),
+                        get_number(), m_dumpfile.c_str());
+    }
+    
+    return get_nextState();
+}
+
+/**
+ * @fn int CHttpState::startCall(CAssigner* assigner, httpCall_t& call, bool hedge)
+ * @brief evaluates the request, looks it up in the state cache and prepares
+ *        the handle. The transfer is run by the caller, alone or with others
+ * @param hedge -- the second call of the hedged request: the hedge url,
+ *        no cache lookup, the first call keeps the memo key
+ * @return CALL_READY, CALL_CACHED with call.output or CALL_FAILED
+ */
+int CHttpState::startCall(CAssigner* assigner, httpCall_t& call, bool hedge) {
     CURLcode rc;
     CURL *curl_handle;
-    struct curl_slist *chunk = NULL;  // custom header
-    char errorBuffer[CURL_ERROR_SIZE];
-    std::string curl_url;
-    std::string curl_params;
-    std::string curl_outstring;
-     
-    assigner->evaluate(m_url, curl_url, this);
+    std::string& curl_url = call.url;
+    std::string& curl_params = call.params;
+    std::string& curl_outstring = call.output;
+    std::string& memoKey = call.memoKey;
+    char *errorBuffer = call.errorBuffer;
+
+    assigner->evaluate(hedge && m_hedgeUrl.size() ? m_hedgeUrl : m_url, curl_url, this);
     if(m_params.length()) {
         assigner->evaluate(m_params, curl_params, this);
         if(m_method == HTTPGET) curl_url += curl_params; // concatenate GET-URL
     }
+
+    // the reply of a hedged request may come from either call, with the
+    // headers of the other one: not cached
+    const bool httpCacheable = m_method == HTTPGET && m_stream == STREAM_NONE && !m_hedgePercentile &&
+        httpCache.is_enabled();
+    if((get_cacheTTL() && !hedge) || httpCacheable) {
+        // everything the reply may depend on
+        memoKey = m_method == HTTPGET ? "GET" : "POST";
+        memoKey.push_back('\0');
+        memoKey.append(curl_url);
+        memoKey.push_back('\0');
+        if(m_method == HTTPPOST) memoKey.append(curl_params);
+        for(const auto &it : m_headers) {
+            memoKey.push_back('\0');
+            memoKey.append(it);
+        }
+        memoKey.push_back('\0');
+        memoKey.append(m_usercert);
+        if(httpCacheable) call.cacheKey = memoKey;
+        if(!get_cacheTTL() || hedge) memoKey.clear();
+    }
+
+    if(get_cacheTTL() && !hedge) {
+        if(stateCache.get(memoKey, curl_outstring)) return CALL_CACHED;
+        // the first child calls upstream, the others take its reply from the cache
+        if(call.flight.join(memoKey) && stateCache.get(memoKey, curl_outstring)) return CALL_CACHED;
+    }
+
+    // upstream cache: the fresh reply is taken, the stale one is revalidated
+    if(call.cacheKey.size() && httpCacheGet(call.cacheKey, call.cached, call.cachedBody)) {
+        if(call.cached.expires > time(nullptr)) {
+            curl_outstring.swap(call.cachedBody);
+            // the children waiting for the flight take it from the state cache
+            if(memoKey.size()) stateCache.put(memoKey, curl_outstring, get_cacheTTL());
+            return CALL_CACHED;
+        }
+        call.revalidate = call.cached.etag.size() || call.cached.lastModified.size();
+    }
     
-    curl_handle = curl_easy_init();
+    // the reply would come too late
+    long long timeout = m_timeout;
+    const long long left = deadlineLeft();
+    if(left != DEADLINE_NONE) {
+        if(left <= 0) {
+            log_warning("%s:%s:%d: request deadline is exceeded", get_scriptName().c_str(),
+                        get_stateName().c_str(), get_number());
+            return CALL_FAILED;
+        }
+        timeout = std::min(timeout, left);
+    }
+
+    if(m_stream == STREAM_FILE) {
+        // the file is replaced when the body is complete; opened before the
+        // circuit check, the call let through is not lost on a local error
+        call.spool = m_dumpfile + "." + boost::lexical_cast<std::string>(getpid());
+        call.fd = open(call.spool.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666);
+        if(call.fd < 0) {
+            log_warning("%s:%s:%d: %s: %s", get_scriptName().c_str(), get_stateName().c_str(),
+                        get_number(), call.spool.c_str(), strerror(errno));
+            return CALL_FAILED;
+        }
+    }
+
+    // the upstream is down: no time is spent on it
+    if(!circuitBreaker.allow(curl_url)) {
+        log_debug("%s:%s:%d: %s: circuit is open", get_scriptName().c_str(),
+                  get_stateName().c_str(), get_number(), curl_url.c_str());
+        if(!call.revalidate) return CALL_FAILED;
+        // the stale reply is better than none
+        curl_outstring.swap(call.cachedBody);
+        return CALL_CACHED;
+    }
+    call.admitted = true;
+
+    // reused handle keeps the connection and TLS session of the upstream
+    curl_handle = call.handle = curlPool.acquire(curl_url);
     
     if(!curl_handle) {
         log_warning("%s:%s:%d: libCURL: error creating connection",
                     get_scriptName().c_str(), get_stateName().c_str(), get_number());
-        return get_errorState();
+        return CALL_FAILED;
     }
     
     rc = curl_easy_setopt(curl_handle, CURLOPT_ERRORBUFFER, errorBuffer);
@@ -172,6 +402,18 @@ int CHttpState::execute(const FCGX_Request *request, CAssigner* assigner) {
         log_error("%s:%s:%d: libCURL: error setting errorBuffer", get_scriptName().c_str(),
                   get_stateName().c_str(), get_number());
     
+    curl_easy_setopt(curl_handle, CURLOPT_TIMEOUT_MS, (long)timeout);
+    curl_easy_setopt(curl_handle, CURLOPT_CONNECTTIMEOUT_MS, (long)std::min((long long)m_connectTimeout, timeout));
+
+    // all the encodings libcurl is built with, the body is decoded before the writer
+    if(m_compress) curl_easy_setopt(curl_handle, CURLOPT_ACCEPT_ENCODING, "");
+    if(m_http2) {
+        // ALPN for https, HTTP/1.1 for http; parallel calls wait for the
+        // connection to multiplex on it instead of opening their own
+        curl_easy_setopt(curl_handle, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(curl_handle, CURLOPT_PIPEWAIT, 1L);
+    }
+
     rc = curl_easy_setopt(curl_handle, CURLOPT_URL, curl_url.c_str());
     if(rc != CURLE_OK)
         log_error("%s:%s:%d: libCURL: error setting URL: %s", get_scriptName().c_str(),
@@ -185,22 +427,39 @@ int CHttpState::execute(const FCGX_Request *request, CAssigner* assigner) {
                       get_number(), errorBuffer);
     }
     
-    rc = curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, curlWriter);
+    rc = m_stream == STREAM_NONE ?
+        curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, curlWriter) :
+        curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, streamWriter);
     if(rc != CURLE_OK)
         log_error("%s:%s:%d: libCURL: error setting writer: %s",
                   get_scriptName().c_str(), get_stateName().c_str(),
                   get_number(), errorBuffer);
     
-    rc = curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, &curl_outstring);
+    rc = m_stream == STREAM_NONE ?
+        curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, &curl_outstring) :
+        curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, &call);
     if(rc != CURLE_OK)
         log_error("%s:%s:%d: libCURL: error setting output string: %s",
                   get_scriptName().c_str(), get_stateName().c_str(),
                   get_number(), errorBuffer);
 
+    call.capture = m_capture;
+
+    if(call.cacheKey.size() || call.client) {
+        curl_easy_setopt(curl_handle, CURLOPT_HEADERFUNCTION, headerWriter);
+        curl_easy_setopt(curl_handle, CURLOPT_HEADERDATA, &call);
+    }
+
     // set custom header
-    if(m_headers.size() > 0) {
-        for(const auto &it : m_headers) chunk = curl_slist_append(chunk, it.c_str());
-        rc = curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, chunk);
+    if(call.revalidate) {
+        if(call.cached.etag.size())
+            call.headers = curl_slist_append(call.headers, ("If-None-Match: " + call.cached.etag).c_str());
+        if(call.cached.lastModified.size())
+            call.headers = curl_slist_append(call.headers, ("If-Modified-Since: " + call.cached.lastModified).c_str());
+    }
+    if(m_headers.size() > 0 || call.headers) {
+        for(const auto &it : m_headers) call.headers = curl_slist_append(call.headers, it.c_str());
+        rc = curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, call.headers);
         if(rc != CURLE_OK)
             log_error("%s:%s:%d: libCURL: error setting custom HTTP headers: %s",
                       get_scriptName().c_str(), get_stateName().c_str(),
@@ -215,21 +474,21 @@ int CHttpState::execute(const FCGX_Request *request, CAssigner* assigner) {
                 log_error("%s:%s:%d: libCURL: error setting user' certificate encoding: %s",
                           get_scriptName().c_str(), get_stateName().c_str(),
                           get_number(), errorBuffer);
-            rc = curl_easy_setopt(curl_handle, CURLOPT_SSLCERT, m_usercert.c_str());
+            rc = curlPool.setFile(curl_handle, CURLOPT_SSLCERT, m_usercert);
             if(rc != CURLE_OK)
                 log_error("%s:%s:%d: libCURL: error setting user' certificate: %s",
                           get_scriptName().c_str(), get_stateName().c_str(),
                           get_number(), errorBuffer);
         }
         if(m_cacert.size()) {
-            rc = curl_easy_setopt(curl_handle, CURLOPT_CAINFO, m_cacert.c_str());
+            rc = curlPool.setFile(curl_handle, CURLOPT_CAINFO, m_cacert);
             if(rc != CURLE_OK)
                 log_error("%s:%s:%d: libCURL: error setting CA certificate: %s",
                           get_scriptName().c_str(), get_stateName().c_str(),
                           get_number(), errorBuffer);
         }
         if(m_pkey.size()) {
-            rc = curl_easy_setopt(curl_handle, CURLOPT_SSLKEY, m_pkey.c_str());
+            rc = curlPool.setFile(curl_handle, CURLOPT_SSLKEY, m_pkey);
             if(rc != CURLE_OK)
                 log_error("%s:%s:%d: libCURL: error setting private key: %s",
                           get_scriptName().c_str(), get_stateName().c_str(),
@@ -244,31 +503,176 @@ int CHttpState::execute(const FCGX_Request *request, CAssigner* assigner) {
         }
     }
     
-    rc = curl_easy_perform(curl_handle);
-
-    if(chunk) curl_slist_free_all(chunk);
-    curl_easy_cleanup(curl_handle);
+    return CALL_READY;
+}
 
+/**
+ * @fn bool CHttpState::finishCall(CAssigner* assigner, httpCall_t& call, int rc)
+ * @brief the transfer is over: memoizes and stores the reply
+ * @param rc -- CURLcode of the transfer
+ * @return false if the transfer failed, nothing is stored
+ */
+bool CHttpState::finishCall(CAssigner* assigner, httpCall_t& call, int rc) {
+    if(rc == CURLE_OK) curl_easy_getinfo(call.handle, CURLINFO_RESPONSE_CODE, &call.httpcode);
+    circuitBreaker.record(call.url, rc == CURLE_OK && call.httpcode < 500);
+    call.admitted = false;
     if(rc != CURLE_OK) {
         log_warning("%s:%s:%d: libCURL: error processing request: %s",
                     get_scriptName().c_str(), get_stateName().c_str(),
-                    get_number(), errorBuffer);
-        return get_errorState();
+                    get_number(), call.errorBuffer[0] ? call.errorBuffer : curl_easy_strerror((CURLcode)rc));
+        return false;
     }
-    
-    assigner->assignLocal(m_outputvar, curl_outstring.c_str());
 
-    if(m_dumpflag) {
-        std::ofstream thefile(m_dumpfile.c_str());
-        if(thefile.is_open()) {
-            thefile << curl_outstring;
-            thefile.close();
+    if(call.fd >= 0) {
+        const bool complete = call.httpcode < 400;
+        close(call.fd);
+        call.fd = -1;
+        if(!complete || rename(call.spool.c_str(), m_dumpfile.c_str())) {
+            if(complete)
+                log_warning("%s:%s:%d: %s: dump error: %s", get_scriptName().c_str(), get_stateName().c_str(),
+                            get_number(), m_dumpfile.c_str(), strerror(errno));
+            unlink(call.spool.c_str());
         }
-        else log_warning("%s:%s:%d: %s: dump error",
-                         get_scriptName().c_str(), get_stateName().c_str(),
-                         get_number(), m_dumpfile.c_str());
     }
-    
-    return get_nextState();
+
+    if(call.cacheKey.size()) {
+        if(call.httpcode == 304 && call.revalidate) {
+            // not modified: the cached body is the reply
+            log_debug("%s:%s:%d: %s: not modified", get_scriptName().c_str(), get_stateName().c_str(),
+                      get_number(), call.url.c_str());
+            call.output.swap(call.cachedBody);
+            call.httpcode = 200;
+            if(httpCacheControl(call.replyHeaders, call.cached))
+                httpCachePut(call.cacheKey, call.cached, call.output, true);
+        }
+        else if(call.httpcode == 200) {
+            httpCacheEntry_t entry;
+            if(httpCacheControl(call.replyHeaders, entry)) httpCachePut(call.cacheKey, entry, call.output);
+        }
+    }
+
+    // error pages are not memoized
+    if(call.memoKey.length() && call.httpcode >= 200 && call.httpcode < 300)
+        stateCache.put(call.memoKey, call.output, get_cacheTTL());
+    setOutput(assigner, call.output);
+    return true;
+}
+
+void CHttpState::addLatency(long ms) {
+    if(m_latency.size() < HEDGE_WINDOW) m_latency.push_back(ms);
+    else m_latency[m_latencyNext] = ms;
+    m_latencyNext = (m_latencyNext + 1) % HEDGE_WINDOW;
+}
+
+// ms to wait for the first call, -1 if there is not enough calls to tell
+long CHttpState::hedgeDelay() {
+    if(m_latency.size() < HEDGE_SAMPLES) return -1;
+    std::vector<long> sorted(m_latency);
+    const size_t n = sorted.size() * m_hedgePercentile / 100;
+    std::nth_element(sorted.begin(), sorted.begin() + n, sorted.end());
+    return sorted[n];
+}
+
+/**
+ * @fn int CHttpState::hedgedPerform(CAssigner* assigner, httpCall_t& call)
+ * @brief runs the call and, if it is not over in the hedge delay, the
+ *        second one to the hedge url; the first successful reply is taken
+ *        and the other call is cancelled. The latency of the first call is
+ *        recorded, the cancelled one counts as long as it was waited for
+ * @return CURLcode of the call taken
+ */
+int CHttpState::hedgedPerform(CAssigner* assigner, httpCall_t& call) {
+    const long delay = hedgeDelay();
+    CURLM *multi = curlPool.multi();
+    const long long start = monotonicMs();
+    if(delay < 0 || !multi || curl_multi_add_handle(multi, call.handle) != CURLM_OK) {
+        const CURLcode rc = curl_easy_perform(call.handle);
+        if(rc == CURLE_OK) addLatency(monotonicMs() - start);
+        return rc;
+    }
+
+    httpCall_t hedge;
+    bool callRunning = true, hedgeRunning = false, hedged = false, hedgeOver = false;
+    int rc = CURLE_OK, hedgeRc = CURLE_OK;
+    bool winner = false;              // true - the hedged call has won
+
+    while(callRunning || hedgeRunning) {
+        int active = 0, msgs = 0;
+        CURLMsg *msg;
+        curl_multi_perform(multi, &active);
+        while((msg = curl_multi_info_read(multi, &msgs))) {
+            if(msg->msg != CURLMSG_DONE) continue;
+            curl_multi_remove_handle(multi, msg->easy_handle);
+            if(msg->easy_handle == call.handle) {
+                callRunning = false;
+                rc = msg->data.result;
+                if(rc == CURLE_OK) addLatency(monotonicMs() - start);
+            }
+            else {
+                hedgeRunning = false;
+                hedgeOver = true;
+                hedgeRc = msg->data.result;
+            }
+        }
+        // the first successful reply, the first call if both are over
+        if(!callRunning && rc == CURLE_OK) break;
+        if(hedgeOver && hedgeRc == CURLE_OK) {
+            winner = true;
+            break;
+        }
+
+        const long long elapsed = monotonicMs() - start;
+        if(!hedged && callRunning && elapsed >= delay) {
+            hedged = true;
+            if(startCall(assigner, hedge, true) == CALL_READY &&
+               curl_multi_add_handle(multi, hedge.handle) == CURLM_OK) {
+                hedgeRunning = true;
+                log_debug("%s:%s:%d: hedged call after %lld ms", get_scriptName().c_str(),
+                          get_stateName().c_str(), get_number(), elapsed);
+            }
+        }
+        if(callRunning || hedgeRunning)
+            curl_multi_wait(multi, nullptr, 0, hedged ? HEDGE_POLL : (int)std::max(1LL, delay - elapsed), nullptr);
+    }
+
+    // the loser is cancelled, the handles go back to the pool with the calls
+    if(callRunning) {
+        curl_multi_remove_handle(multi, call.handle);
+        addLatency(monotonicMs() - start);
+    }
+    if(hedgeRunning) curl_multi_remove_handle(multi, hedge.handle);
+    // a failed hedge is an outcome of its url, not a cancelled call
+    if(hedgeOver && hedgeRc != CURLE_OK) {
+        circuitBreaker.record(hedge.url, false);
+        hedge.admitted = false;
+    }
+
+    if(winner) {
+        if(!callRunning) {
+            circuitBreaker.record(call.url, false);
+            call.admitted = false;
+        }
+        // the reply is taken as of the first call and memoized by its key
+        std::swap(call.handle, hedge.handle);
+        std::swap(call.headers, hedge.headers);
+        std::swap(call.admitted, hedge.admitted);
+        call.url.swap(hedge.url);
+        call.output.swap(hedge.output);
+        memcpy(call.errorBuffer, hedge.errorBuffer, CURL_ERROR_SIZE);
+        curl_easy_setopt(call.handle, CURLOPT_ERRORBUFFER, call.errorBuffer);
+        return hedgeRc;
+    }
+    return rc;
+}
+
+int CHttpState::execute(const FCGX_Request *request, CAssigner* assigner) {
+    httpCall_t call;                  // the handle goes back to the pool on every return
+    if(m_stream == STREAM_CLIENT) call.client = request->out;
+    switch(startCall(assigner, call)) {
+    case CALL_CACHED: return setOutput(assigner, call.output);
+    case CALL_FAILED: return get_errorState();
+    }
+    int rc = m_hedgePercentile ? hedgedPerform(assigner, call) : curl_easy_perform(call.handle);
+    return finishCall(assigner, call, rc) ? get_nextState() : get_errorState();
 }
 
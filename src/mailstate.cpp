@@ -17,6 +17,7 @@
 #include "parser.hpp"
 #include "cassigner.hpp"
 #include "apputils.hpp"
+#include "aio.hpp"
 
 namespace pt = boost::property_tree;
 extern pt::ptree *cpt;                       // property tree: global configuration
@@ -154,6 +155,13 @@ int CMailState::execute(const FCGX_Request *request, CAssigner* assigner) {
     std::string mxFrom;
     std::string mxTo;
     std::string mxCC;
+
+    // attachments may be written by this request
+    if(ioBatch.submit()) {
+        log_warning("%s:%s:%d: files of the request are not written", get_scriptName().c_str(),
+                    get_stateName().c_str(), get_number());
+        return get_errorState();
+    }
     
     struct curl_slist *recipients = NULL;
     
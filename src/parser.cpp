@@ -27,6 +27,7 @@ extern const char *assmnt_error;
 extern const char *rexfileName;      // regex library
 
 static CRegexCollection *rexCollection = nullptr;      // result of rexfileName processing
+std::set<std::string> assignedGlobals;
 
 /* different parsing utilities */
 
@@ -250,6 +251,7 @@ assignmentList_t* parseAssignment(const std::string& line,
         newlist->push_back(strval);
     }
     else throw parser_error(file, syntax_error, counter);
+    if(newlist->front()[0] == '&') assignedGlobals.insert(newlist->front());
     return newlist;
 }
 
@@ -308,6 +310,12 @@ stateMap_t* parseScript(const std::string& file) {
             else IF_STATE("shell_state", CShellState)
             else IF_STATE("struct_state", CStructureState)
             else IF_STATE("goto_state", CGotoState)
+            else IF_STATE("flush_state", CFlushState)
+            else IF_STATE("fetch_state", CFetchState)
+            else IF_STATE("transaction_state", CTransactionState)
+            else IF_STATE("batch_state", CBatchState)
+            else IF_STATE("write_state", CWriteState)
+            else IF_STATE("fanout_state", CFanoutState)
             else throw parser_error(file, syntax_error, counter);
         }
         else {
@@ -3,9 +3,14 @@
 #include <sys/wait.h>
 #include <sys/file.h>
 #include <sys/mman.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <csignal>
 #include <cstring>
 #include <cerrno>
+#include <deque>
+#include <algorithm>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/split.hpp>
@@ -19,6 +24,17 @@
 #include "preforked.hpp"
 #include "database.hpp"
 #include "http.hpp"
+#include "httpd.hpp"
+#include "aio.hpp"
+#include "respcache.hpp"
+#include "statecache.hpp"
+#include "singleflight.hpp"
+#include "copybuffer.hpp"
+#include "cachelistener.hpp"
+#include "curlpool.hpp"
+#include "deadline.hpp"
+#include "circuitbreaker.hpp"
+#include "httpcache.hpp"
 
 namespace pt = boost::property_tree;
 extern pt::ptree *cpt;                       // property tree: global configuration
@@ -45,6 +61,16 @@ static char shr_lockfile[] = "/tmp/appshrd.XXXXXX";
 static int  tmp_lockfd;
 static int  shr_lockfd;
 static int  fcgi_socket;
+static int  http_socket = -1;
+
+// dispatcher mode: master accepts connections and passes them to the idle children
+static bool dispatcher = false;
+static int  chanfd[CHILDREN_HARDLIMIT];      // master ends of the children channels
+static bool childIdle[CHILDREN_HARDLIMIT];   // child reported it is ready (master side)
+static unsigned long long lastServed[CHILDREN_HARDLIMIT]; // dispatch number of the last connection passed, 0 - none
+static unsigned long long dispatched = 0;   // connections passed to the children
+static int  child_chan = -1;                 // child end of the channel
+static int  child_slot = -1;                 // child slot number
 
 // RAII-style scoped file lock-unlock
 class CScopedFLock {
@@ -85,7 +111,13 @@ static void sigterm_handler_parent(int sig) {
 
 extern void freeAllScripts();
 
+volatile static bool childKilled = false;     // SIGTERM, the child exits from the handler
+
 void child_atexit_handler() {
+    // the rows buffered by the write states, no COPY from the signal handler
+    if(childKilled) closeCopyBuffers();
+    else flushCopyBuffers(true);
+    curlPool.cleanup();
     freeAllScripts();
     freeRegexCollection();
     delete cpt;
@@ -95,6 +127,7 @@ void child_atexit_handler() {
 }
 
 static void sigterm_handler_child(int sig) {   
+    childKilled = true;
     log_debug("%d: %d killed", sig, getpid());
     exit(0);
 }
@@ -113,12 +146,219 @@ extern inline void setSlotState(int num, slotstate_t state) {
     pslots[num].childsts = state;
 }
 
+// FNV-1a, script name hash for the dispatcher affinity
+static unsigned scriptHash(const char *name, size_t len) {
+    unsigned h = 2166136261u;
+    for(size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static CAssigner *assigner = nullptr;   // symbol table of the child
+static char *params = nullptr;          // CGI parameters buffer
+static std::string scriptSelector;      // variable name to define script name to run
+static unsigned requestDeadline = 0;    // ms, budget of the request
+
+/**
+ * @fn static void dispatchRequest(FCGX_Request *request)
+ * @brief parses CGI parameters and runs the script requested. Front end independent:
+ *        the request is either FastCGI one or translated by the native HTTP front end
+ * @param request -- request to process
+ */
+static void dispatchRequest(FCGX_Request *request) {
+    FCGX_Stream *realOut = request->out;      // output stream of the front end
+    CCaptureStream *capture = nullptr;        // reply capture for the response cache
+    const respCacheRule_t *cacheRule = nullptr;
+    std::string cacheKey("");
+    bool cacheStore = false;
+
+    // parse QUERY_STRING
+    // 1. Copy QUERY_STRING to the params buffer
+    bzero(params, PARAMBUF_LENGTH*sizeof(char));
+    httpReply.reset();
+
+    const char *request_method  = FCGX_GetParam("REQUEST_METHOD", request->envp);
+    const char *query_string = nullptr;
+    const char *content_length  = FCGX_GetParam("CONTENT_LENGTH", request->envp);
+    int paramlen = 0;
+
+    if(request_method && strncasecmp(request_method, "GET", 3) == 0) {
+        query_string = FCGX_GetParam("QUERY_STRING", request->envp);
+        if(query_string) paramlen = strlen(query_string);
+    }
+    else if(request_method && strncasecmp(request_method, "POST", 4) == 0) {
+        if(content_length && strlen(content_length) > 0)
+            paramlen = boost::lexical_cast<int>(content_length);
+        if(paramlen) {
+            if(paramlen > PARAMBUF_LENGTH-1) paramlen = PARAMBUF_LENGTH-1;
+            FCGX_GetStr(params, paramlen, request->in);
+            query_string = params;
+        }
+    }
+    if(!paramlen) {
+        httpReply.sendStatus(request->out, 404);
+        log_warning("No CGI parameters passed: nothing to do!");
+        return;
+    }
+    deadlineStart(requestDeadline);
+
+    { // 2. split params buffer
+        std::vector<std::string> splitted;
+        std::string paramstr(query_string);
+        paramstr = urlDecode(paramstr);
+        boost::split(splitted, paramstr, boost::is_any_of("&"));
+        for(unsigned int i = 0; i < splitted.size(); i++) {
+            std::string::size_type n = splitted[i].find("=");
+            if(n != std::string::npos) {
+                std::string lval("@0.");
+                lval += splitted[i].substr(0, n);
+                std::string rval = splitted[i].substr(n+1);
+                assigner->assignLocal(lval, strdup(rval.c_str()));
+            }
+        }
+    }
+
+    // store all CGI environment variable as local variables of state 0
+    for(int i = 0; request->envp[i]; i++) {
+        strncpy(params, request->envp[i], PARAMBUF_LENGTH*sizeof(char));
+        char *rval = strstr(params, "=");
+        if(rval) {
+            std::string lval = "@0.";
+            *rval = '\0';
+            lval += params;
+            assigner->assignLocal(lval, strdup(rval+1));
+        }
+    }
+
+    char *scriptName = assigner->getLocalPtr(scriptSelector);
+    if(scriptName) {
+        log_message("%s requested", scriptName);
+        // the slot is written by this child only, master reads it for affinity
+        pslots[child_slot].scripthash = scriptHash(scriptName, strlen(scriptName));
+        int nextState;
+        stateMap_t *script; // current script to execute
+        //  e_it - <scriptName, entryPoint> -- entry point of current script
+        const auto e_it = scriptEntries.find(scriptName);
+        if(e_it != scriptEntries.end()) nextState = e_it->second;
+        else {
+            log_warning("%s: entry point not found", scriptName);
+            httpReply.sendStatus(request->out, 404);
+            goto r_finish;
+        }
+        // s_it - <scriptName, parsed script state map> 
+        const auto s_it = allScripts.find(scriptName);
+        if(s_it != allScripts.end()) script = s_it->second;
+        else {
+            log_warning("%s: script not found", scriptName);
+            httpReply.sendStatus(request->out, 404);
+            goto r_finish;
+        }
+
+        // the whole reply may be cached already; other methods have side effects,
+        // the script must run
+        const bool cacheable = request_method &&
+            (strcasecmp(request_method, "GET") == 0 || strcasecmp(request_method, "HEAD") == 0);
+        cacheRule = cacheable ? respCacheRule(scriptName) : nullptr;
+        if(cacheRule) {
+            std::string reply("");
+            cacheKey = respCacheKey(scriptName, cacheRule, assigner);
+            if(respCache.get(cacheKey, reply)) {
+                // conditional GET against the validators of the stored reply
+                const std::string etag = respCacheHeader(reply, "ETag");
+                const std::string lastmod = respCacheHeader(reply, "Last-Modified");
+                if(HTTPnotModified(request->envp, etag, lastmod.length() ? HTTPparseDate(lastmod.c_str()) : 0)) {
+                    if(etag.length()) httpReply.addHeader("ETag: " + etag);
+                    if(lastmod.length()) httpReply.addHeader("Last-Modified: " + lastmod);
+                    httpReply.sendStatus(request->out, 304);
+                    log_message("%s: cached reply, not modified", scriptName);
+                    goto r_finish;
+                }
+                httpReply.set_sent(); // the header block is a part of the cached reply
+                FCGX_PutStr(reply.data(), reply.size(), request->out);
+                log_message("%s: cached reply", scriptName);
+                goto r_finish;
+            }
+            capture = new CCaptureStream(realOut, cacheRule->maxsize);
+            request->out = capture->stream();
+        }
+
+        // the reply header is sent by the first state producing output
+        // (end or flush), so the script may change it until then
+        // here are the _most_valuable_ten_strings_in_the_program_
+        do {
+            // sit - <stateNum, CState*> -- current state
+            const auto sit = script->find(nextState);
+            if(sit == script->end()) {
+                log_warning("Script %s: failed to find state %d", scriptName, nextState);
+                httpReply.sendStatus(request->out, 500);
+                goto r_finish;
+            }
+            nextState = sit->second->execute(request, assigner);
+        } while(nextState != ENDSTATE);
+        httpReply.send(request->out);
+        cacheStore = httpReply.get_status() == 200;
+        log_message("%s: finished", scriptName);
+    }
+    else {
+        httpReply.sendStatus(request->out, 404);
+    }
+
+r_finish:
+    assigner->landFlights(); // before the buffered rows are copied
+    if(capture) {
+        capture->finish();
+        request->out = realOut;
+        if(cacheStore && capture->is_complete()) respCache.put(cacheKey, capture->get_data(), cacheRule->ttl);
+        delete capture;
+    }
+    deadlineStop();
+    finishDBs();       // cursors left open by the script
+    flushCopyBuffers(false);
+    assigner->resetTable();
+}
+
+/**
+ * @fn static int acceptHttp()
+ * @brief waits for a connection on both FastCGI and HTTP sockets. Called under
+ *        the accept lock, so the connection is ours when poll(2) returns.
+ * @return accepted HTTP connection or -1 if FastCGI connection is pending
+ */
+static int acceptHttp() {
+    struct pollfd pfd[2];
+    int n = 0;
+    if(fcgi_socket >= 0) {
+        pfd[n].fd = fcgi_socket;
+        pfd[n++].events = POLLIN;
+    }
+    pfd[n].fd = http_socket;
+    pfd[n++].events = POLLIN;
+    while(1) {
+        if(poll(pfd, n, -1) < 0) {
+            if(errno == EINTR) continue;
+            log_error("%s: poll failed: %s", __func__, strerror(errno));
+        }
+        if(pfd[n-1].revents & POLLIN) {
+            int fd = accept(http_socket, nullptr, nullptr);
+            if(fd >= 0) return fd;
+        }
+        else if(fcgi_socket >= 0) return -1; // FastCGI connection is pending
+    }
+}
+
 static int processRequest(int child_number) {
     int rv = 0;
     FCGX_Request request;
-    CAssigner *assigner = 0;
-    char *params = new char[PARAMBUF_LENGTH];
-    const std::string scriptSelector = cpt->get<std::string>("common.scriptselector", "@0.function");
+    const int keepalive = cpt->get<int>("common.http_keepalive", HTTP_KEEPALIVE);
+    const int maxrequests = cpt->get<int>("common.http_maxrequests", HTTP_MAXREQUESTS);
+
+    char tag;
+
+    child_slot = child_number;
+    params = new char[PARAMBUF_LENGTH];
+    scriptSelector = cpt->get<std::string>("common.scriptselector", "@0.function");
+    requestDeadline = cpt->get<unsigned>("common.deadline", 0);
 
     atexit(child_atexit_handler);
     setHandler(SIGTERM, sigterm_handler_child);
@@ -161,128 +401,75 @@ static int processRequest(int child_number) {
         pslots[child_number].childpid = getpid();
     }
     
-    rv = FCGX_InitRequest(&request, fcgi_socket, 0);
-    if(rv) log_error("%s:%d: FCGX_InitRequest error: %s", __func__, child_number, strerror(rv));
+    // in dispatcher mode children do not accept, so FastCGI request has no listen socket
+    if(fcgi_socket >= 0) {
+        rv = FCGX_InitRequest(&request, dispatcher ? -1 : fcgi_socket, 0);
+        if(rv) log_error("%s:%d: FCGX_InitRequest error: %s", __func__, child_number, strerror(rv));
+    }
 
     // initialize libcurl
     curl_global_init(CURL_GLOBAL_ALL);
+    curlPool.init();
+
+    // batched I/O, the ring is per process
+    ioBatch.init(cpt->get<bool>("common.io_uring", true));
 
     log_debug("%s:%d: child started", __func__, child_number);
 
     setSlotState(child_number, ST_IDLE);
 
+    if(dispatcher) {
+        tag = CHILD_READY;
+        if(write(child_chan, &tag, 1) < 0) log_error("%s:%d: channel error: %s", __func__, child_number, strerror(errno));
+    }
+
+    while(dispatcher) {
+        int fd = recvFd(child_chan, &tag);
+        if(fd < 0) {
+            if(errno == 0) exit(0); // master is gone
+            log_warning("%s:%d: recvFd error: %s", __func__, child_number, strerror(errno));
+            continue;
+        }
+        setSlotState(child_number, ST_BUSY);
+        if(tag == FRONTEND_HTTP) httpServeConnection(fd, dispatchRequest, keepalive, maxrequests);
+        else {
+            // the connection is accepted already: FCGX_Accept_r skips accept(2)
+            // if ipcFd is set, keepConnection prevents it from closing ipcFd
+            // in the FCGX_Finish_r of the previous request
+            request.keepConnection = 1;
+            request.ipcFd = fd;
+            while(FCGX_Accept_r(&request) == 0) {
+                dispatchRequest(&request);
+                ioBatch.submit();
+                FCGX_Finish_r(&request);
+                if(request.ipcFd < 0) break; // web server does not keep connection
+            }
+        }
+        setSlotState(child_number, ST_IDLE);
+        tag = CHILD_READY;
+        if(write(child_chan, &tag, 1) < 0) exit(0);
+    }
+
     while(1) {
+        int httpfd = -1;
         {
             CScopedFLock fl(tmp_lockfd);
-            rv = FCGX_Accept_r(&request);
+            if(http_socket >= 0) httpfd = acceptHttp();
+            if(httpfd < 0) rv = FCGX_Accept_r(&request);
             setSlotState(child_number, ST_BUSY);
         }
-        
-        if(rv) log_error("%s:%d: FCGX_Accept_r error: %s", __func__, child_number, strerror(rv));
 
-        // parse QUERY_STRING
-        // 1. Copy QUERY_STRING to the params buffer
-        bzero(params, PARAMBUF_LENGTH*sizeof(char));
-
-        const char *request_method  = FCGX_GetParam("REQUEST_METHOD", request.envp);
-        const char *server_protocol = FCGX_GetParam("SERVER_PROTOCOL", request.envp);
-        const char *query_string;
-        const char *content_length  = FCGX_GetParam("CONTENT_LENGTH", request.envp);
-        int paramlen = 0;
-
-        if(strncasecmp(request_method, "GET", 3) == 0) {
-            query_string = FCGX_GetParam("QUERY_STRING", request.envp);
-            if(query_string) paramlen = strlen(query_string);
-        }
-        else if(strncasecmp(request_method, "POST", 4) == 0) {
-            if(content_length && strlen(content_length) > 0)
-                paramlen = boost::lexical_cast<int>(content_length);
-            if(paramlen) {
-                if(paramlen > PARAMBUF_LENGTH-1) paramlen = PARAMBUF_LENGTH-1;
-                FCGX_GetStr(params, paramlen, request.in);
-                query_string = params;
-            }
-        }
-        if(!paramlen) {
-            FCGX_PutS(HTTPstatus(server_protocol, 404, params, PARAMBUF_LENGTH*sizeof(char)), request.out);
-            log_warning("No CGI parameters passed: nothing to do!");
-            FCGX_Finish_r(&request);
+        if(httpfd >= 0) {
+            httpServeConnection(httpfd, dispatchRequest, keepalive, maxrequests);
             setSlotState(child_number, ST_IDLE);
             continue;
         }
 
-        { // 2. split params buffer
-            std::vector<std::string> splitted;
-            std::string paramstr(query_string);
-            paramstr = urlDecode(paramstr);
-            boost::split(splitted, paramstr, boost::is_any_of("&"));
-            for(unsigned int i = 0; i < splitted.size(); i++) {
-                std::string::size_type n = splitted[i].find("=");
-                if(n != std::string::npos) {
-                    std::string lval("@0.");
-                    lval += splitted[i].substr(0, n);
-                    std::string rval = splitted[i].substr(n+1);
-                    assigner->assignLocal(lval, strdup(rval.c_str()));
-                }
-            }
-        }
-
-        // store all CGI environment variable as local variables of state 0
-        for(int i = 0; request.envp[i]; i++) {
-            strncpy(params, request.envp[i], PARAMBUF_LENGTH*sizeof(char));
-            char *rval = strstr(params, "=");
-            if(rval) {
-                std::string lval = "@0.";
-                *rval = '\0';
-                lval += params;
-                assigner->assignLocal(lval, strdup(rval+1));
-            }
-        }
-
-        char *scriptName = assigner->getLocalPtr(scriptSelector);
-        if(scriptName) {
-            log_message("%s requested", scriptName);
-            int nextState;
-            stateMap_t *script; // current script to execute
-            //  e_it - <scriptName, entryPoint> -- entry point of current script
-            const auto e_it = scriptEntries.find(scriptName);
-            if(e_it != scriptEntries.end()) nextState = e_it->second;
-            else {
-                log_warning("%s: entry point not found", scriptName);
-                FCGX_PutS(HTTPstatus(server_protocol, 404, params, PARAMBUF_LENGTH*sizeof(char)),
-                          request.out);
-                goto r_finish;
-            }
-            // s_it - <scriptName, parsed script state map> 
-            const auto s_it = allScripts.find(scriptName);
-            if(s_it != allScripts.end()) script = s_it->second;
-            else {
-                log_warning("%s: script not found", scriptName);
-                FCGX_PutS(HTTPstatus(server_protocol, 404, params, PARAMBUF_LENGTH*sizeof(char)), request.out);
-                goto r_finish;
-            }
-
-            FCGX_PutS("Content-type: text/html\r\n\r\n", request.out);
-            // here are the _most_valuable_ten_strings_in_the_program_
-            do {
-                // sit - <stateNum, CState*> -- current state
-                const auto sit = script->find(nextState);
-                if(sit == script->end()) {
-                    log_warning("Script %s: failed to find state %d", scriptName, nextState);
-                    FCGX_PutS(HTTPstatus(server_protocol, 500, params, PARAMBUF_LENGTH*sizeof(char)), request.out);
-                    goto r_finish;
-                }
-                nextState = sit->second->execute(&request, assigner);
-            } while(nextState != ENDSTATE);
-            log_message("%s: finished", scriptName);
-        }
-        else {
-            FCGX_PutS(HTTPstatus(server_protocol, 404, params, PARAMBUF_LENGTH*sizeof(char)), request.out);
-        }
+        if(rv) log_error("%s:%d: FCGX_Accept_r error: %s", __func__, child_number, strerror(rv));
 
-r_finish:
+        dispatchRequest(&request);
+        ioBatch.submit(); // files are written before the reply is sent
         FCGX_Finish_r(&request);
-        assigner->resetTable();
         setSlotState(child_number, ST_IDLE);
     }
     curl_global_cleanup();
@@ -296,9 +483,33 @@ static inline bool procRunning(pid_t pid) {
 }
 
 static inline void forkChild(int num) {
+    int chan[2];
+    if(dispatcher) {
+        if(chanfd[num] >= 0) close(chanfd[num]); // the previous child of this slot
+        chanfd[num] = -1;
+        childIdle[num] = false;
+        lastServed[num] = 0;
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, chan) < 0) {
+            log_warning("%s: socketpair failed: %s", __func__, strerror(errno));
+            return;
+        }
+    }
     int rv = fork();
-    if(rv == 0) processRequest(num);
-    else if(rv > 0) children_running++;
+    if(rv == 0) {
+        if(dispatcher) {
+            for(int i = 0; i < CHILDREN_HARDLIMIT; i++) if(chanfd[i] >= 0) close(chanfd[i]);
+            close(chan[0]);
+            child_chan = chan[1];
+        }
+        processRequest(num);
+    }
+    else if(rv > 0) {
+        children_running++;
+        if(dispatcher) {
+            close(chan[1]);
+            chanfd[num] = chan[0];
+        }
+    }
     else log_error("%s: fork failed: %s", __func__, strerror(errno));
 }
 
@@ -343,6 +554,179 @@ static bool needFork() {
     return threshold > FORK_THRESHOLD;
 }
 
+// periodic master work: children pool size and the statistics
+static void housekeeping() {
+    static time_t lastStats = time(nullptr);
+    if(needFork()) forkChildren();
+    cacheListener.check();
+    if(time(nullptr) - lastStats >= STATS_INTERVAL) {
+        lastStats = time(nullptr);
+        respCache.logStats();
+        stateCache.logStats();
+        httpCache.logStats();
+        httpCachePrune();
+        singleFlight.logStats();
+        cacheListener.logStats();
+        circuitBreaker.logStats();
+        logDBStats();
+    }
+}
+
+// *********************************************************************
+// *** dispatcher mode
+// *********************************************************************
+
+struct pending_t {       // connection accepted by master, not passed to a child yet
+    int fd;
+    char frontend;       // FRONTEND_FCGI or FRONTEND_HTTP
+    unsigned scripthash; // 0 if the script name is not found in the first bytes
+};
+
+static std::deque<pending_t> pendingQueue;
+static std::string selectorParam; // "function" for "@0.function" script selector
+
+/**
+ * @fn static unsigned peekScript(int fd)
+ * @brief looks for the script selector parameter in the first bytes of request.
+ *        For HTTP it is a part of request line, for FastCGI it is a part of
+ *        QUERY_STRING in FCGI_PARAMS record. POST parameters are not seen.
+ * @return script name hash or 0
+ */
+static unsigned peekScript(int fd) {
+    static const char qstring[] = "QUERY_STRING";
+    char buf[PARAMBUF_LENGTH];
+    ssize_t n = recv(fd, buf, sizeof(buf), MSG_PEEK|MSG_DONTWAIT);
+    if(n <= 0 || selectorParam.empty()) return 0;
+
+    const std::string pattern = selectorParam + "=";
+    const char *end = buf + n;
+    const char *p = buf;
+    while((p = std::search(p, end, pattern.begin(), pattern.end())) != end) {
+        const char *q = p - (sizeof(qstring) - 1);
+        if(p == buf || p[-1] == '?' || p[-1] == '&' ||
+           (q >= buf && strncmp(q, qstring, sizeof(qstring) - 1) == 0))
+        {
+            const char *v = p + pattern.size();
+            const char *e = v;
+            while(e < end && *e != '&' && *e != ' ' && *e != '#' && *e > 0x20 && *e < 0x7f) e++;
+            return e > v ? scriptHash(v, e - v) : 0;
+        }
+        p += pattern.size();
+    }
+    return 0;
+}
+
+/**
+ * @fn static int chooseChild(unsigned scripthash)
+ * @brief chooses the idle child to pass the connection to: the one served
+ *        longest ago among those that served the same script last time, or
+ *        among all idle children if there are no such children. The idle
+ *        children take the connections in turn, an old child is not left
+ *        idle for its lifetime count of requests
+ * @return slot number or -1 if all children are busy
+ */
+static int chooseChild(unsigned scripthash) {
+    int best = -1, affine = -1;
+    for(int i = 0; i < children_count; i++) {
+        if(!childIdle[i] || chanfd[i] < 0) continue;
+        if(best < 0 || lastServed[i] < lastServed[best]) best = i;
+        if(scripthash && pslots[i].scripthash == scripthash &&
+           (affine < 0 || lastServed[i] < lastServed[affine])) affine = i;
+    }
+    return affine >= 0 ? affine : best;
+}
+
+static inline void addPoll(std::vector<struct pollfd>& pfd, std::vector<int>& owner, int fd, int who) {
+    struct pollfd p;
+    p.fd = fd;
+    p.events = POLLIN;
+    p.revents = 0;
+    pfd.push_back(p);
+    owner.push_back(who);
+}
+
+/**
+ * @fn static void runDispatcher()
+ * @brief master main loop in dispatcher mode: accepts connections, queues them
+ *        and passes to the idle children over the children channels
+ */
+static void runDispatcher() {
+    std::vector<struct pollfd> pfd;
+    std::vector<int> owner;         // slot number or -1/-2 for FastCGI/HTTP listen socket, -3 for cache listener
+    time_t lastcheck = time(nullptr);
+    size_t maxdepth = 0;
+
+    while(children_running > 0) {
+        pfd.clear();
+        owner.clear();
+        if(doRestart && pendingQueue.size() < DISPATCH_QUEUE) {
+            if(fcgi_socket >= 0) addPoll(pfd, owner, fcgi_socket, -1);
+            if(http_socket >= 0) addPoll(pfd, owner, http_socket, -2);
+        }
+        for(int i = 0; i < children_count; i++) {
+            if(chanfd[i] >= 0) addPoll(pfd, owner, chanfd[i], i);
+        }
+        if(cacheListener.fd() >= 0) addPoll(pfd, owner, cacheListener.fd(), -3);
+
+        int rv = poll(&pfd[0], pfd.size(), SLEEPTIME * 1000);
+        if(rv < 0 && errno != EINTR) log_error("%s: poll failed: %s", __func__, strerror(errno));
+
+        for(size_t k = 0; rv > 0 && k < pfd.size(); k++) {
+            if(!pfd[k].revents) continue;
+            if(owner[k] == -3) cacheListener.receive();
+            else if(owner[k] < 0) {
+                pending_t pending;
+                pending.fd = accept(pfd[k].fd, nullptr, nullptr);
+                if(pending.fd < 0) continue;
+                pending.frontend = owner[k] == -1 ? FRONTEND_FCGI : FRONTEND_HTTP;
+                pending.scripthash = peekScript(pending.fd);
+                pendingQueue.push_back(pending);
+            }
+            else {
+                char tag;
+                int slot = owner[k];
+                if(read(chanfd[slot], &tag, 1) == 1) childIdle[slot] = true;
+                else {
+                    // child is gone, it will be restarted by forkChildren
+                    close(chanfd[slot]);
+                    chanfd[slot] = -1;
+                    childIdle[slot] = false;
+                }
+            }
+        }
+
+        if(pendingQueue.size() > maxdepth) maxdepth = pendingQueue.size();
+        while(!pendingQueue.empty()) {
+            const pending_t& pending = pendingQueue.front();
+            int slot = chooseChild(pending.scripthash);
+            if(slot < 0) break; // all children are busy
+            childIdle[slot] = false;
+            rv = sendFd(chanfd[slot], pending.fd, pending.frontend);
+            if(rv) {
+                // the channel is broken: the child exits on its end closed and
+                // is restarted, the connection goes to another child
+                log_warning("%s: can not pass connection to child %d: %s", __func__, slot, strerror(rv));
+                close(chanfd[slot]);
+                chanfd[slot] = -1;
+                continue;
+            }
+            lastServed[slot] = ++dispatched;
+            close(pending.fd);
+            pendingQueue.pop_front();
+        }
+
+        if(time(nullptr) - lastcheck >= SLEEPTIME) {
+            lastcheck = time(nullptr);
+            log_debug("%s: queue depth %zu, max %zu", __func__, pendingQueue.size(), maxdepth);
+            maxdepth = pendingQueue.size();
+            housekeeping();
+        }
+    }
+
+    for(const auto &it : pendingQueue) close(it.fd);
+    pendingQueue.clear();
+}
+
 int runPreforked() {
     int rv;
 
@@ -366,24 +750,75 @@ int runPreforked() {
     rv = FCGX_Init();
     if(rv) log_error("%s: FCGX_Init failed: %s", __func__, strerror(rv));
 
-    fcgi_socket = FCGX_OpenSocket(cpt->get<std::string>("common.fcgisocket", ":9090").c_str(),
-                                  CHILDREN_HARDLIMIT);
-    if(fcgi_socket < 0) log_error("%s: FCGX_OpenSocket failed: %s", __func__, strerror(errno));
+    const std::string fcgipath = cpt->get<std::string>("common.fcgisocket", ":9090");
+    const std::string httppath = cpt->get<std::string>("common.httpsocket", "");
+
+    if(fcgipath == "none" && httppath.length()) fcgi_socket = -1; // HTTP only
+    else {
+        fcgi_socket = FCGX_OpenSocket(fcgipath.c_str(), CHILDREN_HARDLIMIT);
+        if(fcgi_socket < 0) log_error("%s: FCGX_OpenSocket failed: %s", __func__, strerror(errno));
+    }
+
+    // native HTTP front end
+    if(httppath.length()) {
+        http_socket = httpOpenSocket(httppath.c_str(), CHILDREN_HARDLIMIT);
+        if(http_socket < 0)
+            log_error("%s: %s: can not open HTTP socket: %s", __func__, httppath.c_str(), strerror(errno));
+    }
+
+    // dispatcher mode: master accepts and passes connections to the children
+    dispatcher = cpt->get<bool>("common.dispatcher", false);
+    if(dispatcher) {
+        const std::string selector = cpt->get<std::string>("common.scriptselector", "@0.function");
+        std::string::size_type dot = selector.find('.');
+        if(selector.compare(0, 3, "@0.") == 0) selectorParam = selector.substr(dot + 1);
+        for(int i = 0; i < CHILDREN_HARDLIMIT; i++) chanfd[i] = -1;
+#ifdef TCP_DEFER_ACCEPT
+        // wake up when the request data arrived, so we can peek the script name
+        int defer = 1;
+        if(fcgi_socket >= 0) setsockopt(fcgi_socket, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer, sizeof(defer));
+        if(http_socket >= 0) setsockopt(http_socket, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer, sizeof(defer));
+#endif
+    }
+
+    // shared memory caches are created before fork
+    respCacheInit();
+    stateCacheInit();
+    httpCacheInit();
+    dbStatsInit();
+    circuitBreaker.create();
+    cacheListener.create();
 
     // main loop
 
     forkChildren();
+    if(dispatcher) runDispatcher();
     while(children_running > 0) {
-        sleep(SLEEPTIME);
-        if(needFork()) forkChildren();
+        cacheListener.wait(SLEEPTIME); // invalidations are handled meanwhile
+        housekeeping();
     }
 
     log_warning("%s: shutdown in progress...", __func__);
 
     FCGX_ShutdownPending();
-    close(fcgi_socket);
+    if(fcgi_socket >= 0) close(fcgi_socket);
+    if(http_socket >= 0) close(http_socket);
+    for(int i = 0; dispatcher && i < CHILDREN_HARDLIMIT; i++) if(chanfd[i] >= 0) close(chanfd[i]);
 
     munmap(pslots, CHILDREN_TABSIZE);
+    respCache.logStats();
+    respCache.destroy();
+    stateCache.logStats();
+    stateCache.destroy();
+    httpCache.logStats();
+    httpCache.destroy();
+    singleFlight.logStats();
+    singleFlight.destroy();
+    cacheListener.logStats();
+    cacheListener.destroy();
+    circuitBreaker.logStats();
+    circuitBreaker.destroy();
+    logDBStats();
 
     close(shr_lockfd);
     close(tmp_lockfd);
@@ -8,13 +8,20 @@
  */
 
 #include "config.h"
+#include <cstdio>
 #include <cstring>
+#include <cctype>
+#include <map>
 #include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
 #include "cstate.hpp"
 #include "parser.hpp"
 #include "cassigner.hpp"
 #include "database.hpp"
 #include "apputils.hpp"
+#include "statecache.hpp"
+#include "singleflight.hpp"
+#include "shmcache.hpp"
 
 namespace pt = boost::property_tree;
 extern pt::ptree *cpt;                       // property tree: global configuration
@@ -25,18 +32,26 @@ extern const char *syntax_error;
 // *********************************************************************
 
 void CQueryState::clearQResult() {
-    if(m_qResult) {
-        for(const auto &it : *m_qResult) free(it);
-        delete m_qResult;
-        m_qResult = nullptr;
-    }
+    delete m_qResult;
+    m_qResult = nullptr;
 }
 
 
 CQueryState::CQueryState(const int stateno, const std::string& scriptName):
-    CState(stateno, scriptName, "query"), m_dbsection(""), m_query(""), m_qResult(0) {};
+    CState(stateno, scriptName, "query"), m_dbsection(""), m_query(""), m_statement(""),
+    m_stmtName(""), m_prepared(false), m_bind(false), m_retry(false), m_cursorRows(0), m_cursor(0), m_qResult(0) {};
+
+// query states with cursors by script and number, for the fetch states
+static std::map<std::pair<std::string, int>, CQueryState*> cursorStates;
+
+CQueryState* findQueryState(const std::string& scriptName, int stateno) {
+    const auto it = cursorStates.find(std::make_pair(scriptName, stateno));
+    return it != cursorStates.end() ? it->second : nullptr;
+}
 
 CQueryState::~CQueryState() {
+    const auto it = cursorStates.find(std::make_pair(get_scriptName(), get_number()));
+    if(it != cursorStates.end() && it->second == this) cursorStates.erase(it);
     clearQResult();
     for(auto &it : m_assignments) delete it;
 };
@@ -58,36 +73,266 @@ int CQueryState::parse(const std::string& line, const std::string& file, unsigne
         len = regmatch[1].rm_eo - regmatch[1].rm_so;
         m_query = line.substr(regmatch[1].rm_so, len);
     }
+    else if(is_matched("bind", line, regmatch, 0, file, counter)) {
+        m_bind = true;
+    }
+    else if(is_matched("retry", line, regmatch, 0, file, counter)) {
+        m_retry = true;
+    }
+    else if(is_matched("cursor", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_cursorRows = boost::lexical_cast<unsigned>(line.substr(regmatch[1].rm_so, len));
+        cursorStates[std::make_pair(get_scriptName(), get_number())] = this;
+    }
+    else if(is_matched("cache", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        set_cacheTTL(boost::lexical_cast<unsigned>(line.substr(regmatch[1].rm_so, len)));
+        stateCacheRequired();
+    }
+    else if(is_matched("tags", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        std::string tags = line.substr(regmatch[1].rm_so, len);
+        boost::split(m_cacheTags, tags, boost::is_any_of(","), boost::token_compress_on);
+        for(const auto &it : m_cacheTags) stateCacheTag(it);
+    }
     else m_assignments.push_back(parseAssignment(line, get_number(), file, counter));
     return 0;
 }
 
 bool CQueryState::verify() {
+    if(m_bind && m_query.length()) {
+        m_prepared = bindVariables(m_query, get_number(), m_statement, m_bindVars);
+        if(m_prepared) {
+            char name[24];
+            snprintf(name, sizeof(name), "q%016llx", (unsigned long long)hash64(m_statement.data(), m_statement.size()));
+            m_stmtName = name;
+        }
+        else log_warning("%s:%d: query can not be prepared, variables are interpolated",
+                         get_scriptName().c_str(), get_number());
+    }
+    if(m_cursorRows && get_cacheTTL()) {
+        log_warning("%s:%d: cursor results are not cached", get_scriptName().c_str(), get_number());
+        set_cacheTTL(0);
+    }
+    if(m_cacheTags.size() && !get_cacheTTL())
+        log_warning("%s:%d: tags without cache clause are ignored", get_scriptName().c_str(), get_number());
     return
         get_errorState() > 0 && get_nextState() > 0 && get_errorState() != get_nextState() &&
         m_dbsection.length() > 0 && m_query.length() > 0;
 }
 
+// the next row of the cursor, nullptr at the end
+CQueryResult* CQueryState::fetch() {
+    if(!m_cursor) return nullptr;
+    CQueryResult *row = getDatabase(m_dbsection)->fetch(m_cursor);
+    if(!row) m_cursor = 0;
+    return row;
+}
+
 char* CQueryState::getPropositional(const std::string& name) const {
-    try {
-        size_t num = boost::lexical_cast<size_t>(name.substr(1));
-        if(m_qResult && num < m_qResult->size()) {
-            if((*m_qResult)[num]) return strdup((*m_qResult)[num]);
-            else return strdup("");
+    return m_qResult ? m_qResult->getPropositional(name) : nullptr;
+}
+
+// identifier symbol, $ included, before the quote or dollar tag
+static inline bool is_identChar(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '$';
+}
+
+// variable name at the beginning of the string, short form is expanded
+static size_t matchVariable(const std::string& src, int stateno, std::string& var) {
+    size_t so, eo;
+    if(is_variable(src, &so, &eo, "lvar") && so == 0) var = src.substr(0, eo);
+    else if(is_variable(src, &so, &eo, "slvar") && so == 0) {
+        var = "@";
+        var.append(boost::lexical_cast<std::string>(stateno));
+        var.push_back('.');
+        var.append(src.substr(1, eo - 1));
+    }
+    else if(is_variable(src, &so, &eo, "gvar") && so == 0) var = src.substr(0, eo);
+    else return 0;
+    return eo;
+}
+
+/**
+ * @fn bool bindVariables(const std::string& query, int stateno, std::string& statement, std::vector<std::string>& vars)
+ * @brief turns @ and & variables of the query into $n placeholders. The
+ *        variable quoted alone ('@var') loses the quotes, the one inside a
+ *        longer literal is concatenated: 'a@var%' -> ('a' || $1::text || '%').
+ *        The backslash escapes of E'' literals are kept: E'\\'' is E'\''
+ * @param statement -- (out) the query with placeholders
+ * @param vars -- (out) variables names for $1, $2, ...
+ * @return false if the query can not be prepared: it has propositional
+ *         variables, variables in the quoted identifiers or E'' literals,
+ *         or dollar quoted literals
+ */
+bool bindVariables(const std::string& query, int stateno, std::string& statement, std::vector<std::string>& vars) {
+    std::vector<std::string> pieces;    // literal: text and placeholders
+    std::string text(""), var;
+    char quote = 0;
+    bool estring = false;               // E'' literal
+    bool escaped = false;               // the next symbol of E'' literal is escaped by backslash
+    size_t i = 0, len, so, eo;
+
+    statement = "";
+    vars.clear();
+    while(i < query.length()) {
+        char c = query[i];
+        if(c == '\\' && i + 1 < query.length()) {
+            // escaped symbol is copied as is, like evaluate() does
+            if(quote == '\'') {
+                text.push_back(query[i + 1]);
+                escaped = estring && !escaped && query[i + 1] == '\\';
+            }
+            else statement.push_back(query[i + 1]);
+            i += 2;
+            continue;
+        }
+        if((c == '@' || c == '&') && (len = matchVariable(query.substr(i), stateno, var))) {
+            if(quote == '"' || estring) return false;
+            vars.push_back(var);
+            std::string placeholder("$");
+            placeholder.append(boost::lexical_cast<std::string>(vars.size()));
+            if(quote == '\'') {
+                pieces.push_back("'" + text + "'");
+                pieces.push_back(placeholder);
+                text = "";
+            }
+            else statement.append(placeholder);
+            i += len;
+            continue;
+        }
+        if(c == '$' && is_variable(query.substr(i), &so, &eo, "pvar") && so == 0) return false;
+        if(c == '$' && !quote && (i == 0 || !is_identChar(query[i - 1]))) {
+            // $$ or $tag$ opens a dollar quoted literal
+            size_t e = i + 1;
+            while(e < query.length() && query[e] != '$' && is_identChar(query[e])) e++;
+            if(e < query.length() && query[e] == '$' && !isdigit((unsigned char)query[i + 1])) return false;
+        }
+
+        if(quote == '\'') {
+            if(escaped) {
+                text.push_back(c);
+                escaped = false;
+                i++;
+                continue;
+            }
+            if(c == '\'' && i + 1 < query.length() && query[i + 1] == '\'') {
+                text.append("''");
+                i += 2;
+                continue;
+            }
+            if(c == '\'') {
+                quote = 0;
+                estring = false;
+                pieces.push_back("'" + text + "'");
+                if(pieces.size() == 1) statement.append(pieces[0]);
+                else if(pieces.size() == 3 && pieces[0] == "''" && pieces[2] == "''") statement.append(pieces[1]);
+                else {
+                    std::string concat("");
+                    for(size_t p = 0; p < pieces.size(); p++) {
+                        if(pieces[p] == "''") continue;
+                        if(concat.length()) concat.append(" || ");
+                        concat.append(pieces[p]);
+                        if(pieces[p][0] == '$') concat.append("::text");
+                    }
+                    statement.append("(" + concat + ")");
+                }
+                pieces.clear();
+                text = "";
+            }
+            else text.push_back(c);
+            i++;
+            continue;
         }
+        if(quote == '"' && c == '"') quote = 0;
+        else if(!quote && (c == '\'' || c == '"')) {
+            quote = c;
+            if(c == '\'') {
+                const size_t n = statement.length();
+                estring = n && toupper((unsigned char)statement[n - 1]) == 'E' &&
+                          (n == 1 || !is_identChar(statement[n - 2]));
+                i++;
+                continue;
+            }
+        }
+        statement.push_back(c);
+        i++;
     }
-    catch(...) {
+    return quote == 0;
+}
+
+// no rows is an empty string
+static std::string packQResult(const CQueryResult *qr) {
+    std::string memo("");
+    if(qr) {
+        for(size_t col = 0; col < qr->columns(); col++) memoPack(memo, qr->name(col));
+        for(size_t col = 0; col < qr->columns(); col++) memoPack(memo, qr->value(col));
     }
+    return memo;
+}
+
+static CQueryResult* unpackQResult(std::string& memo) {
+    if(memo.empty()) return nullptr;
+    CMemoResult *qr = new CMemoResult(memo);
+    if(qr->is_valid()) return qr;
+    delete qr;
     return nullptr;
 }
 
 int CQueryState::execute(const FCGX_Request *request, CAssigner* assigner) {
     unsigned i;
     clearQResult();    // cleanup from previous run
+    m_cursor = 0;
     try {
         std::string outq("");
-        assigner->evaluate(m_query, outq, this);
-        m_qResult = getDatabase(m_dbsection)->query(outq);
+        std::string memo("");
+        std::string key("");
+        std::vector<std::string> values;
+        const bool prepared = m_prepared;
+        if(prepared) {
+            // missing variable is an empty string, as interpolated
+            for(const auto &it : m_bindVars) {
+                char *val = assigner->getValue(it);
+                values.push_back(val ? val : "");
+                free(val);
+            }
+        }
+        else assigner->evaluate(m_query, outq, this);
+        if(m_cursorRows) {
+            // the rows are read by the fetch state
+            qparams_t params;
+            for(const auto &it : values) params.push_back(it.c_str());
+            m_cursor = getDatabase(m_dbsection)->openCursor(prepared ? m_statement : outq, params, m_cursorRows);
+            return get_nextState();
+        }
+        if(get_cacheTTL()) {
+            key = "query";
+            key.push_back('\0');
+            key.append(m_dbsection);
+            key.push_back('\0');
+            if(prepared) {
+                key.append(m_statement);
+                for(const auto &it : values) memoPack(key, it);
+            }
+            else key.append(outq);
+            // invalidated tag has the new generation, the old entries are not found
+            for(const auto &it : m_cacheTags) memoPack(key, boost::lexical_cast<std::string>(cacheTagGeneration(it)));
+        }
+        if(key.length() && stateCache.get(key, memo)) m_qResult = unpackQResult(memo);
+        else {
+            // the first child runs the query, the others take its result from the cache
+            CScopedFlight flight;
+            if(key.length() && flight.join(key) && stateCache.get(key, memo)) m_qResult = unpackQResult(memo);
+            else {
+                if(prepared) {
+                    qparams_t params;
+                    for(const auto &it : values) params.push_back(it.c_str());
+                    m_qResult = getDatabase(m_dbsection)->execPrepared(m_stmtName, m_statement, params, m_retry);
+                }
+                else m_qResult = getDatabase(m_dbsection)->query(outq, m_retry);
+                if(key.length()) stateCache.put(key, packQResult(m_qResult), get_cacheTTL());
+            }
+        }
         for(i = 0; i < m_assignments.size(); ++i)
             assigner->assign(m_assignments[i], this);
     }
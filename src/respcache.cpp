@@ -0,0 +1,144 @@
+/**
+ * @file   respcache.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Tue Oct 20 14:05:26 2026
+ *
+ * @brief  Full response cache implementation
+ *
+ */
+
+#include "config.h"
+#include <map>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/foreach.hpp>
+#include "apputils.hpp"
+#include "cassigner.hpp"
+#include "respcache.hpp"
+
+namespace pt = boost::property_tree;
+extern pt::ptree *cpt;                       // property tree: global configuration
+
+CShmCache respCache;
+
+static std::map<std::string, respCacheRule_t> cacheRules; // filled before fork
+
+// *********************************************************************
+// *** CCaptureStream
+// *********************************************************************
+
+CCaptureStream::CCaptureStream(FCGX_Stream *out, size_t limit):
+    m_out(out), m_data(""), m_limit(limit), m_overflow(false), m_flush(false)
+{
+    memset(&m_stream, 0, sizeof(m_stream));
+    m_stream.wrNext = m_buf;
+    m_stream.stop = m_buf + sizeof(m_buf);
+    m_stream.emptyBuffProc = emptyBuffer;
+    m_stream.data = this;
+}
+
+// buffer is full or FCGX_FFlush is called, flush() tells one from another
+void CCaptureStream::emptyBuffer(FCGX_Stream *stream, int doClose) {
+    CCaptureStream *cs = static_cast<CCaptureStream*>(stream->data);
+    size_t len = stream->wrNext - cs->m_buf;
+    if(len > 0) {
+        if(!cs->m_overflow) {
+            if(cs->m_data.size() + len > cs->m_limit) {
+                cs->m_overflow = true;
+                cs->m_data.clear();
+            }
+            else cs->m_data.append((char*)cs->m_buf, len);
+        }
+        if(FCGX_PutStr((char*)cs->m_buf, len, cs->m_out) < 0) stream->isClosed = 1;
+    }
+    if(!doClose && cs->m_flush && FCGX_FFlush(cs->m_out) < 0) stream->isClosed = 1;
+    cs->m_flush = false;
+    stream->wrNext = cs->m_buf;
+}
+
+// FCGX_FFlush of the output stream, the real one is flushed as well if captured
+int CCaptureStream::flush(FCGX_Stream *stream) {
+    if(stream->emptyBuffProc == emptyBuffer) static_cast<CCaptureStream*>(stream->data)->m_flush = true;
+    return FCGX_FFlush(stream);
+}
+
+// passes the rest of output to the real stream, does not flush it
+void CCaptureStream::finish() {
+    emptyBuffer(&m_stream, 1);
+}
+
+// *********************************************************************
+// *** response cache
+// *********************************************************************
+
+/**
+ * @fn void respCacheInit()
+ * @brief reads [respcache] section and creates the cache, called by master
+ *        before fork. Format of the script line: ttl [param,param,...] [maxsize]
+ */
+void respCacheInit() {
+    const auto section = cpt->get_child_optional("respcache");
+    if(!section) return;
+
+    const size_t maxentry = cpt->get<size_t>("respcache.maxentry", RESPCACHE_MAXENTRY);
+    BOOST_FOREACH(const pt::ptree::value_type &v, *section) {
+        if(v.first == "size" || v.first == "maxentry") continue;
+        std::vector<std::string> fields;
+        std::string line = boost::trim_copy(v.second.data());
+        boost::split(fields, line, boost::is_any_of(" \t"), boost::token_compress_on);
+        respCacheRule_t rule;
+        try {
+            rule.ttl = boost::lexical_cast<unsigned>(fields[0]);
+            rule.maxsize = fields.size() > 2 ? boost::lexical_cast<size_t>(fields[2]) : maxentry;
+        }
+        catch(boost::bad_lexical_cast &) {
+            log_error("%s: [respcache] %s: format error", __func__, v.first.c_str());
+        }
+        if(fields.size() > 1 && fields[1] != "-")
+            boost::split(rule.params, fields[1], boost::is_any_of(","), boost::token_compress_on);
+        if(rule.maxsize > maxentry) rule.maxsize = maxentry;
+        cacheRules[v.first] = rule;
+    }
+    if(cacheRules.empty()) return;
+
+    // key is short, script name and a few values
+    if(!respCache.create("respcache", cpt->get<size_t>("respcache.size", RESPCACHE_SIZE), maxentry + 256))
+        cacheRules.clear();
+}
+
+const respCacheRule_t* respCacheRule(const std::string& script) {
+    const auto it = cacheRules.find(script);
+    return it != cacheRules.end() ? &it->second : nullptr;
+}
+
+// script name and the parameters values, '\0' separated
+std::string respCacheKey(const std::string& script, const respCacheRule_t *rule, CAssigner *assigner) {
+    std::string key(script);
+    for(const auto &it : rule->params) {
+        key.push_back('\0');
+        const char *value = assigner->getLocalPtr("@0." + it);
+        if(value) key.append(value);
+        else key.push_back('\1'); // absent differs from empty
+    }
+    return key;
+}
+
+// value of the header in the CGI header block of the stored reply, empty if none
+std::string respCacheHeader(const std::string& reply, const char *name) {
+    const size_t end = reply.find("\r\n\r\n");
+    const size_t n = strlen(name);
+    size_t pos = 0;
+    if(end == std::string::npos) return "";
+    while(pos < end) {
+        const size_t eol = reply.find("\r\n", pos);
+        if(eol - pos > n && reply[pos + n] == ':' && strncasecmp(reply.data() + pos, name, n) == 0) {
+            size_t so = reply.find_first_not_of(" \t", pos + n + 1);
+            if(so > eol) so = eol;
+            return reply.substr(so, eol - so);
+        }
+        pos = eol + 2;
+    }
+    return "";
+}
@@ -10,12 +10,14 @@
 #include "config.h"
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include <vector>
 #include <boost/lexical_cast.hpp>
 #include "cstate.hpp"
 #include "parser.hpp"
 #include "cassigner.hpp"
 #include "apputils.hpp"
+#include "aio.hpp"
 
 extern const char *syntax_error;
 
@@ -64,6 +66,12 @@ bool CShellState::verify() {
 int CShellState::execute(const FCGX_Request *request, CAssigner* assigner) {
     std::string command ("");
     assigner->evaluate(m_command, command, this);
+    // the command may read files written by this request
+    if(ioBatch.submit()) {
+        log_warning("%s:%s:%d: files of the request are not written", get_scriptName().c_str(),
+                    get_stateName().c_str(), get_number());
+        return get_errorState();
+    }
     FILE *in = ::popen(command.c_str(), "r");
     if(in) {
         const size_t N = 1024;
@@ -71,11 +79,11 @@ int CShellState::execute(const FCGX_Request *request, CAssigner* assigner) {
         while (true) {
             std::vector<char> buf(N);
             size_t read = ::fread((void*)&buf[0], 1, N, in);
-            if(read) result.append(buf.begin(), buf.end());
+            if(read) result.append(&buf[0], read);
             if(read < N) break; 
         }
         pclose(in);
-        assigner->assignLocal(m_outputvar, result.c_str());
+        assigner->assignLocal(m_outputvar, strdup(result.c_str())); // the symbol table frees it
         return get_nextState();    
     }
 
@@ -0,0 +1,213 @@
+/**
+ * @file   shmcache.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Tue Oct 20 12:31:08 2026
+ *
+ * @brief  CShmCache class definition
+ *
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <cstring>
+#include <cerrno>
+#include "apputils.hpp"
+#include "shmcache.hpp"
+
+#define SHMCACHE_ALIGN 64
+
+static inline size_t alignUp(size_t n) {
+    return (n + SHMCACHE_ALIGN - 1) & ~(size_t)(SHMCACHE_ALIGN - 1);
+}
+
+// FNV-1a 64, 0 is reserved for the empty slot
+uint64_t hash64(const char *data, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for(size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+CShmCache::CShmCache(): m_hdr(nullptr), m_slots(nullptr), m_size(0), m_name("") {}
+
+CShmCache::~CShmCache() {
+    // shared memory is unmapped by exit(3), destroy() is for master
+}
+
+/**
+ * @fn bool CShmCache::create(const std::string& name, size_t size, size_t slotsize, size_t ways)
+ * @brief maps shared memory and initializes the cache, must be called by
+ *        master before the children are forked
+ * @param name -- cache name for the log messages
+ * @param size -- total shared memory size
+ * @param slotsize -- slot size, key and data of one entry must fit it
+ * @param ways -- slots per set
+ * @return false if memory can not be mapped
+ */
+bool CShmCache::create(const std::string& name, size_t size, size_t slotsize, size_t ways) {
+    pthread_mutexattr_t attr;
+
+    m_name = name;
+    slotsize = alignUp(slotsize + sizeof(slot_t));
+    if(ways == 0) ways = 1;
+    if(size < alignUp(sizeof(header_t)) + slotsize * ways) size = alignUp(sizeof(header_t)) + slotsize * ways;
+
+    void *mem = mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED, -1, 0);
+    if(mem == MAP_FAILED) {
+        log_warning("%s: %s: mmap failed: %s", __func__, m_name.c_str(), strerror(errno));
+        return false;
+    }
+    m_size = size;
+    m_hdr = (header_t*)mem;
+    m_slots = (char*)mem + alignUp(sizeof(header_t));
+    memset(m_hdr, 0, sizeof(header_t)); // anonymous mapping is zeroed, slots are empty
+    m_hdr->ways = ways;
+    m_hdr->slotsize = slotsize;
+    m_hdr->nsets = (size - alignUp(sizeof(header_t))) / (slotsize * ways);
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    // a child may be killed holding the lock
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&m_hdr->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    log_message("%s: %s: %zu sets of %zu slots, %zu bytes per entry", __func__,
+                m_name.c_str(), m_hdr->nsets, ways, get_maxData());
+    return true;
+}
+
+void CShmCache::destroy() {
+    if(!m_hdr) return;
+    pthread_mutex_destroy(&m_hdr->mutex);
+    munmap(m_hdr, m_size);
+    m_hdr = nullptr;
+    m_slots = nullptr;
+}
+
+void CShmCache::lock() {
+    int rv = pthread_mutex_lock(&m_hdr->mutex);
+    if(rv == EOWNERDEAD) {
+        // the slot being written has zero hash until the data is complete
+        pthread_mutex_consistent(&m_hdr->mutex);
+    }
+}
+
+// must be called locked
+CShmCache::slot_t* CShmCache::find(const std::string& key, uint64_t hash, time_t now) {
+    size_t set = hash % m_hdr->nsets;
+    for(size_t way = 0; way < m_hdr->ways; way++) {
+        slot_t *s = slot(set, way);
+        if(s->hash != hash || s->keylen != key.size() ||
+           memcmp((char*)(s + 1), key.data(), key.size())) continue;
+        if(s->expires <= now) {
+            s->hash = 0;
+            m_hdr->stats.expired++;
+            return nullptr;
+        }
+        return s;
+    }
+    return nullptr;
+}
+
+/**
+ * @fn bool CShmCache::get(const std::string& key, std::string& data)
+ * @return true and the data if the key is found and not expired
+ */
+bool CShmCache::get(const std::string& key, std::string& data) {
+    if(!m_hdr) return false;
+    uint64_t hash = hash64(key.data(), key.size());
+    bool found = false;
+
+    lock();
+    slot_t *s = find(key, hash, time(nullptr));
+    if(s) {
+        data.assign((char*)(s + 1) + s->keylen, s->datalen);
+        s->lastuse = ++m_hdr->tick;
+        m_hdr->stats.hits++;
+        found = true;
+    }
+    else m_hdr->stats.misses++;
+    unlock();
+    return found;
+}
+
+/**
+ * @fn bool CShmCache::put(const std::string& key, const std::string& data, unsigned ttl)
+ * @brief stores the entry replacing the same key, an empty or expired slot
+ *        or the least recently used one in the set
+ * @return false if the entry is too large for the slot
+ */
+bool CShmCache::put(const std::string& key, const std::string& data, unsigned ttl) {
+    if(!m_hdr) return false;
+    if(sizeof(slot_t) + key.size() + data.size() > m_hdr->slotsize) {
+        lock();
+        m_hdr->stats.toolarge++;
+        unlock();
+        return false;
+    }
+    uint64_t hash = hash64(key.data(), key.size());
+    time_t now = time(nullptr);
+    size_t set = hash % m_hdr->nsets;
+
+    lock();
+    slot_t *s = find(key, hash, now);
+    if(!s) {
+        slot_t *lru = nullptr;
+        for(size_t way = 0; way < m_hdr->ways; way++) {
+            slot_t *cand = slot(set, way);
+            if(cand->hash == 0 || cand->expires <= now) {
+                s = cand;
+                break;
+            }
+            if(!lru || cand->lastuse < lru->lastuse) lru = cand;
+        }
+        if(!s) {
+            s = lru;
+            m_hdr->stats.evictions++;
+        }
+    }
+    s->hash = 0;
+    s->keylen = key.size();
+    s->datalen = data.size();
+    memcpy((char*)(s + 1), key.data(), key.size());
+    memcpy((char*)(s + 1) + key.size(), data.data(), data.size());
+    s->expires = now + ttl;
+    s->lastuse = ++m_hdr->tick;
+    s->hash = hash;
+    m_hdr->stats.stores++;
+    unlock();
+    return true;
+}
+
+void CShmCache::remove(const std::string& key) {
+    if(!m_hdr) return;
+    uint64_t hash = hash64(key.data(), key.size());
+    lock();
+    slot_t *s = find(key, hash, time(nullptr));
+    if(s) s->hash = 0;
+    unlock();
+}
+
+void CShmCache::getStats(shmCacheStats_t *stats) {
+    if(!m_hdr) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    lock();
+    *stats = m_hdr->stats;
+    unlock();
+}
+
+void CShmCache::logStats() {
+    shmCacheStats_t st;
+    if(!m_hdr) return;
+    getStats(&st);
+    unsigned long total = st.hits + st.misses;
+    log_message("%s: hits %lu, misses %lu (%.1f%% hit), stores %lu, evictions %lu, expired %lu, too large %lu",
+                m_name.c_str(), st.hits, st.misses, total ? 100.0 * st.hits / total : 0.0,
+                st.stores, st.evictions, st.expired, st.toolarge);
+}
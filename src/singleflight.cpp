@@ -0,0 +1,173 @@
+/**
+ * @file   singleflight.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Tue Oct 20 19:22:40 2026
+ *
+ * @brief  CSingleFlight class definition
+ *
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include "apputils.hpp"
+#include "shmcache.hpp"
+#include "singleflight.hpp"
+
+CSingleFlight singleFlight;
+
+CSingleFlight::CSingleFlight(): m_table(nullptr), m_leading(0), m_wait(SINGLEFLIGHT_WAIT), m_globals(false) {}
+
+// called by master before fork
+bool CSingleFlight::create(unsigned waitms, bool globals) {
+    pthread_mutexattr_t mattr;
+    pthread_condattr_t cattr;
+
+    void *mem = mmap(nullptr, sizeof(table_t), PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED, -1, 0);
+    if(mem == MAP_FAILED) {
+        log_warning("%s: mmap failed: %s", __func__, strerror(errno));
+        return false;
+    }
+    m_table = (table_t*)mem;
+    m_wait = waitms;
+    m_globals = globals;
+
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&m_table->mutex, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&m_table->done, &cattr);
+    pthread_condattr_destroy(&cattr);
+    return true;
+}
+
+void CSingleFlight::destroy() {
+    if(!m_table) return;
+    pthread_cond_destroy(&m_table->done);
+    pthread_mutex_destroy(&m_table->mutex);
+    munmap(m_table, sizeof(table_t));
+    m_table = nullptr;
+}
+
+static inline void addMs(struct timespec& ts, unsigned ms) {
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000L;
+    if(ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+}
+
+static inline bool is_before(const struct timespec& a, const struct timespec& b) {
+    return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+void CSingleFlight::lock() {
+    if(pthread_mutex_lock(&m_table->mutex) == EOWNERDEAD) pthread_mutex_consistent(&m_table->mutex);
+}
+
+/**
+ * @fn int CSingleFlight::begin(const std::string& key)
+ * @brief joins the flight for the key
+ * @return slot number if we are the leader (end() must be called),
+ *         SF_WAITED if the leader has finished while we waited,
+ *         SF_ALONE if the work is to be done without coordination
+ */
+int CSingleFlight::begin(const std::string& key) {
+    if(!m_table) return SF_ALONE;
+    const uint64_t hash = hash64(key.data(), key.size());
+    struct timespec deadline, probe;
+    bool waited = false;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    addMs(deadline, m_wait);
+
+    lock();
+    while(1) {
+        int slot = -1, free = -1;
+        for(int i = 0; i < SINGLEFLIGHT_SLOTS; i++) {
+            if(m_table->flights[i].hash == hash) {
+                slot = i;
+                break;
+            }
+            if(free < 0 && m_table->flights[i].hash == 0) free = i;
+        }
+        if(slot < 0) {
+            if(waited) {
+                pthread_mutex_unlock(&m_table->mutex);
+                return SF_WAITED;
+            }
+            if(free < 0) {
+                m_table->stats.overflows++;
+                pthread_mutex_unlock(&m_table->mutex);
+                return SF_ALONE;
+            }
+            m_table->flights[free].hash = hash;
+            m_table->flights[free].leader = getpid();
+            m_table->stats.leaders++;
+            m_leading++;
+            pthread_mutex_unlock(&m_table->mutex);
+            return free;
+        }
+        if(m_table->flights[slot].leader == getpid()) {
+            // the same key twice within the request: fanout, global miss
+            pthread_mutex_unlock(&m_table->mutex);
+            return SF_ALONE;
+        }
+        if(kill(m_table->flights[slot].leader, 0) < 0 && errno == ESRCH) {
+            // leader is killed in flight
+            m_table->flights[slot].leader = getpid();
+            m_table->stats.takeovers++;
+            m_leading++;
+            pthread_mutex_unlock(&m_table->mutex);
+            return slot;
+        }
+        if(m_leading) {
+            // the leader of another flight does not wait: two children
+            // could wait for each other
+            pthread_mutex_unlock(&m_table->mutex);
+            return SF_ALONE;
+        }
+        if(!waited) m_table->stats.followers++;
+        waited = true;
+        // the dead leader does not broadcast: wake up to check it is alive
+        clock_gettime(CLOCK_MONOTONIC, &probe);
+        addMs(probe, SINGLEFLIGHT_PROBE);
+        const bool last = !is_before(probe, deadline);
+        int rv = pthread_cond_timedwait(&m_table->done, &m_table->mutex, last ? &deadline : &probe);
+        if(rv == EOWNERDEAD) pthread_mutex_consistent(&m_table->mutex);
+        else if(rv == ETIMEDOUT && last) {
+            m_table->stats.timeouts++;
+            pthread_mutex_unlock(&m_table->mutex);
+            return SF_ALONE;
+        }
+    }
+}
+
+void CSingleFlight::end(int slot) {
+    if(!m_table || slot < 0 || slot >= SINGLEFLIGHT_SLOTS) return;
+    lock();
+    if(m_leading) m_leading--;
+    m_table->flights[slot].hash = 0;
+    pthread_cond_broadcast(&m_table->done);
+    pthread_mutex_unlock(&m_table->mutex);
+}
+
+void CSingleFlight::logStats() {
+    sfStats_t st;
+    if(!m_table) return;
+    lock();
+    st = m_table->stats;
+    pthread_mutex_unlock(&m_table->mutex);
+    log_message("singleflight: leaders %lu, followers %lu, timeouts %lu, takeovers %lu, overflows %lu",
+                st.leaders, st.followers, st.timeouts, st.takeovers, st.overflows);
+}
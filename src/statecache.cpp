@@ -0,0 +1,153 @@
+/**
+ * @file   statecache.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Tue Oct 20 16:48:19 2026
+ *
+ * @brief  State results memoization staff
+ *
+ */
+
+#include "config.h"
+#include <sys/mman.h>
+#include <stdint.h>
+#include <cerrno>
+#include <cstring>
+#include <set>
+#include <algorithm>
+#include <boost/property_tree/ptree.hpp>
+#include "apputils.hpp"
+#include "statecache.hpp"
+#include "singleflight.hpp"
+
+namespace pt = boost::property_tree;
+extern pt::ptree *cpt;                       // property tree: global configuration
+
+CShmCache stateCache;
+
+static bool stateCacheUsed = false;          // a state with cache clause is parsed
+
+struct cacheTag_t {
+    uint64_t hash;                           // 0 - empty slot
+    volatile uint64_t generation;            // changed by master, read by the children
+};
+
+static std::set<std::string> tagNames;       // filled by the parser
+static cacheTag_t *cacheTags = nullptr;      // shared, open addressing
+
+// called by the parser for the states with cache clause
+void stateCacheRequired() {
+    stateCacheUsed = true;
+}
+
+// called by the parser for the states with tags clause
+void stateCacheTag(const std::string& tag) {
+    tagNames.insert(tag);
+}
+
+static cacheTag_t* findTag(const std::string& tag) {
+    if(!cacheTags) return nullptr;
+    const uint64_t hash = hash64(tag.data(), tag.size());
+    for(size_t i = 0; i < STATECACHE_TAGS; i++) {
+        cacheTag_t *t = &cacheTags[(hash + i) % STATECACHE_TAGS];
+        if(t->hash == hash) return t;
+        if(t->hash == 0) return nullptr;
+    }
+    return nullptr;
+}
+
+static void cacheTagsInit() {
+    void *mem = mmap(nullptr, STATECACHE_TAGS * sizeof(cacheTag_t), PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED, -1, 0);
+    if(mem == MAP_FAILED) {
+        log_warning("%s: mmap failed: %s", __func__, strerror(errno));
+        return;
+    }
+    cacheTags = (cacheTag_t*)mem;
+    size_t n = 0;
+    for(const auto &it : tagNames) {
+        if(++n > STATECACHE_TAGS / 2) {
+            log_warning("%s: too many cache tags, %s and the rest are not invalidated", __func__, it.c_str());
+            break;
+        }
+        const uint64_t hash = hash64(it.data(), it.size());
+        size_t i = hash % STATECACHE_TAGS;
+        while(cacheTags[i].hash != 0 && cacheTags[i].hash != hash) i = (i + 1) % STATECACHE_TAGS;
+        cacheTags[i].hash = hash;
+    }
+    log_message("%s: %zu cache tags", __func__, std::min(tagNames.size(), (size_t)STATECACHE_TAGS / 2));
+}
+
+// 0 for the unknown tag
+uint64_t cacheTagGeneration(const std::string& tag) {
+    cacheTag_t *t = findTag(tag);
+    return t ? __sync_add_and_fetch(&t->generation, 0) : 0;
+}
+
+// false if no script uses the tag
+bool invalidateCacheTag(const std::string& tag) {
+    cacheTag_t *t = findTag(tag);
+    if(!t) return false;
+    __sync_fetch_and_add(&t->generation, 1);
+    return true;
+}
+
+// notifications may be lost: the listener connection was broken
+void invalidateCacheTags() {
+    for(size_t i = 0; cacheTags && i < STATECACHE_TAGS; i++)
+        if(cacheTags[i].hash) __sync_fetch_and_add(&cacheTags[i].generation, 1);
+}
+
+// called by master before fork
+void stateCacheInit() {
+    const bool globals = cpt->get<bool>("common.singleflight_globals", false);
+    if(stateCacheUsed)
+        stateCache.create("statecache", cpt->get<size_t>("statecache.size", STATECACHE_SIZE),
+                          cpt->get<size_t>("statecache.maxentry", STATECACHE_MAXENTRY));
+    if(stateCache.is_enabled() && tagNames.size()) cacheTagsInit();
+    // identical concurrent misses wait for the first child
+    if(stateCache.is_enabled() || globals)
+        singleFlight.create(cpt->get<unsigned>("common.singleflight_wait", SINGLEFLIGHT_WAIT), globals);
+}
+
+// value format: 'N' for null or 'S', 4 bytes length and the string itself
+void memoPack(std::string& out, const char *value) {
+    if(!value) {
+        out.push_back('N');
+        return;
+    }
+    uint32_t len = strlen(value);
+    out.push_back('S');
+    out.append((const char*)&len, sizeof(len));
+    out.append(value, len);
+}
+
+void memoPack(std::string& out, const std::string& value) {
+    uint32_t len = value.size();
+    out.push_back('S');
+    out.append((const char*)&len, sizeof(len));
+    out.append(value);
+}
+
+/**
+ * @fn bool memoUnpack(const std::string& in, size_t& pos, const char **value, size_t *len)
+ * @brief gets the next value from the packed result
+ * @param pos -- (in/out) current position
+ * @param value -- (out) pointer into in, nullptr for null value
+ * @return false if there is no more values or the data is malformed
+ */
+bool memoUnpack(const std::string& in, size_t& pos, const char **value, size_t *len) {
+    uint32_t l;
+    if(pos >= in.size()) return false;
+    if(in[pos] == 'N') {
+        pos++;
+        *value = nullptr;
+        *len = 0;
+        return true;
+    }
+    if(in[pos] != 'S' || pos + 1 + sizeof(l) > in.size()) return false;
+    memcpy(&l, in.data() + pos + 1, sizeof(l));
+    if(pos + 1 + sizeof(l) + l > in.size()) return false;
+    *value = in.data() + pos + 1 + sizeof(l);
+    *len = l;
+    pos += 1 + sizeof(l) + l;
+    return true;
+}
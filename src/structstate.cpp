@@ -8,6 +8,7 @@
 
 #include "config.h"
 #include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/xml_parser.hpp>
@@ -15,6 +16,7 @@
 #include "parser.hpp"
 #include "cassigner.hpp"
 #include "apputils.hpp"
+#include "statecache.hpp"
 
 namespace pt = boost::property_tree;
 extern const char *syntax_error;
@@ -24,7 +26,7 @@ extern const char *syntax_error;
 // *********************************************************************
 
 CStructureState::CStructureState(const int stateno, const std::string& scriptName):
-    CState(stateno, scriptName, "structure"), m_sformat(FUNSET) {};
+    CState(stateno, scriptName, "structure"), m_sformat(FUNSET), m_memoActive(false) {};
 
 CStructureState::~CStructureState() {
     for(auto &it : m_assignments) delete it;
@@ -46,10 +48,38 @@ int CStructureState::parse(const std::string& line, const std::string& file, uns
         set_sformat(FJSON);
         log_debug("%s:%s:%u: json format matched", file.c_str(), get_stateName().c_str(), counter);
     }
-    else m_assignments.push_back(parseAssignment(line, get_number(), file, counter));
+    else if(is_matched("cache", line, regmatch, 0, file, counter)) {
+        regoff_t len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        set_cacheTTL(boost::lexical_cast<unsigned>(line.substr(regmatch[1].rm_so, len)));
+        stateCacheRequired();
+    }
+    else {
+        m_assignments.push_back(parseAssignment(line, get_number(), file, counter));
+        addMemoNames(m_assignments.back());
+    }
     return 0;
 }
 
+// collects $names used by the assignment: these values are memoized
+void CStructureState::addMemoNames(const assignmentList_t *assignment) {
+    assignmentList_t::const_iterator it = assignment->begin();
+    for(++it; it != assignment->end(); ++it) {
+        std::string::size_type pos = 0;
+        if((*it)[0] == '$') {
+            m_memoNames.push_back(*it);
+            continue;
+        }
+        if((*it)[0] != '"') continue;
+        // "... $name ..." string
+        while((pos = it->find('$', pos)) != std::string::npos) {
+            std::string::size_type end = pos + 1;
+            while(end < it->length() && (isalnum((*it)[end]) || (*it)[end] == '_' || (*it)[end] == '.')) end++;
+            if(end > pos + 1) m_memoNames.push_back(it->substr(pos, end - pos));
+            pos = end;
+        }
+    }
+}
+
 bool CStructureState::verify() {
     return
         m_sformat != FUNSET && 
@@ -63,12 +93,43 @@ int CStructureState::execute(const FCGX_Request *request, CAssigner* assigner) {
     char *val = assigner->getValue(m_matchVar);
     int next = get_errorState();
     m_pt.clear(); // cleanup
+    m_memo.clear();
+    m_memoActive = false;
     if(val) {
         try {
-            std::stringstream ss;
-            ss << val;
-            if(m_sformat == FJSON) pt::read_json(ss, m_pt);
-            else pt::read_xml(ss, m_pt);
+            std::string memoKey("");
+            std::string memo("");
+            if(get_cacheTTL()) {
+                // the names memoized differ from state to state
+                memoKey = m_sformat == FJSON ? "json" : "xml";
+                memoKey.push_back('\0');
+                memoKey.append(get_scriptName());
+                memoKey.push_back('\0');
+                memoKey.append(boost::lexical_cast<std::string>(get_number()));
+                memoKey.push_back('\0');
+                memoKey.append(val);
+            }
+            if(memoKey.length() && stateCache.get(memoKey, memo)) {
+                // name, value pairs
+                const char *name, *value;
+                size_t nlen, vlen, pos = 0;
+                while(memoUnpack(memo, pos, &name, &nlen) && memoUnpack(memo, pos, &value, &vlen))
+                    if(name && value) m_memo[std::string(name, nlen)] = std::string(value, vlen);
+                m_memoActive = true;
+            }
+            else {
+                std::stringstream ss;
+                ss << val;
+                if(m_sformat == FJSON) pt::read_json(ss, m_pt);
+                else pt::read_xml(ss, m_pt);
+                if(memoKey.length()) {
+                    for(const auto &it : m_memoNames) {
+                        memoPack(memo, it);
+                        memoPack(memo, m_pt.get<std::string>(it.substr(1), ""));
+                    }
+                    stateCache.put(memoKey, memo, get_cacheTTL());
+                }
+            }
             if(m_assignments.size()) {
                 for(unsigned i = 0; i < m_assignments.size(); ++i) {
                     assigner->assign(m_assignments[i], this);
@@ -91,6 +152,13 @@ int CStructureState::execute(const FCGX_Request *request, CAssigner* assigner) {
 }
 
 char* CStructureState::getPropositional(const std::string& name) const {
+    if(m_memoActive) {
+        const auto it = m_memo.find(name);
+        if(it != m_memo.end() && it->second.length() > 0) return strdup(it->second.c_str());
+        log_warning("%s:%s:%d: %s: no value", get_scriptName().c_str(),
+                    get_stateName().c_str(), get_number(), name.c_str());
+        return nullptr;
+    }
     try {
         std::string val = m_pt.get<std::string>(name.substr(1), "");
         if(val.length() > 0) return strdup(val.c_str());
@@ -0,0 +1,69 @@
+/**
+ * @file   transactionstate.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Wed Oct 21 15:02:44 2026
+ *
+ * @brief  CTransactionState class implementation: begin, commit or rollback
+ *         of the explicit transaction, the query states in between run in it
+ *
+ */
+
+#include "config.h"
+#include "apputils.hpp"
+#include "cstate.hpp"
+#include "parser.hpp"
+#include "cassigner.hpp"
+#include "database.hpp"
+
+namespace pt = boost::property_tree;
+extern pt::ptree *cpt;                       // property tree: global configuration
+extern const char *syntax_error;
+
+// *********************************************************************
+// *** CTransactionState
+// *********************************************************************
+
+CTransactionState::CTransactionState(const int stateno, const std::string& scriptName):
+    CState(stateno, scriptName, "transaction"), m_dbsection(""), m_action("") { };
+
+CTransactionState::~CTransactionState() {};
+
+int CTransactionState::parse(const std::string& line, const std::string& file, unsigned counter) {
+    regmatch_t regmatch[REGMATCH_COUNT];
+    regoff_t len;
+    if(is_matched("db", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_dbsection = line.substr(regmatch[1].rm_so, len);
+        if(cpt->find(m_dbsection) == cpt->not_found()) {
+            log_error("%s:%u: '%s' database section is not defined in configuration!",
+                      file.c_str(), counter, m_dbsection.c_str());
+        }
+        addDBSection(m_dbsection);
+    }
+    else if(is_matched("txaction", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_action = line.substr(regmatch[1].rm_so, len);
+    }
+    else throw parser_error(file, syntax_error, counter);
+    return 0;
+}
+
+bool CTransactionState::verify() {
+    if(get_errorState() == 0) set_errorState(get_nextState());
+    return get_nextState() > 0 && m_dbsection.length() > 0 && m_action.length() > 0;
+}
+
+int CTransactionState::execute(const FCGX_Request *request, CAssigner* assigner) {
+    try {
+        CDatabase *db = getDatabase(m_dbsection);
+        if(m_action == "begin") db->begin();
+        else if(m_action == "commit") db->commit();
+        else db->rollback();
+    }
+    catch(const std::exception& e) {
+        log_warning("%s:%s:%d: %s: %s", get_scriptName().c_str(), get_stateName().c_str(),
+                    get_number(), m_action.c_str(), e.what());
+        return get_errorState();
+    }
+    return get_nextState();
+}
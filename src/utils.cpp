@@ -16,6 +16,10 @@
 
 #define LOGBUFF_SIZE 256
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 static bool debug_mode = true; // altered by the init_syslog function
 
 /**
@@ -193,3 +197,81 @@ void log_message(const char *format, ...) {
     vlog(LOG_INFO, severity, format, args);
     va_end(args);
 }
+
+/**
+ * @fn int sendFd(int chan, int fd, char tag)
+ * @brief passes the descriptor to the other process over unix domain socket
+ * @param chan -- unix domain socket
+ * @param fd -- descriptor to pass
+ * @param tag -- one byte of data sent along with descriptor
+ * @return 0 if success, errno otherwise
+ */
+int sendFd(int chan, int fd, char tag) {
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        struct cmsghdr cm;
+        char control[CMSG_SPACE(sizeof(int))];
+    } cmsgbuf;
+
+    bzero(&msg, sizeof(msg));
+    bzero(&cmsgbuf, sizeof(cmsgbuf));
+    iov.iov_base = &tag;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsgbuf.control;
+    msg.msg_controllen = sizeof(cmsgbuf.control);
+
+    struct cmsghdr *cmptr = CMSG_FIRSTHDR(&msg);
+    cmptr->cmsg_len = CMSG_LEN(sizeof(int));
+    cmptr->cmsg_level = SOL_SOCKET;
+    cmptr->cmsg_type = SCM_RIGHTS;
+    memcpy(CMSG_DATA(cmptr), &fd, sizeof(int));
+
+    while(sendmsg(chan, &msg, MSG_NOSIGNAL) < 0) {
+        if(errno != EINTR) return errno;
+    }
+    return 0;
+}
+
+/**
+ * @fn int recvFd(int chan, char *tag)
+ * @brief receives the descriptor passed by sendFd
+ * @param chan -- unix domain socket
+ * @param tag -- (out) one byte of data sent along with descriptor
+ * @return descriptor, -1 on error (errno is set) or if the peer closed the channel
+ *         (errno is 0)
+ */
+int recvFd(int chan, char *tag) {
+    struct msghdr msg;
+    struct iovec iov;
+    ssize_t n;
+    int fd = -1;
+    union {
+        struct cmsghdr cm;
+        char control[CMSG_SPACE(sizeof(int))];
+    } cmsgbuf;
+
+    bzero(&msg, sizeof(msg));
+    iov.iov_base = tag;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsgbuf.control;
+    msg.msg_controllen = sizeof(cmsgbuf.control);
+
+    while((n = recvmsg(chan, &msg, 0)) < 0) {
+        if(errno != EINTR) return -1;
+    }
+    if(n == 0) {
+        errno = 0;
+        return -1;
+    }
+    struct cmsghdr *cmptr = CMSG_FIRSTHDR(&msg);
+    if(cmptr && cmptr->cmsg_len == CMSG_LEN(sizeof(int)) &&
+       cmptr->cmsg_level == SOL_SOCKET && cmptr->cmsg_type == SCM_RIGHTS)
+        memcpy(&fd, CMSG_DATA(cmptr), sizeof(int));
+    else errno = EBADMSG;
+    return fd;
+}
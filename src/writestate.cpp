@@ -0,0 +1,91 @@
+/**
+ * @file   writestate.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Fri Oct 23 16:10:37 2026
+ *
+ * @brief  CWriteState class implementation: the row is added to the child
+ *         buffer of the table, the buffers go to the database with COPY
+ *
+ */
+
+#include "config.h"
+#include <boost/algorithm/string.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include "apputils.hpp"
+#include "cstate.hpp"
+#include "parser.hpp"
+#include "cassigner.hpp"
+#include "database.hpp"
+#include "copybuffer.hpp"
+
+namespace pt = boost::property_tree;
+extern pt::ptree *cpt;                       // property tree: global configuration
+extern const char *syntax_error;
+
+// *********************************************************************
+// *** CWriteState
+// *********************************************************************
+
+CWriteState::CWriteState(const int stateno, const std::string& scriptName):
+    CState(stateno, scriptName, "write"), m_dbsection(""), m_table("") { };
+
+CWriteState::~CWriteState() {};
+
+int CWriteState::parse(const std::string& line, const std::string& file, unsigned counter) {
+    regmatch_t regmatch[REGMATCH_COUNT];
+    regoff_t len;
+    if(is_matched("db", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_dbsection = line.substr(regmatch[1].rm_so, len);
+        if(cpt->find(m_dbsection) == cpt->not_found()) {
+            log_error("%s:%u: '%s' database section is not defined in configuration!",
+                      file.c_str(), counter, m_dbsection.c_str());
+        }
+        addDBSection(m_dbsection);
+    }
+    else if(is_matched("table", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_table = line.substr(regmatch[1].rm_so, len);
+        m_columns.clear();
+        if(regmatch[3].rm_so >= 0) {
+            len = regmatch[3].rm_eo - regmatch[3].rm_so;
+            std::string columns = line.substr(regmatch[3].rm_so, len);
+            boost::split(m_columns, columns, boost::is_any_of(","));
+            for(auto &it : m_columns) boost::trim(it);
+        }
+    }
+    else if(is_matched("value", line, regmatch, 0, file, counter)) {
+        len = regmatch[1].rm_eo - regmatch[1].rm_so;
+        m_values.push_back(line.substr(regmatch[1].rm_so, len));
+    }
+    else throw parser_error(file, syntax_error, counter);
+    return 0;
+}
+
+bool CWriteState::verify() {
+    if(get_errorState() == 0) set_errorState(get_nextState());
+    if(m_columns.size() && m_columns.size() != m_values.size()) {
+        log_warning("%s:%d: %zu columns, %zu values", get_scriptName().c_str(), get_number(),
+                    m_columns.size(), m_values.size());
+        return false;
+    }
+    return get_nextState() > 0 && m_dbsection.length() > 0 && m_table.length() > 0 && m_values.size() > 0;
+}
+
+int CWriteState::execute(const FCGX_Request *request, CAssigner* assigner) {
+    try {
+        std::string line(""), value;
+        for(size_t i = 0; i < m_values.size(); i++) {
+            value = "";
+            assigner->evaluate(m_values[i], value, this);
+            if(i) line.push_back('\t');
+            line.append(copyEscape(value.c_str()));
+        }
+        copyAppend(m_dbsection, m_table, m_columns, line);
+    }
+    catch(const std::exception& e) {
+        log_warning("%s:%s:%d: %s", get_scriptName().c_str(), get_stateName().c_str(), get_number(), e.what());
+        return get_errorState();
+    }
+    return get_nextState();
+}
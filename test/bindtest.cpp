@@ -0,0 +1,82 @@
+/**
+ * @file   bindtest.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Mon Oct 19 14:21:07 2026
+ *
+ * @brief  Variables of the query turned into the placeholders of the
+ *         prepared statement: quoting, concatenation inside the literals
+ *         and the queries left to interpolation
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/property_tree/ptree.hpp>
+#include "parser.hpp"
+#include "cstate.hpp"
+
+namespace pt = boost::property_tree;
+pt::ptree *cpt;                      // property tree: global configuration
+
+static int failures = 0;
+
+// state 5, the short form @var is @5.var
+static void check(const char *query, const char *expected, const char *vars = "") {
+    std::string statement;
+    std::vector<std::string> names;
+    const bool prepared = bindVariables(query, 5, statement, names);
+    std::string joined("");
+    for(size_t i = 0; i < names.size(); i++) {
+        if(i) joined.push_back(' ');
+        joined.append(names[i]);
+    }
+    if(!expected) {
+        if(prepared) {
+            std::cerr << query << ": prepared as '" << statement << "', expected interpolation" << std::endl;
+            failures++;
+        }
+        return;
+    }
+    if(!prepared || statement != expected || joined != vars) {
+        std::cerr << query << ": " << (prepared ? "'" + statement + "' [" + joined + "]" : "not prepared")
+                  << ", expected '" << expected << "' [" << vars << "]" << std::endl;
+        failures++;
+    }
+}
+
+int main(int ac, char **av) {
+    if(openRegexCollection(ac > 1 ? av[1] : "../conf/regexlib.dat")) return 1;
+
+    check("select * from t where id = @id", "select * from t where id = $1", "@5.id");
+    check("select * from t where a = @3.a and b = &b", "select * from t where a = $1 and b = $2", "@3.a &b");
+    // the variable quoted alone loses the quotes, inside a literal it is concatenated
+    check("select * from t where name = '@name'", "select * from t where name = $1", "@5.name");
+    check("select * from t where name like 'a@name%'",
+          "select * from t where name like ('a' || $1::text || '%')", "@5.name");
+    check("select * from t where name like '@name%'",
+          "select * from t where name like ($1::text || '%')", "@5.name");
+    check("select '@a-@b'", "select ($1::text || '-' || $2::text)", "@5.a @5.b");
+    // literals without variables are kept as they are
+    check("select '' as e, 'it''s' as s from t where id = @id", "select '' as e, 'it''s' as s from t where id = $1", "@5.id");
+    check("select 'it''s @name'", "select ('it''s ' || $1::text)", "@5.name");
+    // the escaped @ is not a variable
+    check("select 'mail\\@host' from t where id = @id", "select 'mail@host' from t where id = $1", "@5.id");
+    // the backslash of E'' escapes the quote, the literal does not end there
+    check("select E'\\\\'' from t where id = @id", "select E'\\'' from t where id = $1", "@5.id");
+    check("select E'\\\\'', @id", "select E'\\'', $1", "@5.id");
+    check("select name, '\\\\', @id", "select name, '\\', $1", "@5.id");
+
+    // left to interpolation
+    check("select $1 from t where id = @id", nullptr);
+    check("select * from t where name = '$1'", nullptr);
+    check("select * from \"@table\"", nullptr);
+    check("select E'\\\\@name'", nullptr);
+    check("select $tag$it's @name$tag$", nullptr);
+    check("select $$it's$$ from t where id = @id", nullptr);
+    check("select * from t where name = 'open", nullptr);
+
+    freeRegexCollection();
+    std::cout << (failures ? "FAILED" : "OK") << std::endl;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,123 @@
+/**
+ * @file   circuittest.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Mon Oct 19 15:37:18 2026
+ *
+ * @brief  Circuit breaker state machine: closed -> open on the failures in
+ *         a row or the error rate, open -> half-open after opentime, the
+ *         probe closing or opening it again, the probe released, stale or
+ *         dead replaced
+ *
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <boost/property_tree/ptree.hpp>
+#include "circuitbreaker.hpp"
+
+namespace pt = boost::property_tree;
+pt::ptree *cpt;                      // property tree: global configuration
+
+#define OPENTIME 200                 // ms
+
+static int failures = 0;
+
+static void check(const char *what, bool value, bool expected) {
+    if(value != expected) {
+        std::cerr << what << ": " << value << ", expected " << expected << std::endl;
+        failures++;
+    }
+}
+
+static inline void waitOpenTime() {
+    usleep((OPENTIME + 50) * 1000);
+}
+
+int main(int ac, char **av) {
+    cpt = new pt::ptree;
+    if(circuitBreaker.create()) {
+        std::cerr << "circuit breaker without [circuitbreaker] section" << std::endl;
+        return 1;
+    }
+    check("no breaker", circuitBreaker.allow("http://any/"), true);
+
+    cpt->put("circuitbreaker.failures", 3);
+    cpt->put("circuitbreaker.errorrate", 50);
+    cpt->put("circuitbreaker.minrequests", 10);
+    cpt->put("circuitbreaker.window", 10);
+    cpt->put("circuitbreaker.opentime", OPENTIME);
+    if(!circuitBreaker.create()) {
+        std::cerr << "circuit breaker is not created" << std::endl;
+        return 1;
+    }
+
+    // closed -> open: failures in a row, a success starts them over
+    const std::string url("http://upstream:8080/get?id=1");
+    circuitBreaker.record(url, false);
+    circuitBreaker.record(url, false);
+    circuitBreaker.record(url, true);
+    circuitBreaker.record(url, false);
+    circuitBreaker.record(url, false);
+    check("2 failures in a row", circuitBreaker.allow(url), true);
+    circuitBreaker.record(url, false);
+    check("3 failures in a row", circuitBreaker.allow(url), false);
+    check("other path of the upstream", circuitBreaker.allow("http://upstream:8080/other"), false);
+    check("other upstream", circuitBreaker.allow("http://upstream:8081/get"), true);
+
+    // open -> half-open: one probe, the others are rejected; the failed probe opens it again
+    waitOpenTime();
+    check("probe", circuitBreaker.allow(url), true);
+    check("call during the probe", circuitBreaker.allow(url), false);
+    circuitBreaker.record(url, false);
+    check("probe failed", circuitBreaker.allow(url), false);
+
+    // the probe released is replaced at once
+    waitOpenTime();
+    check("second probe", circuitBreaker.allow(url), true);
+    circuitBreaker.release(url);
+    check("probe released", circuitBreaker.allow(url), true);
+
+    // the probe not over in opentime is replaced by another child, the stale
+    // one does not close the circuit
+    pid_t pid = fork();
+    if(pid == 0) {
+        if(circuitBreaker.allow(url)) _exit(1);
+        waitOpenTime();
+        _exit(circuitBreaker.allow(url) ? 0 : 2);
+    }
+    int status = -1;
+    waitpid(pid, &status, 0);
+    check("stale probe replaced", WIFEXITED(status) && WEXITSTATUS(status) == 0, true);
+    circuitBreaker.record(url, true);
+    check("stale probe succeeded", circuitBreaker.allow(url), false);
+
+    // the dead probe is replaced too; half-open -> closed
+    waitOpenTime();
+    check("third probe", circuitBreaker.allow(url), true);
+    circuitBreaker.record(url, true);
+    check("closed", circuitBreaker.allow(url), true);
+    check("closed, next call", circuitBreaker.allow(url), true);
+    circuitBreaker.record(url, false);
+    circuitBreaker.record(url, false);
+    check("closed, failures start over", circuitBreaker.allow(url), true);
+
+    // closed -> open: the error rate after minrequests calls of the window,
+    // the upstream is counted from its first failure
+    const std::string rate("https://rate:443/");
+    circuitBreaker.record(rate, true);
+    for(int i = 0; i < 4; i++) {
+        circuitBreaker.record(rate, false);
+        circuitBreaker.record(rate, true);
+    }
+    circuitBreaker.record(rate, true);
+    check("error rate before minrequests", circuitBreaker.allow(rate), true);
+    circuitBreaker.record(rate, false);
+    check("error rate 50%", circuitBreaker.allow(rate), false);
+
+    circuitBreaker.destroy();
+    std::cout << (failures ? "FAILED" : "OK") << std::endl;
+    return failures ? 1 : 0;
+}
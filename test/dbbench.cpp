@@ -0,0 +1,117 @@
+/**
+ * @file   dbbench.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Fri Oct 23 12:20:44 2026
+ *
+ * @brief  Key lookups in the local SQLite file (dbtype = sqlite) vs the same
+ *         prepared lookups in Postgres over loopback. The SQLite file is
+ *         created with the given number of rows; Postgres is skipped when
+ *         it is not reachable.
+ *
+ *   dbbench [-c conninfo] [-f file] [-n lookups] [-r rows]
+ */
+
+#include "config.h"
+#include <sys/time.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <pqxx/pqxx>
+#include <sqlite3.h>
+#include "database.hpp"
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static void report(const char *name, double usec, int lookups) {
+    printf("%-10s %8.2f usec per lookup\n", name, usec / lookups);
+}
+
+static const char *lookup = "select val from lookup where id = $1";
+
+static bool createFile(const std::string& file, int rows) {
+    sqlite3 *db;
+    unlink(file.c_str());
+    if(sqlite3_open(file.c_str(), &db) != SQLITE_OK) return false;
+    std::string sql("create table lookup(id integer primary key, val text);\nbegin;\n");
+    for(int i = 0; i < rows; i++)
+        sql += "insert into lookup values(" + std::to_string(i) + ", 'value " + std::to_string(i) + "');\n";
+    sql += "commit;";
+    bool ok = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+    sqlite3_close(db);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    std::string conninfo("dbname=smarty user=smarty password=smarty host=127.0.0.1");
+    std::string file("dbbench.dat");
+    int lookups = 100000, rows = 10000, opt;
+    while((opt = getopt(argc, argv, "c:f:n:r:")) != -1) {
+        switch(opt) {
+        case 'c': conninfo = optarg; break;
+        case 'f': file = optarg; break;
+        case 'n': lookups = atoi(optarg); break;
+        case 'r': rows = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-c conninfo] [-f file] [-n lookups] [-r rows]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(!createFile(file, rows)) {
+        fprintf(stderr, "%s: can not be created\n", file.c_str());
+        return 1;
+    }
+    double start;
+    try {
+        // the query state path: prepared once, a row per lookup
+        CSqliteDatabase db(file, SQLITE_MMAP_SIZE);
+        db.checkout();
+        start = now();
+        for(int n = 0; n < lookups; n++) {
+            std::string key = std::to_string(n % rows);
+            qparams_t params(1, key.c_str());
+            CQueryResult *r = db.execPrepared("lookup", lookup, params, false);
+            if(!r || !r->value(0)) {
+                fprintf(stderr, "sqlite: %s: not found\n", key.c_str());
+                return 1;
+            }
+            delete r;
+        }
+        report("sqlite", now() - start, lookups);
+    }
+    catch(const std::exception& e) {
+        fprintf(stderr, "sqlite: %s\n", e.what());
+        return 1;
+    }
+    unlink(file.c_str());
+
+    try {
+        pqxx::connection conn(conninfo);
+        {
+            pqxx::work w(conn);
+            w.exec("create temporary table lookup(id integer primary key, val text)");
+            w.exec("insert into lookup select i, 'value ' || i from generate_series(0, " +
+                   std::to_string(rows - 1) + ") i");
+            w.commit();
+        }
+        conn.prepare("lookup", lookup);
+        start = now();
+        for(int n = 0; n < lookups; n++) {
+            pqxx::nontransaction w(conn);
+            pqxx::result r = w.prepared("lookup")(std::to_string(n % rows)).exec();
+            if(r.empty()) {
+                fprintf(stderr, "postgres: %d: not found\n", n % rows);
+                return 1;
+            }
+        }
+        report("postgres", now() - start, lookups);
+    }
+    catch(const std::exception& e) {
+        fprintf(stderr, "postgres skipped: %s\n", e.what());
+    }
+    return 0;
+}
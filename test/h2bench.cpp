@@ -0,0 +1,122 @@
+/**
+ * @file   h2bench.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Tue Oct 27 11:36:08 2026
+ *
+ * @brief  Upstream calls of a child the way the http and fanout states make
+ *         them: the handles of the curl pool, rounds of parallel calls on
+ *         its multi handle. HTTP/1.1 vs HTTP/2 and plain vs compressed
+ *         replies: connections opened, bytes on the wire, time per call.
+ *
+ *   h2bench [-k] [-c parallel] [-n calls] url
+ */
+
+#include "config.h"
+#include <sys/time.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <curl/curl.h>
+#include "curlpool.hpp"
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static size_t writer(char *data, size_t size, size_t nmemb, size_t *body) {
+    *body += size * nmemb;
+    return size * nmemb;
+}
+
+struct result_t {
+    long connects;
+    curl_off_t wire;          // headers and the body as received
+    size_t body;              // decoded
+    int failed;
+};
+
+static result_t run(const std::string& url, bool http2, bool compress, bool insecure, int parallel, int calls) {
+    result_t r = { 0, 0, 0, 0 };
+    CURLM *multi = curlPool.multi();
+    for(int done = 0; done < calls; done += parallel) {
+        std::vector<CURL*> handles;
+        for(int i = 0; i < parallel && done + i < calls; i++) {
+            CURL *h = curlPool.acquire(url);
+            curl_easy_setopt(h, CURLOPT_URL, url.c_str());
+            curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, writer);
+            curl_easy_setopt(h, CURLOPT_WRITEDATA, &r.body);
+            if(insecure) {
+                curl_easy_setopt(h, CURLOPT_SSL_VERIFYPEER, 0L);
+                curl_easy_setopt(h, CURLOPT_SSL_VERIFYHOST, 0L);
+            }
+            if(compress) curl_easy_setopt(h, CURLOPT_ACCEPT_ENCODING, "");
+            if(http2) {
+                curl_easy_setopt(h, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+                curl_easy_setopt(h, CURLOPT_PIPEWAIT, 1L);
+            }
+            else curl_easy_setopt(h, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_1_1);
+            curl_multi_add_handle(multi, h);
+            handles.push_back(h);
+        }
+        int active = 1, msgs;
+        CURLMsg *msg;
+        while(active) {
+            curl_multi_perform(multi, &active);
+            while((msg = curl_multi_info_read(multi, &msgs)))
+                if(msg->msg == CURLMSG_DONE && msg->data.result != CURLE_OK) r.failed++;
+            if(active) curl_multi_wait(multi, nullptr, 0, 1000, nullptr);
+        }
+        for(auto h : handles) {
+            long connects = 0, headers = 0;
+            curl_off_t size = 0;
+            curl_easy_getinfo(h, CURLINFO_NUM_CONNECTS, &connects);
+            curl_easy_getinfo(h, CURLINFO_HEADER_SIZE, &headers);
+            curl_easy_getinfo(h, CURLINFO_SIZE_DOWNLOAD_T, &size);
+            r.connects += connects;
+            r.wire += headers + size;
+            curl_multi_remove_handle(multi, h);
+            curlPool.release(url, h);
+        }
+    }
+    return r;
+}
+
+int main(int argc, char **argv) {
+    int parallel = 8, calls = 400, opt;
+    bool insecure = false;
+    while((opt = getopt(argc, argv, "kc:n:")) != -1) {
+        switch(opt) {
+        case 'k': insecure = true; break;
+        case 'c': parallel = atoi(optarg); break;
+        case 'n': calls = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-k] [-c parallel] [-n calls] url\n", argv[0]);
+            return 1;
+        }
+    }
+    if(optind >= argc || parallel < 1) {
+        fprintf(stderr, "usage: %s [-k] [-c parallel] [-n calls] url\n", argv[0]);
+        return 1;
+    }
+    const std::string url(argv[optind]);
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    printf("%-20s %9s %12s %12s %10s %7s\n", "", "connects", "wire bytes", "body bytes", "usec/call", "failed");
+    for(int mode = 0; mode < 4; mode++) {
+        const bool http2 = mode >= 2, compress = mode & 1;
+        curlPool.init();                // every mode starts with no connections
+        const double start = now();
+        result_t r = run(url, http2, compress, insecure, parallel, calls);
+        const double usec = now() - start;
+        printf("%-20s %9ld %12lld %12zu %10.1f %7d\n",
+               http2 ? (compress ? "HTTP/2 compressed" : "HTTP/2") : (compress ? "HTTP/1.1 compressed" : "HTTP/1.1"),
+               r.connects, (long long)r.wire, r.body, usec / calls, r.failed);
+        curlPool.cleanup();
+    }
+    curl_global_cleanup();
+    return 0;
+}
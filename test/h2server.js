@@ -0,0 +1,40 @@
+/**
+ * @file   h2server.js
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Tue Oct 27 11:36:08 2026
+ *
+ * @brief  Upstream for h2bench: HTTP/2 and HTTP/1.1 over TLS, a reference
+ *         JSON document compressed with br or gzip as the client accepts.
+ *         Counts the TCP connections, prints them on SIGTERM.
+ *
+ *   node h2server.js port key.pem cert.pem
+ */
+
+const http2 = require('http2');
+const zlib = require('zlib');
+const fs = require('fs');
+
+const [port, key, cert] = process.argv.slice(2);
+let connections = 0;
+
+// exchange rates like document, 64 KB or so
+const rates = [];
+for (let i = 0; i < 600; i++)
+    rates.push({ code: 'C' + i, name: 'Currency ' + i, rate: (1 + i / 1000).toFixed(6), updated: '2026-10-27T11:00:00Z' });
+const body = Buffer.from(JSON.stringify({ base: 'USD', rates: rates }));
+const encoded = { br: zlib.brotliCompressSync(body), gzip: zlib.gzipSync(body) };
+
+const server = http2.createSecureServer({ key: fs.readFileSync(key), cert: fs.readFileSync(cert), allowHTTP1: true },
+    (req, res) => {
+        const accept = req.headers['accept-encoding'] || '';
+        const encoding = ['br', 'gzip'].find(e => accept.includes(e));
+        res.setHeader('content-type', 'application/json');
+        if (encoding) res.setHeader('content-encoding', encoding);
+        res.end(encoding ? encoded[encoding] : body);
+    });
+server.on('secureConnection', () => connections++);
+process.on('SIGTERM', () => {
+    console.log(`h2server: ${connections} connections`);
+    process.exit(0);
+});
+server.listen(port);
@@ -0,0 +1,210 @@
+/**
+ * @file   httpbench.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Mon Oct 19 16:02:11 2026
+ *
+ * @brief  HTTP load test. Compares the native HTTP front end latency with the
+ *         web server + FastCGI chain: run it against both with the same URI.
+ *
+ *   httpbench [-c clients] [-n requests] [-k] host port uri
+ *   -c -- concurrent clients (processes), default 4
+ *   -n -- requests per client, default 1000
+ *   -k -- use keep-alive connection, otherwise connection per request
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static int connectTo(const char *host, const char *port) {
+    struct addrinfo hints, *res;
+    int fd, one = 1;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host, port, &hints, &res)) return -1;
+    fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if(fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if(fd >= 0) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// reads one reply, Content-Length and chunked bodies are supported
+static bool readReply(int fd, std::string& buf, bool *closing) {
+    char tmp[16384];
+    std::string::size_type hend;
+    while((hend = buf.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t n = read(fd, tmp, sizeof(tmp));
+        if(n <= 0) return false;
+        buf.append(tmp, n);
+    }
+    std::string head = buf.substr(0, hend);
+    for(auto &c : head) c = tolower(c);
+    *closing = head.find("connection: close") != std::string::npos;
+    size_t pos = hend + 4;
+    std::string::size_type cl = head.find("content-length:");
+    if(cl != std::string::npos) {
+        size_t len = strtoul(head.c_str() + cl + 15, 0, 10);
+        while(buf.size() < pos + len) {
+            ssize_t n = read(fd, tmp, sizeof(tmp));
+            if(n <= 0) return false;
+            buf.append(tmp, n);
+        }
+        buf.erase(0, pos + len);
+        return true;
+    }
+    if(head.find("transfer-encoding: chunked") != std::string::npos) {
+        while(1) {
+            std::string::size_type eol;
+            while((eol = buf.find("\r\n", pos)) == std::string::npos) {
+                ssize_t n = read(fd, tmp, sizeof(tmp));
+                if(n <= 0) return false;
+                buf.append(tmp, n);
+            }
+            size_t len = strtoul(buf.c_str() + pos, 0, 16);
+            size_t need = eol + 2 + len + 2;
+            while(buf.size() < need) {
+                ssize_t n = read(fd, tmp, sizeof(tmp));
+                if(n <= 0) return false;
+                buf.append(tmp, n);
+            }
+            pos = need;
+            if(len == 0) break;
+        }
+        buf.erase(0, pos);
+        return true;
+    }
+    // no length: reply ends with connection
+    while(1) {
+        ssize_t n = read(fd, tmp, sizeof(tmp));
+        if(n <= 0) break;
+    }
+    buf.clear();
+    return true;
+}
+
+static int runClient(int num, const char *host, const char *port, const char *uri,
+                     int requests, bool keepalive, int pipefd)
+{
+    std::vector<double> lat;
+    std::string req("GET ");
+    std::string buf;
+    int fd = -1, errors = 0;
+    bool closing = false;
+
+    req.append(uri);
+    req.append(" HTTP/1.1\r\nHost: ");
+    req.append(host);
+    req.append(keepalive ? "\r\n\r\n" : "\r\nConnection: close\r\n\r\n");
+
+    for(int i = 0; i < requests; i++) {
+        double start = now();
+        if(fd < 0) {
+            fd = connectTo(host, port);
+            buf.clear();
+        }
+        if(fd < 0 || write(fd, req.data(), req.size()) != (ssize_t)req.size() || !readReply(fd, buf, &closing)) {
+            errors++;
+            if(fd >= 0) close(fd);
+            fd = -1;
+            continue;
+        }
+        lat.push_back(now() - start);
+        if(!keepalive || closing) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if(fd >= 0) close(fd);
+    lat.push_back(errors); // the last one is errors count
+    if(write(pipefd, &lat[0], lat.size() * sizeof(double)) < 0) perror("write");
+    return 0;
+}
+
+int main(int ac, char **av) {
+    int clients = 4, requests = 1000, opt;
+    bool keepalive = false;
+
+    while((opt = getopt(ac, av, "c:n:k")) != -1) {
+        switch(opt) {
+        case 'c': clients = atoi(optarg); break;
+        case 'n': requests = atoi(optarg); break;
+        case 'k': keepalive = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-c clients] [-n requests] [-k] host port uri\n", av[0]);
+            return EINVAL;
+        }
+    }
+    if(ac - optind != 3 || clients <= 0 || requests <= 0) {
+        fprintf(stderr, "usage: %s [-c clients] [-n requests] [-k] host port uri\n", av[0]);
+        return EINVAL;
+    }
+
+    std::vector<int> pipes;
+    double start = now();
+    for(int i = 0; i < clients; i++) {
+        int pfd[2];
+        if(pipe(pfd) < 0) {
+            perror("pipe");
+            return errno;
+        }
+        if(fork() == 0) {
+            close(pfd[0]);
+            exit(runClient(i, av[optind], av[optind+1], av[optind+2], requests, keepalive, pfd[1]));
+        }
+        close(pfd[1]);
+        pipes.push_back(pfd[0]);
+    }
+
+    std::vector<double> lat;
+    int errors = 0;
+    for(auto fd : pipes) {
+        std::vector<double> part(requests + 1);
+        size_t got = 0, want = part.size() * sizeof(double);
+        ssize_t n;
+        while(got < want && (n = read(fd, (char*)&part[0] + got, want - got)) > 0) got += n;
+        close(fd);
+        size_t cnt = got / sizeof(double);
+        if(cnt == 0) continue;
+        errors += (int)part[cnt-1];
+        lat.insert(lat.end(), part.begin(), part.begin() + cnt - 1);
+    }
+    while(wait(0) > 0);
+    double elapsed = (now() - start) / 1e6;
+
+    if(lat.empty()) {
+        fprintf(stderr, "no successful requests, %d errors\n", errors);
+        return 1;
+    }
+    std::sort(lat.begin(), lat.end());
+    double sum = 0;
+    for(auto v : lat) sum += v;
+    printf("requests: %zu, errors: %d, %s, %.1f req/s\n", lat.size(), errors,
+           keepalive ? "keep-alive" : "connection per request", lat.size() / elapsed);
+    printf("latency, us: min %.0f avg %.0f p50 %.0f p90 %.0f p99 %.0f max %.0f\n",
+           lat.front(), sum / lat.size(), lat[lat.size() / 2], lat[lat.size() * 9 / 10],
+           lat[lat.size() * 99 / 100], lat.back());
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+/**
+ * @file   httpcachetest.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Mon Oct 19 15:02:44 2026
+ *
+ * @brief  Freshness and validators of the upstream replies taken from their
+ *         headers: max-age and Age, Expires against Date, no-store,
+ *         no-cache, and the lifetime kept by 304 Not Modified
+ *
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <boost/property_tree/ptree.hpp>
+#include "httpcache.hpp"
+
+namespace pt = boost::property_tree;
+pt::ptree *cpt;                      // property tree: global configuration
+
+static int failures = 0;
+
+// lifetime is exact, expires is now + lifetime give or take a second
+static void check(const char *what, const std::string& headers, httpCacheEntry_t& entry,
+                  bool storable, long lifetime) {
+    const time_t before = time(nullptr);
+    const bool rv = httpCacheControl(headers, entry);
+    const time_t after = time(nullptr);
+    bool ok = rv == storable && entry.lifetime == lifetime;
+    if(lifetime) ok = ok && entry.expires >= before + lifetime && entry.expires <= after + lifetime;
+    else ok = ok && entry.expires == 0;
+    if(!ok) {
+        std::cerr << what << ": storable " << rv << ", lifetime " << entry.lifetime << ", expires in "
+                  << (entry.expires ? (long)(entry.expires - before) : 0L) << "; expected storable "
+                  << storable << ", lifetime " << lifetime << std::endl;
+        failures++;
+    }
+}
+
+static void checkValidator(const char *what, const std::string& value, const char *expected) {
+    if(value != expected) {
+        std::cerr << what << ": '" << value << "', expected '" << expected << "'" << std::endl;
+        failures++;
+    }
+}
+
+int main(int ac, char **av) {
+    {
+        httpCacheEntry_t e;
+        check("max-age", "Cache-Control: public, max-age=60\r\n", e, true, 60);
+    }
+    {
+        httpCacheEntry_t e;
+        check("max-age and Age", "Cache-Control: max-age=60\r\nAge: 10\r\n", e, true, 50);
+    }
+    {
+        httpCacheEntry_t e;
+        check("Age over max-age", "Cache-Control: max-age=60\r\nAge: 90\r\n", e, false, 0);
+    }
+    {
+        // the upstream clock is not ours: the lifetime is Expires - Date
+        httpCacheEntry_t e;
+        check("Expires and Date", "Date: Mon, 26 Oct 2026 10:00:00 GMT\r\n"
+              "Expires: Mon, 26 Oct 2026 10:05:00 GMT\r\n", e, true, 300);
+    }
+    {
+        httpCacheEntry_t e;
+        check("max-age over Expires", "Date: Mon, 26 Oct 2026 10:00:00 GMT\r\n"
+              "Expires: Mon, 26 Oct 2026 10:05:00 GMT\r\ncache-control: max-age=30\r\n", e, true, 30);
+    }
+    {
+        httpCacheEntry_t e;
+        check("invalid Expires", "Expires: 0\r\n", e, false, 0);
+    }
+    {
+        httpCacheEntry_t e;
+        check("no-store", "Cache-Control: no-store, max-age=60\r\nETag: \"a\"\r\n", e, false, 0);
+    }
+    {
+        // revalidated every time, kept for the validator
+        httpCacheEntry_t e;
+        check("no-cache with ETag", "Cache-Control: no-cache\r\nETag: \"v1\"\r\n", e, true, 0);
+        checkValidator("no-cache ETag", e.etag, "\"v1\"");
+    }
+    {
+        httpCacheEntry_t e;
+        check("no-cache", "Cache-Control: no-cache\r\n", e, false, 0);
+    }
+    {
+        httpCacheEntry_t e;
+        check("maxttl", "Cache-Control: max-age=999999\r\n", e, true, HTTPCACHE_MAXTTL);
+    }
+    {
+        // 304 without freshness keeps the lifetime and the validators of the entry
+        httpCacheEntry_t e;
+        check("200", "Cache-Control: max-age=120\r\nETag: \"v1\"\r\n"
+              "Last-Modified: Mon, 26 Oct 2026 10:00:00 GMT\r\n", e, true, 120);
+        e.expires = 0;
+        check("304", "Server: upstream\r\n", e, true, 120);
+        checkValidator("304 ETag", e.etag, "\"v1\"");
+        checkValidator("304 Last-Modified", e.lastModified, "Mon, 26 Oct 2026 10:00:00 GMT");
+        check("304 with max-age", "ETag: \"v2\"\r\nCache-Control: max-age=30\r\n", e, true, 30);
+        checkValidator("304 new ETag", e.etag, "\"v2\"");
+    }
+    {
+        httpCacheEntry_t e;
+        check("no freshness", "Content-Type: text/plain\r\n", e, false, 0);
+    }
+
+    std::cout << (failures ? "FAILED" : "OK") << std::endl;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,114 @@
+/**
+ * @file   iobench.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Mon Oct 19 20:41:05 2026
+ *
+ * @brief  Batched child I/O benchmark: each "request" writes some files and
+ *         sends the reply to a socket. Runs the plain I/O and, if available,
+ *         the io_uring backend, reports system calls per request and latency.
+ *
+ *   iobench [-n requests] [-f files] [-s filesize] [-r replysize] [-d dir]
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "apputils.hpp"
+#include "aio.hpp"
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static int run(bool useUring, int requests, int files, size_t filesize,
+               size_t replysize, const std::string& dir)
+{
+    int sv[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        perror("socketpair");
+        return errno;
+    }
+    pid_t reader = fork();
+    if(reader == 0) {
+        char buf[65536];
+        close(sv[0]);
+        while(read(sv[1], buf, sizeof(buf)) > 0);
+        _exit(0);
+    }
+    close(sv[1]);
+
+    CIoBatch batch;
+    if(batch.init(useUring) != useUring) {
+        printf("io_uring: not available\n");
+        close(sv[0]);
+        waitpid(reader, 0, 0);
+        return 0;
+    }
+
+    std::vector<double> lat;
+    std::string reply(replysize, 'r');
+    int errors = 0;
+    for(int i = 0; i < requests; i++) {
+        double start = now();
+        for(int f = 0; f < files; f++) {
+            std::string data(filesize, 'f');
+            if(batch.writeFile(dir + "/iobench." + std::to_string(f) + ".out", data)) errors++;
+        }
+        struct iovec iov;
+        iov.iov_base = &reply[0];
+        iov.iov_len = reply.size();
+        if(!batch.sendv(sv[0], &iov, 1)) errors++;
+        lat.push_back(now() - start);
+    }
+    close(sv[0]);
+    waitpid(reader, 0, 0);
+    for(int f = 0; f < files; f++) unlink((dir + "/iobench." + std::to_string(f) + ".out").c_str());
+
+    const ioStats_t& st = batch.get_stats();
+    std::sort(lat.begin(), lat.end());
+    double sum = 0;
+    for(auto v : lat) sum += v;
+    printf("%s: requests %d, errors %d, syscalls/request %.2f, submissions/request %.2f\n",
+           useUring ? "io_uring" : "plain", requests, errors,
+           (double)st.syscalls / requests, (double)st.batches / requests);
+    printf("latency, us: avg %.1f p50 %.1f p99 %.1f max %.1f\n",
+           sum / lat.size(), lat[lat.size() / 2], lat[lat.size() * 99 / 100], lat.back());
+    return errors ? 1 : 0;
+}
+
+int main(int ac, char **av) {
+    int requests = 10000, files = 2, opt;
+    size_t filesize = 4096, replysize = 8192;
+    std::string dir("/tmp");
+
+    while((opt = getopt(ac, av, "n:f:s:r:d:")) != -1) {
+        switch(opt) {
+        case 'n': requests = atoi(optarg); break;
+        case 'f': files = atoi(optarg); break;
+        case 's': filesize = strtoul(optarg, 0, 10); break;
+        case 'r': replysize = strtoul(optarg, 0, 10); break;
+        case 'd': dir = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-n requests] [-f files] [-s filesize] [-r replysize] [-d dir]\n", av[0]);
+            return EINVAL;
+        }
+    }
+    if(requests <= 0 || files < 0 || replysize == 0) {
+        fprintf(stderr, "usage: %s [-n requests] [-f files] [-s filesize] [-r replysize] [-d dir]\n", av[0]);
+        return EINVAL;
+    }
+
+    int rv = run(false, requests, files, filesize, replysize, dir);
+    return rv | run(true, requests, files, filesize, replysize, dir);
+}
@@ -0,0 +1,62 @@
+/**
+ * @file   memotest.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Wed Oct 28 10:14:52 2026
+ *
+ * @brief  Query result memoized in the state cache and unpacked again: the
+ *         $name and $N variables resolve as they do for the database row
+ *
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <boost/property_tree/ptree.hpp>
+#include "database.hpp"
+#include "statecache.hpp"
+
+namespace pt = boost::property_tree;
+pt::ptree *cpt;                      // property tree: global configuration
+
+static int failures = 0;
+
+static void check(const CQueryResult& qr, const std::string& var, const char *expected) {
+    char *value = qr.getPropositional(var);
+    if((!value && expected) || (value && !expected) || (value && strcmp(value, expected))) {
+        std::cerr << var << ": '" << (value ? value : "(null)") << "', expected '"
+                  << (expected ? expected : "(null)") << "'" << std::endl;
+        failures++;
+    }
+    free(value);
+}
+
+int main(int ac, char **av) {
+    // the row as packQResult stores it: names, then values
+    std::string memo("");
+    memoPack(memo, "id");
+    memoPack(memo, "name");
+    memoPack(memo, "comment");
+    memoPack(memo, "42");
+    memoPack(memo, std::string("Smarty"));
+    memoPack(memo, (const char*)nullptr);
+
+    CMemoResult qr(memo);
+    if(!qr.is_valid() || qr.columns() != 3) {
+        std::cerr << "memo is not unpacked" << std::endl;
+        return 1;
+    }
+    check(qr, "$id", "42");
+    check(qr, "$name", "Smarty");
+    check(qr, "$comment", "");       // NULL is an empty string
+    check(qr, "$nam", nullptr);
+    check(qr, "$names", nullptr);
+    check(qr, "$1", "Smarty");         // columns are counted from 0
+    if(strcmp(qr.name(1), "name")) {
+        std::cerr << "name(1): '" << qr.name(1) << "'" << std::endl;
+        failures++;
+    }
+
+    std::cout << (failures ? "FAILED" : "OK") << std::endl;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,87 @@
+/**
+ * @file   pgbatch.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Thu Oct 22 12:40:31 2026
+ *
+ * @brief  Round trips of the independent lookups: one work transaction per
+ *         query (the old query state), autocommit per query and all the
+ *         queries in one pipeline (batch state). Needs a Postgres server.
+ *
+ *   pgbatch [-c conninfo] [-n iterations] [-q queries]
+ */
+
+#include <sys/time.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <pqxx/pqxx>
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static std::string lookup(int i) {
+    return "select relname from pg_class where oid = " + std::to_string(1259 + i % 3);
+}
+
+static void report(const char *name, double usec, int iterations) {
+    printf("%-14s %8.1f usec per request\n", name, usec / iterations);
+}
+
+int main(int argc, char **argv) {
+    std::string conninfo("dbname=smarty user=smarty password=smarty host=127.0.0.1");
+    int iterations = 1000, queries = 4, opt;
+    while((opt = getopt(argc, argv, "c:n:q:")) != -1) {
+        switch(opt) {
+        case 'c': conninfo = optarg; break;
+        case 'n': iterations = atoi(optarg); break;
+        case 'q': queries = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-c conninfo] [-n iterations] [-q queries]\n", argv[0]);
+            return 1;
+        }
+    }
+    try {
+        pqxx::connection conn(conninfo);
+        double start;
+
+        start = now();
+        for(int n = 0; n < iterations; n++) {
+            for(int i = 0; i < queries; i++) {
+                pqxx::work w(conn);
+                w.exec(lookup(i));
+                w.commit();
+            }
+        }
+        report("work", now() - start, iterations);
+
+        start = now();
+        for(int n = 0; n < iterations; n++) {
+            for(int i = 0; i < queries; i++) {
+                pqxx::nontransaction w(conn);
+                w.exec(lookup(i));
+            }
+        }
+        report("nontransaction", now() - start, iterations);
+
+        start = now();
+        for(int n = 0; n < iterations; n++) {
+            pqxx::nontransaction w(conn);
+            pqxx::pipeline pipe(w);
+            std::vector<pqxx::pipeline::query_id> ids;
+            for(int i = 0; i < queries; i++) ids.push_back(pipe.insert(lookup(i)));
+            pipe.complete();
+            for(const auto &it : ids) pipe.retrieve(it);
+        }
+        report("pipeline", now() - start, iterations);
+    }
+    catch(const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file   sfbench.cpp
+ * @author Gleb Semenov <gleb.semenov@gmail.com>
+ * @date   Tue Oct 20 21:03:52 2026
+ *
+ * @brief  Cache expiry stampede: the children request a few popular keys at
+ *         the same moment the cached entries expire, the "upstream" call is
+ *         a sleep. Reports upstream calls per key with and without
+ *         singleflight coalescing.
+ *
+ *   sfbench [-c children] [-k keys] [-r rounds] [-u upstream_ms]
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "shmcache.hpp"
+#include "singleflight.hpp"
+
+// the way CQueryState and CHttpState use the cache
+static void request(CShmCache& cache, const std::string& key, unsigned upstream, unsigned long *calls) {
+    std::string data;
+    if(cache.get(key, data)) return;
+    CScopedFlight flight;
+    if(flight.join(key) && cache.get(key, data)) return;
+    __sync_fetch_and_add(calls, 1);
+    usleep(upstream * 1000);
+    cache.put(key, "result of " + key, 2);
+}
+
+static unsigned long run(bool coalesce, int children, int keys, int rounds, unsigned upstream) {
+    CShmCache cache;
+    unsigned long *calls = (unsigned long*)mmap(nullptr, sizeof(unsigned long), PROT_READ|PROT_WRITE,
+                                                MAP_ANON|MAP_SHARED, -1, 0);
+    *calls = 0;
+    cache.create("sfbench", 1024*1024, 256);
+    if(coalesce) singleFlight.create(SINGLEFLIGHT_WAIT, false);
+
+    for(int c = 0; c < children; c++) {
+        if(fork() == 0) {
+            for(int r = 0; r < rounds; r++) {
+                // all the children wake up right after the entries expire
+                sleep(3);
+                for(int k = 0; k < keys; k++)
+                    request(cache, "key" + std::to_string((k + c) % keys), upstream, calls);
+            }
+            _exit(0);
+        }
+    }
+    while(wait(nullptr) > 0);
+
+    unsigned long total = *calls;
+    printf("%-12s children %d, keys %d, rounds %d: %lu upstream calls, %.1f per key\n",
+           coalesce ? "singleflight" : "plain", children, keys, rounds, total,
+           (double)total / (keys * rounds));
+    if(coalesce) {
+        singleFlight.logStats();
+        singleFlight.destroy();
+    }
+    cache.destroy();
+    munmap(calls, sizeof(unsigned long));
+    return total;
+}
+
+int main(int argc, char **argv) {
+    int children = 32, keys = 4, rounds = 3, opt;
+    unsigned upstream = 50;
+    while((opt = getopt(argc, argv, "c:k:r:u:")) != -1) {
+        switch(opt) {
+        case 'c': children = atoi(optarg); break;
+        case 'k': keys = atoi(optarg); break;
+        case 'r': rounds = atoi(optarg); break;
+        case 'u': upstream = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-c children] [-k keys] [-r rounds] [-u upstream_ms]\n", argv[0]);
+            return 1;
+        }
+    }
+    run(false, children, keys, rounds, upstream);
+    return run(true, children, keys, rounds, upstream) == (unsigned long)(keys * rounds) ? 0 : 1;
+}